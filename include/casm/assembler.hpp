@@ -1,5 +1,11 @@
 #pragma once
 #include "casm/parser.hpp"
+#include "casm/buffer.hpp"
+#include "casm/symbols.hpp"
+#include "casm/optimizer.hpp"
+#include "casm/regalloc.hpp"
+#include "casm/cfg.hpp"
+#include "casm/expression.hpp"
 #include <coil/coil.hpp>
 #include <coil/instr.hpp>
 #include <coil/obj.hpp>
@@ -10,6 +16,8 @@
 #include <variant>
 #include <optional>
 #include <functional>
+#include <array>
+#include <algorithm>
 
 namespace casm {
 
@@ -47,11 +55,27 @@ public:
      */
     struct Options {
         bool verbose = false;              // Enable verbose output
-        bool optimize = false;             // Enable optimization
+        bool optimize = false;             // Enable statement-level optimization passes
         bool allowUnresolvedSymbols = false; // Allow unresolved symbols (for linking)
         bool emitDebugInfo = false;        // Emit debug information
+        bool compactEncoding = false;      // Variable-length operands (smallest width per value)
+        size_t inlineLimit = Optimizer::DEFAULT_INLINE_LIMIT; // Largest function body inlined when optimizing, 0 for none
+        bool orderFunctions = false;       // Place functions next to their callers, by call graph
+        Profile profile;                   // Block counts to lay out functions and weight calls by
+        u32 registerCount = 16;            // Physical registers %r0 to %rN-1 virtual registers may use
     };
 
+    /**
+     * @brief Relocation type written to the COIL relocation table
+     */
+    enum class RelocationType : u8 {
+        Absolute = 1,  // Field holds S + A
+        Relative = 2   // Field holds S + A - P, P being the end of the field
+    };
+    
+    // Section index of exported constants, which belong to no section (SHN_ABS in ELF)
+    static constexpr u16 ABSOLUTE_SECTION_INDEX = 0xFFF1;
+    
     /**
      * @brief Construct an assembler with optional configuration
      * @param options Configuration options
@@ -79,6 +103,18 @@ public:
      */
     const std::vector<std::string>& getErrors() const { return m_errors; }
     
+    /**
+     * @brief Get the rewrites applied by the optimizer in the last assembly
+     * @return Rewrite counts, all zero unless Options::optimize or Options::orderFunctions is set
+     */
+    const OptimizationStats& getOptimizationStats() const { return m_optimizationStats; }
+    
+    /**
+     * @brief Get where the last assembly placed virtual registers
+     * @return Allocation of each function using virtual registers
+     */
+    const std::vector<FunctionAllocation>& getRegisterAllocations() const { return m_registerAllocations; }
+    
     /**
      * @brief Set error handler
      * @param handler Function to call when errors occur
@@ -104,15 +140,46 @@ private:
     struct Symbol;
     struct Section;
     struct RelocationEntry;
+    struct InstructionLayout;
+    struct LayoutItem;
     class AssemblyContext;
     
+    // Encoded instruction header: opcode, flags, operand types, encoding form
+    static constexpr size_t INSTRUCTION_HEADER_SIZE = 4;
+    
+    // Encoded size of a register, immediate, memory or absolute label operand
+    static constexpr size_t OPERAND_SIZE = 4;
+    
+    // Widest operand payload in the compact encoding: a memory operand with 8-byte base and offset
+    static constexpr size_t MAX_OPERAND_SIZE = 16;
+    
+    // Largest encoded instruction in either encoding: header plus three operands
+    static constexpr size_t MAX_INSTRUCTION_SIZE = INSTRUCTION_HEADER_SIZE + 3 * MAX_OPERAND_SIZE;
+    
     /**
-     * @brief Symbol information
+     * @brief Displacement form of a relaxable branch (jmp, br, call)
+     * 
+     * Stored in the fourth header byte of the encoded instruction. Forms other
+     * than None encode the target as a PC-relative displacement measured from
+     * the end of the instruction.
+     */
+    enum class BranchForm : u8 {
+        None = 0,      // Not relaxable, target encoded as a regular operand
+        Rel8 = 1,      // 8-bit displacement
+        Rel16 = 2,     // 16-bit displacement
+        Rel32 = 3      // 32-bit displacement
+    };
+    
+    // Dense section identifier, assigned in creation order
+    using SectionId = u32;
+    static constexpr SectionId NO_SECTION = ~SectionId{0};
+    
+    /**
+     * @brief Symbol information, keyed by name in the context's symbol table
      */
     struct Symbol {
-        std::string name;          // Symbol name
         u64 value = 0;             // Symbol value (usually offset)
-        std::string section;       // Section name
+        SectionId section = NO_SECTION; // Defining section
         coil::SymbolType type = coil::SymbolType::NoType;  // Symbol type
         coil::SymbolBinding binding = coil::SymbolBinding::Local; // Symbol binding
         bool defined = false;      // Whether symbol is defined
@@ -120,16 +187,101 @@ private:
     };
     
     /**
-     * @brief Relocation entry for symbol references
+     * @brief Named constant defined by .equ or .set, never emitted unless exported
+     */
+    struct Constant {
+        ExpressionPtr expr;            // Defining expression
+        std::optional<i64> value;      // Value, once the expression could be evaluated
+        bool redefinable = false;      // Defined by .set
+    };
+    
+    // Relocation kind byte: field size in bytes in the low nibble, PC-relative flag in the high bit
+    static constexpr u8 RELOC_SIZE_MASK = 0x0F;
+    static constexpr u8 RELOC_RELATIVE = 0x80;
+    
+    static constexpr u8 packRelocKind(size_t size, bool relative) {
+        return static_cast<u8>((size & RELOC_SIZE_MASK) | (relative ? RELOC_RELATIVE : 0));
+    }
+    
+    /**
+     * @brief Relocation entry for symbol references, kept compact for large inputs
      */
     struct RelocationEntry {
-        std::string symbolName;    // Referenced symbol name
-        std::string sectionName;   // Section containing the reference
-        size_t offset;             // Offset within section
-        size_t size;               // Size of reference in bytes
-        bool isRelative;           // Whether it's a PC-relative reference
-        int64_t addend;            // Value to add to symbol value
-        SourceLocation location;   // Where the reference occurred
+        u32 offset;                // Offset of the field within its section
+        SymbolId symbol;           // Referenced symbol
+        SectionId section;         // Section containing the field
+        u8 kind;                   // Packed field size and PC-relative flag
+        i64 addend;                // Value to add to symbol value
+        
+        size_t size() const { return kind & RELOC_SIZE_MASK; }
+        bool isRelative() const { return (kind & RELOC_RELATIVE) != 0; }
+    };
+    
+    /**
+     * @brief Assembly pass a directive is processed in
+     */
+    enum class Pass {
+        Layout,    // First pass - record sizes in the layout stream
+        Emit       // Second pass - emit bytes into the section
+    };
+    
+    struct DirectiveDescriptor;
+    
+    /**
+     * @brief Directive handler, shared by both passes
+     */
+    using DirectiveHandler = void (Assembler::*)(const Directive&, const DirectiveDescriptor&,
+                                                 Pass, AssemblyContext&);
+    
+    /**
+     * @brief Static description of a directive, indexed by DirectiveKind
+     */
+    struct DirectiveDescriptor {
+        size_t elementSize;            // Bytes per operand for data directives
+        coil::ValueType valueType;     // Value type for numeric data directives
+        bool labelsData;               // Whether a label on the line marks emitted data
+        DirectiveHandler handler;      // Handler, or nullptr if unsupported
+    };
+    
+    // Directive descriptor table
+    static const std::array<DirectiveDescriptor, static_cast<size_t>(DirectiveKind::Count)> DIRECTIVES;
+    
+    /**
+     * @brief Layout of a single instruction, computed in the first pass
+     */
+    struct InstructionLayout {
+        SectionId section = NO_SECTION; // Section containing the instruction
+        size_t offset = 0;         // Offset within the section
+        size_t size = 0;           // Exact encoded size in bytes
+        size_t baseSize = 0;       // Encoded size without the branch target
+        BranchForm form = BranchForm::None; // Displacement form for branches
+        std::string target;        // Branch target label (relaxable branches only)
+        SymbolId targetId = NO_SYMBOL; // Resolved branch target, set by relaxation
+    };
+    
+    /**
+     * @brief Entry in a section's layout stream
+     */
+    struct LayoutItem {
+        enum class Kind {
+            Fixed,         // Fixed number of bytes (data directives)
+            Zero,          // Run of zero bytes (.zero)
+            Align,         // Zero padding up to an alignment boundary
+            Instruction,   // Instruction, sized by its InstructionLayout
+            Label          // Label definition at the current offset
+        };
+        
+        Kind kind;
+        size_t value = 0;          // Byte count, alignment, instruction index, or symbol ID
+    };
+    
+    /**
+     * @brief Run of zero bytes kept out of a section's data buffer
+     */
+    struct ZeroRun {
+        size_t offset;             // Section offset of the first zero byte
+        size_t size;               // Number of zero bytes
+        size_t dataOffset;         // Position in the data buffer the run precedes
     };
     
     /**
@@ -137,28 +289,86 @@ private:
      */
     struct Section {
         std::string name;          // Section name
-        std::vector<u8> data;      // Section data
+        SectionId id = NO_SECTION; // Creation-order index
+        SectionBuffer data;        // Section data, excluding zero runs
+        std::vector<ZeroRun> zeroRuns; // Zero runs, expanded only when writing ProgBits
         size_t currentOffset = 0;  // Current offset in the section
+        size_t dataSize = 0;       // Bytes stored in data, computed by the layout
         coil::SectionType type = coil::SectionType::ProgBits; // Section type
         coil::SectionFlag flags = coil::SectionFlag::None;   // Section flags
         size_t alignment = 1;      // Section alignment
         
+        // Layout stream recorded by the first pass
+        std::vector<LayoutItem> layout;
+        
         // Symbol table
         std::unordered_map<std::string, size_t> symbols;
         
+        // Reserve count zero bytes without storing them
+        void addZeros(size_t count) {
+            if (count == 0) {
+                return;
+            }
+            
+            // NoBits sections only track their size
+            if (type != coil::SectionType::NoBits) {
+                if (!zeroRuns.empty() && zeroRuns.back().dataOffset == data.size()) {
+                    zeroRuns.back().size += count;
+                } else {
+                    zeroRuns.push_back({currentOffset, count, data.size()});
+                }
+            }
+            currentOffset += count;
+        }
+        
+        // Section contents with zero runs expanded
+        std::vector<u8> materialize() const {
+            std::vector<u8> bytes(currentOffset, 0);
+            
+            size_t copied = 0;
+            u8* dest = bytes.data();
+            for (const ZeroRun& run : zeroRuns) {
+                data.read(copied, dest, run.dataOffset - copied);
+                dest += run.dataOffset - copied + run.size;
+                copied = run.dataOffset;
+            }
+            data.read(copied, dest, data.size() - copied);
+            return bytes;
+        }
+        
+        // Section offset to position in the data buffer; the offset must not fall in a zero run
+        size_t dataOffset(size_t offset) const {
+            auto run = std::upper_bound(zeroRuns.begin(), zeroRuns.end(), offset,
+                [](size_t value, const ZeroRun& zero) { return value < zero.offset; });
+            if (run == zeroRuns.begin()) {
+                return offset;
+            }
+            --run;
+            return offset - (run->offset + run->size - run->dataOffset);
+        }
+        
+        // Overwrite emitted bytes at a section offset
+        void patch(size_t offset, const u8* bytes, size_t count) {
+            data.patch(dataOffset(offset), bytes, count);
+        }
+        
         // Helper method to add data with alignment
         void addData(const std::vector<u8>& newData, size_t align = 1) {
             // Pad to alignment if needed
             if (align > 1) {
-                size_t padding = (align - (currentOffset % align)) % align;
-                data.insert(data.end(), padding, 0);
-                currentOffset += padding;
+                addZeros((align - (currentOffset % align)) % align);
             }
             
-            data.insert(data.end(), newData.begin(), newData.end());
+            data.append(newData.data(), newData.size());
             currentOffset += newData.size();
         }
         
+        // Helper method to append raw bytes
+        void addBytes(const u8* bytes, size_t count) {
+            data.append(bytes, count);
+            currentOffset += count;
+        }
+        
         // Helper method to add a single byte
         void addByte(u8 value) {
             data.push_back(value);
@@ -168,12 +378,10 @@ private:
         // Add bytes with necessary padding for alignment
         void addAlignedBytes(const std::vector<u8>& bytes, size_t alignment) {
             // Add padding bytes if needed
-            size_t padding = (alignment - (currentOffset % alignment)) % alignment;
-            data.insert(data.end(), padding, 0);
-            currentOffset += padding;
+            addZeros((alignment - (currentOffset % alignment)) % alignment);
             
             // Add actual data
-            data.insert(data.end(), bytes.begin(), bytes.end());
+            data.append(bytes.data(), bytes.size());
             currentOffset += bytes.size();
         }
     };
@@ -188,44 +396,85 @@ private:
         // Section management
         void ensureSection(const std::string& name);
         void switchSection(const std::string& name);
-        Section& getCurrentSection();
-        Section* getSection(const std::string& name);
+        Section& getCurrentSection() {
+            if (!m_currentSection) {
+                ensureSection(".text");
+            }
+            return *m_currentSection;
+        }
+        Section* getSection(const std::string& name) { return m_sections.get(name); }
+        Section* getSection(SectionId id) { return id < m_sections.size() ? &m_sections[id] : nullptr; }
         
         // Symbol management
-        void addSymbol(const std::string& name, const Symbol& symbol);
+        SymbolId addSymbol(const std::string& name, const Symbol& symbol);
         Symbol* getSymbol(const std::string& name);
-        void markSymbolDefined(const std::string& name, u64 value, const std::string& section);
+        Symbol& getSymbol(SymbolId id) { return m_symbols[id]; }
+        SymbolId findSymbol(const std::string& name) const { return m_symbols.find(name); }
+        SymbolId referenceSymbol(const std::string& name) { return m_symbols.intern(name); }
+        const std::string& getSymbolName(SymbolId id) const { return m_symbols.name(id); }
+        void markSymbolDefined(const std::string& name, u64 value, SectionId section);
         void addGlobalSymbol(const std::string& name);
         
+        // Constant management (.equ/.set)
+        void defineConstant(const std::string& name, ExpressionPtr value, bool redefinable);
+        const Constant* getConstant(const std::string& name) const { return m_constants.get(name); }
+        bool isConstant(const std::string& name) const { return m_constants.find(name) != NO_SYMBOL; }
+        i64 getConstantValue(const std::string& name) const;
+        
+        // Evaluate an expression against constants and the laid-out labels, throws AssemblyException
+        i64 evaluate(const Expression& expr) const;
+        
+        // Label offsets are final once branches are relaxed
+        void finishLayout() { m_layoutFinal = true; }
+        
         // Relocation management
         void addRelocation(const RelocationEntry& reloc);
         
+        // Instruction layout management
+        size_t addInstructionLayout(const InstructionLayout& layout);
+        InstructionLayout& getInstructionLayout(size_t index) { return m_instructionLayouts[index]; }
+        std::vector<InstructionLayout>& getInstructionLayouts() { return m_instructionLayouts; }
+        
         // Data operations
-        void addImmediate(const ImmediateValue& value, coil::ValueType type);
+        void addImmediates(const std::vector<std::unique_ptr<Operand>>& operands, coil::ValueType type);
         void addLabelReference(const std::string& label, size_t size, bool isRelative = false, int64_t addend = 0);
         void addString(const std::string& str, bool nullTerminated = false);
         
-        // Get all sections
-        const std::unordered_map<std::string, Section>& getSections() const { return m_sections; }
+        // Get all sections, in creation order and indexed by SectionId
+        const SymbolTable<Section>& getSections() const { return m_sections; }
+        SymbolTable<Section>& getSections() { return m_sections; }
         
-        // Get all symbols
-        const std::unordered_map<std::string, Symbol>& getSymbols() const { return m_symbols; }
+        // Get all symbols, in insertion order
+        const SymbolTable<Symbol>& getSymbols() const { return m_symbols; }
         
         // Get all relocations
         const std::vector<RelocationEntry>& getRelocations() const { return m_relocations; }
+        std::vector<RelocationEntry>& getRelocations() { return m_relocations; }
         
-        // Current section name
-        const std::string& getCurrentSectionName() const { return m_currentSection; }
+        // Current section name and ID
+        const std::string& getCurrentSectionName() { return getCurrentSection().name; }
+        SectionId getCurrentSectionId() { return getCurrentSection().id; }
         
         // Options
         const Options& getOptions() const { return m_options; }
         
     private:
-        std::unordered_map<std::string, Section> m_sections;
-        std::unordered_map<std::string, Symbol> m_symbols;
+        SymbolTable<Section> m_sections;
+        SymbolTable<Symbol> m_symbols;
         std::vector<RelocationEntry> m_relocations;
-        std::string m_currentSection;
+        std::vector<InstructionLayout> m_instructionLayouts;
+        std::vector<u64> m_rawIntegers;    // Scratch buffer for integer data directives
+        std::vector<f64> m_rawFloats;      // Scratch buffer for float data directives
+        Section* m_currentSection = nullptr; // Cached on section switch
+        SymbolTable<Constant> m_constants;
+        mutable size_t m_constantDepth = 0; // Nesting of constant evaluation, bounds cycles
+        bool m_layoutFinal = false;
         const Options& m_options;
+        
+        // Expression evaluation, throws ExpressionException
+        std::optional<SymbolValue> resolveSymbol(const std::string& name) const;
+        i64 constantValue(SymbolId id) const;
+        i64 evaluateExpression(const Expression& expr) const;
     };
     
     // Implementation methods
@@ -237,6 +486,105 @@ private:
      */
     void collectSymbols(const std::vector<Statement>& statements, AssemblyContext& ctx);
     
+    /**
+     * @brief Define a label at the current position during the first pass
+     * @param label Label name
+     * @param ctx Assembly context
+     */
+    void defineLabel(const std::string& label, AssemblyContext& ctx);
+    
+    /**
+     * @brief Record an instruction in the current section's layout stream
+     * @param instruction Instruction to lay out
+     * @param ctx Assembly context
+     */
+    void layoutInstruction(const Instruction& instruction, AssemblyContext& ctx);
+    
+    /**
+     * @brief Assign section offsets to all layout items and label symbols
+     * @param ctx Assembly context
+     */
+    void assignOffsets(AssemblyContext& ctx);
+    
+    /**
+     * @brief Iteratively grow branch displacement forms until every branch reaches its target
+     * @param ctx Assembly context
+     */
+    void relaxBranches(AssemblyContext& ctx);
+    
+    /**
+     * @brief Compute the exact encoded size of an instruction
+     * @param instruction Instruction to measure
+     * @param form Displacement form of the branch target, if any
+     * @param compact Whether the compact encoding is used
+     * @return Size in bytes (0 if the instruction cannot be encoded)
+     */
+    static size_t instructionSize(const Instruction& instruction, BranchForm form = BranchForm::None,
+                                  bool compact = false);
+    
+    /**
+     * @brief Compute the payload size of an operand in the compact encoding
+     * @param operand Operand to measure (label operands are 4-byte relocation fields)
+     * @return Size in bytes
+     */
+    static size_t compactOperandSize(const Operand& operand);
+    
+    /**
+     * @brief Check whether an operand's value depends on symbols
+     * @param operand Operand to check (label references and expressions naming symbols)
+     * @return true if the operand is sized before its value is known and keeps a fixed width
+     */
+    static bool isSymbolicOperand(const Operand& operand);
+    
+    /**
+     * @brief Get the smallest of 1, 2, 4 or 8 bytes holding a signed value
+     * @param value Value to fit
+     * @return Width in bytes
+     */
+    static size_t signedWidth(i64 value);
+    
+    /**
+     * @brief Get the smallest of 1, 2, 4 or 8 bytes holding an unsigned value
+     * @param value Value to fit
+     * @return Width in bytes
+     */
+    static size_t unsignedWidth(u64 value);
+    
+    /**
+     * @brief Parse the index of a register name
+     * @param name Register name (e.g., "r0", "r1")
+     * @return Register index, or nullopt if the name is invalid
+     */
+    static std::optional<u32> parseRegisterIndex(const std::string& name);
+    
+    /**
+     * @brief Check whether an instruction is a branch whose target can be relaxed
+     * @param instruction Instruction to check
+     * @return True for jmp, br and call with a single label operand
+     */
+    static bool isRelaxableBranch(const Instruction& instruction);
+    
+    /**
+     * @brief Get the number of displacement bytes used by a branch form
+     * @param form Branch form
+     * @return Displacement size in bytes
+     */
+    static size_t displacementSize(BranchForm form);
+    
+    /**
+     * @brief Get the smallest branch form that can hold a displacement
+     * @param displacement PC-relative displacement
+     * @return Smallest sufficient branch form
+     */
+    static BranchForm formForDisplacement(i64 displacement);
+    
+    /**
+     * @brief Look up the COIL opcode for an instruction mnemonic
+     * @param name Lowercase instruction name
+     * @return Opcode, or nullopt if the mnemonic is unknown
+     */
+    static std::optional<coil::Opcode> lookupOpcode(const std::string& name);
+    
     /**
      * @brief Second pass - generate code and resolve references
      * @param statements Statements to process
@@ -244,6 +592,12 @@ private:
      */
     void generateCode(const std::vector<Statement>& statements, AssemblyContext& ctx);
     
+    /**
+     * @brief Patch every reference resolvable at assembly time, keeping the rest as relocations
+     * @param ctx Assembly context
+     */
+    void resolveRelocations(AssemblyContext& ctx);
+    
     /**
      * @brief Generate COIL object from assembly context
      * @param ctx Assembly context
@@ -252,44 +606,87 @@ private:
     coil::Object generateObject(AssemblyContext& ctx);
     
     /**
-     * @brief Process a directive
+     * @brief Process a directive through the descriptor table
      * @param directive Directive to process
      * @param label Optional label
+     * @param pass Pass the directive is processed in
      * @param ctx Assembly context
      */
-    void processDirective(const Directive& directive, const std::string& label, AssemblyContext& ctx);
+    void processDirective(const Directive& directive, const std::string& label, Pass pass, AssemblyContext& ctx);
+    
+    /**
+     * @brief Report a directive diagnostic once, during the layout pass
+     * @param message Error message
+     * @param pass Current pass
+     */
+    void directiveError(const std::string& message, Pass pass);
+    
+    // Directive handlers
+    void handleSection(const Directive& directive, const DirectiveDescriptor& desc, Pass pass, AssemblyContext& ctx);
+    void handleGlobal(const Directive& directive, const DirectiveDescriptor& desc, Pass pass, AssemblyContext& ctx);
+    void handleData(const Directive& directive, const DirectiveDescriptor& desc, Pass pass, AssemblyContext& ctx);
+    void handleString(const Directive& directive, const DirectiveDescriptor& desc, Pass pass, AssemblyContext& ctx);
+    void handleZero(const Directive& directive, const DirectiveDescriptor& desc, Pass pass, AssemblyContext& ctx);
+    void handleAlign(const Directive& directive, const DirectiveDescriptor& desc, Pass pass, AssemblyContext& ctx);
+    void handleConstant(const Directive& directive, const DirectiveDescriptor& desc, Pass pass, AssemblyContext& ctx);
     
     /**
      * @brief Process an instruction
      * @param instruction Instruction to process
      * @param label Optional label
+     * @param layout Layout computed for the instruction in the first pass
      * @param ctx Assembly context
      */
-    void processInstruction(const Instruction& instruction, const std::string& label, AssemblyContext& ctx);
+    void processInstruction(const Instruction& instruction, const std::string& label,
+                            const InstructionLayout& layout, AssemblyContext& ctx);
     
     /**
      * @brief Encode an instruction to binary
      * @param instr COIL instruction
-     * @return Encoded instruction bytes
+     * @param out Output buffer of at least MAX_INSTRUCTION_SIZE bytes
+     * @param form Displacement form of the branch target in dest
+     * @return Number of bytes written
+     */
+    size_t encodeInstruction(const coil::Instruction& instr, u8* out, BranchForm form = BranchForm::None);
+    
+    /**
+     * @brief Encode an instruction with variable-length operands
+     * 
+     * The header matches encodeInstruction, except that the fourth byte also
+     * holds a 2-bit payload width code (1, 2, 4 or 8 bytes) per operand: dest
+     * in bits 2-3, src1 in bits 4-5, src2 in bits 6-7.
+     * 
+     * @param instr COIL instruction
+     * @param out Output buffer of at least MAX_INSTRUCTION_SIZE bytes
+     * @param form Displacement form of the branch target in dest
+     * @param fixedWidthMask Operands (bit per index) that are 4-byte relocation fields
+     * @param memoryOffsets Full offset of each memory operand by index, as COIL keeps only 32 bits
+     * @return Number of bytes written
      */
-    std::vector<u8> encodeInstruction(const coil::Instruction& instr);
+    size_t encodeCompactInstruction(const coil::Instruction& instr, u8* out, BranchForm form, u8 fixedWidthMask,
+                                    const std::array<i64, 3>& memoryOffsets);
     
     /**
      * @brief Convert CASM operand to COIL operand
      * @param operand CASM operand
      * @param ctx Assembly context
+     * @param layout Layout of the instruction the operand belongs to
+     * @param fieldOffset Section offset of the operand's encoded field
      * @param defaultType Default value type
-     * @return COIL operand and any relocations needed
+     * @param memoryOffset Receives the full offset of a memory operand, if not null
+     * @return COIL operand; label references also record a relocation
      */
-    coil::Operand convertOperand(const Operand& operand, AssemblyContext& ctx, 
-                                coil::ValueType defaultType = coil::ValueType::I32);
+    coil::Operand convertOperand(const Operand& operand, AssemblyContext& ctx,
+                                const InstructionLayout& layout, size_t fieldOffset,
+                                coil::ValueType defaultType = coil::ValueType::I32,
+                                i64* memoryOffset = nullptr);
     
     /**
-     * @brief Convert value type string to COIL value type
-     * @param typeStr Type string (e.g., "i32", "f64")
-     * @return COIL value type
+     * @brief Create the immediate for a value computed from symbols or constants
+     * @param value Value, which must fit in the 32-bit field it was laid out with
+     * @return 32-bit immediate operand
      */
-    coil::ValueType stringToValueType(const std::string& typeStr);
+    coil::Operand symbolicImmediate(i64 value);
     
     /**
      * @brief Get register index from name
@@ -314,6 +711,8 @@ private:
     // Member variables
     Options m_options;
     std::vector<std::string> m_errors;
+    OptimizationStats m_optimizationStats;
+    std::vector<FunctionAllocation> m_registerAllocations;
     std::function<void(const std::string&, const SourceLocation&)> m_errorHandler;
 };
 
@@ -0,0 +1,118 @@
+#pragma once
+#include "casm/types.hpp"
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace casm {
+
+/**
+ * @brief Append-only byte buffer made of fixed pages
+ *
+ * Pages are never moved or reallocated once allocated, so growing the buffer
+ * does not copy previously emitted bytes. Bytes can be patched in place at any
+ * offset and read back page by page without building a contiguous copy.
+ */
+class SectionBuffer {
+public:
+  // Smallest and largest page allocated by the buffer
+  static constexpr size_t MIN_PAGE_SIZE = 4096;
+  static constexpr size_t MAX_PAGE_SIZE = 1 << 20;
+
+  SectionBuffer() = default;
+  SectionBuffer(SectionBuffer&&) = default;
+  SectionBuffer& operator=(SectionBuffer&&) = default;
+
+  /**
+   * @brief Get the number of bytes in the buffer
+   * @return Buffer size in bytes
+   */
+  size_t size() const { return m_size; }
+
+  /**
+   * @brief Check whether the buffer holds no bytes
+   * @return True if the buffer is empty
+   */
+  bool empty() const { return m_size == 0; }
+
+  /**
+   * @brief Release all pages
+   */
+  void clear();
+
+  /**
+   * @brief Size the next allocated page(s) to hold count more bytes
+   * @param count Expected number of bytes still to be appended
+   */
+  void reserve(size_t count);
+
+  /**
+   * @brief Append bytes to the end of the buffer
+   * @param bytes Bytes to append
+   * @param count Number of bytes
+   */
+  void append(const u8* bytes, size_t count);
+
+  /**
+   * @brief Append a single byte
+   * @param value Byte to append
+   */
+  void push_back(u8 value) { append(&value, 1); }
+
+  /**
+   * @brief Overwrite bytes already in the buffer
+   * @param offset Offset of the first byte to overwrite
+   * @param bytes Replacement bytes
+   * @param count Number of bytes
+   */
+  void patch(size_t offset, const u8* bytes, size_t count);
+
+  /**
+   * @brief Copy bytes out of the buffer
+   * @param offset Offset of the first byte to copy
+   * @param dest Destination for the bytes
+   * @param count Number of bytes
+   */
+  void read(size_t offset, u8* dest, size_t count) const;
+
+  /**
+   * @brief Get the byte at an offset
+   * @param offset Byte offset
+   * @return Byte value
+   */
+  u8 operator[](size_t offset) const;
+
+  /**
+   * @brief Visit the contents as consecutive spans, one per page
+   * @param visit Callable taking (const u8* bytes, size_t count)
+   */
+  template <typename Visitor>
+  void forEachSpan(Visitor&& visit) const {
+    for (const Page& page : m_pages) {
+      visit(static_cast<const u8*>(page.bytes.get()), page.size);
+    }
+  }
+
+  /**
+   * @brief Gather the contents into a contiguous vector
+   * @return Copy of the buffer contents
+   */
+  std::vector<u8> toVector() const;
+
+private:
+  struct Page {
+    std::unique_ptr<u8[]> bytes;  // Page storage, never reallocated
+    size_t start;                 // Buffer offset of the first byte
+    size_t size;                  // Bytes used
+    size_t capacity;              // Bytes allocated
+  };
+
+  Page& addPage(size_t needed);
+  size_t findPage(size_t offset) const;
+
+  std::vector<Page> m_pages;
+  size_t m_size = 0;
+  size_t m_reserved = 0;          // Bytes announced by reserve() not yet allocated
+};
+
+} // namespace casm
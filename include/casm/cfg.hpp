@@ -0,0 +1,103 @@
+#pragma once
+#include "casm/parser.hpp"
+#include "casm/symbols.hpp"
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace casm {
+
+/**
+ * @brief Straight-line run of statements entered only at the top
+ */
+struct BasicBlock {
+  size_t begin = 0;                   // Index of the first statement
+  size_t end = 0;                     // One past the index of the last statement
+  size_t function = 0;                // Index of the owning function
+  std::vector<std::string> labels;    // Labels defined at the top of the block
+  std::vector<size_t> successors;     // Blocks of the same function control can continue to
+  std::vector<size_t> predecessors;   // Blocks of the same function that can continue here
+  std::vector<std::string> exits;     // Jump targets outside the function (tail jumps)
+  bool returns = false;               // Ends in an unconditional ret
+  bool indirect = false;              // Ends in a jump whose target is not a label
+  bool fallsOut = false;              // Runs off the end of its function
+};
+
+/**
+ * @brief Function: the code from one function entry label to the next
+ */
+struct Function {
+  std::string name;                   // Entry label, empty for code before the first entry
+  std::string section;                // Section holding the function
+  size_t begin = 0;                   // Index of the first statement
+  size_t end = 0;                     // One past the index of the last statement
+  std::vector<size_t> blocks;         // Blocks in source order, the first is the entry
+  std::vector<std::string> callees;   // Labels called from the function, in order of first call
+};
+
+/**
+ * @brief Basic blocks and control-flow edges of a parsed program
+ *
+ * The graph is built from statements, before layout, and refers to them by
+ * index, so it stays valid until the statements are modified. Functions start
+ * at the labels that the assembler marks coil::SymbolType::Func: code labels
+ * declared .global or used as call targets. Instructions before the first such
+ * label in a section form an unnamed function. A function ends at the next
+ * entry label or section change. Blocks start at the function entry, at every
+ * labelled statement and after every jmp, br or ret.
+ */
+class ControlFlowGraph {
+public:
+  static constexpr size_t NO_BLOCK = ~size_t{0};
+  static constexpr size_t NO_FUNCTION = ~size_t{0};
+
+  /**
+   * @brief Build the graph of a program
+   * @param statements Parsed statements
+   * @return Control-flow graph referring to the statements by index
+   */
+  static ControlFlowGraph build(const std::vector<Statement>& statements);
+
+  /**
+   * @brief Find the labels that start functions
+   * @param statements Parsed statements
+   * @return Names of code labels declared .global or used as call targets
+   */
+  static std::unordered_set<std::string> functionEntries(const std::vector<Statement>& statements);
+
+  const std::vector<Function>& getFunctions() const { return m_functions; }
+  const std::vector<BasicBlock>& getBlocks() const { return m_blocks; }
+
+  /**
+   * @brief Find a function by its entry label
+   * @param name Entry label
+   * @return Index of the function, or NO_FUNCTION if absent
+   */
+  size_t findFunction(std::string_view name) const;
+
+  /**
+   * @brief Find the block a label is defined in
+   * @param label Label name
+   * @return Index of the block, or NO_BLOCK if the label is not in a function
+   */
+  size_t findBlock(std::string_view label) const;
+
+  /**
+   * @brief Get the block holding a statement
+   * @param statement Statement index
+   * @return Index of the block, or NO_BLOCK for statements outside functions
+   */
+  size_t blockOf(size_t statement) const {
+    return statement < m_statementBlocks.size() ? m_statementBlocks[statement] : NO_BLOCK;
+  }
+
+private:
+  std::vector<Function> m_functions;
+  std::vector<BasicBlock> m_blocks;
+  std::vector<size_t> m_statementBlocks;  // Block of each statement, NO_BLOCK outside functions
+  SymbolTable<size_t> m_labelBlocks;      // Block of each label defined in a function
+  SymbolTable<size_t> m_functionIndex;    // Function of each entry label
+};
+
+} // namespace casm
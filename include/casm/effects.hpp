@@ -0,0 +1,67 @@
+#pragma once
+#include "casm/parser.hpp"
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace casm {
+
+/**
+ * @brief Registers, memory and flags an instruction reads and writes
+ *
+ * Register operands are referred to by operand index, so passes can rewrite
+ * them in place. Base registers of memory operands are always read.
+ */
+struct InstructionEffects {
+  std::vector<size_t> reads;               // Indices of register operands read
+  std::vector<size_t> writes;              // Indices of register operands written
+  std::vector<std::string> addressReads;   // Base registers of memory operands, lowercase
+  bool loads = false;                      // Reads memory, including pop
+  bool stores = false;                     // Writes memory, including push
+  bool stack = false;                      // push or pop: moves the stack pointer
+  bool setsFlags = false;                  // Arithmetic, cmp and test
+  bool conditional = false;                // Has condition parameters, so reads flags and may do nothing
+  bool clobbers = false;                   // call or unknown: any register or memory may change
+};
+
+/**
+ * @brief Get the effects of an instruction
+ * @param instr Instruction to classify
+ * @return Effects, conservative for instructions the assembler does not know
+ */
+InstructionEffects effectsOf(const Instruction& instr);
+
+/**
+ * @brief Check whether the flags an instruction sets may be read before they are set again
+ *
+ * Scans forward from the instruction. A conditional instruction, a label, a
+ * jump or the end of the range count as reading the flags.
+ * @param statements Statements holding the instruction
+ * @param index Index of the instruction
+ * @param end One past the last statement to scan
+ * @return False only if another instruction sets the flags first
+ */
+bool flagsObserved(const std::vector<Statement>& statements, size_t index, size_t end);
+
+/**
+ * @brief Get the lowercase register name of an operand
+ * @param operand Operand to check
+ * @return Register name without the %, or nullopt if the operand is not a register
+ */
+std::optional<std::string> registerOf(const Operand& operand);
+
+/**
+ * @brief Get the condition parameter that holds exactly when another does not
+ * @param condition Condition parameter without the ^, such as "eq"
+ * @return Inverse condition ("neq" for "eq"), or nullopt if there is none
+ */
+std::optional<std::string> inverseCondition(const std::string& condition);
+
+/**
+ * @brief Check whether a register name is a virtual register (%v0, %v1, ...)
+ * @param name Register name without the %
+ * @return True for virtual registers, which are local to a function
+ */
+bool isVirtualRegister(const std::string& name);
+
+} // namespace casm
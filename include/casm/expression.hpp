@@ -0,0 +1,105 @@
+#pragma once
+#include "casm/types.hpp"
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace casm {
+
+/**
+ * @brief Value a symbol contributes to an expression
+ */
+struct SymbolValue {
+  static constexpr u32 ABSOLUTE = ~u32{0};
+
+  i64 value = 0;              // Constant value, or label offset within its section
+  u32 section = ABSOLUTE;     // Section of a label, ABSOLUTE for constants
+};
+
+/**
+ * @brief Integer expression evaluated at assembly time
+ *
+ * Expressions combine integer literals and @symbol references with
+ * + - * / % << >> & | ^, unary - and ~, and parentheses, with C precedence.
+ * Labels may only appear as the difference of two labels in one section, so
+ * a valid expression always evaluates to a constant.
+ */
+class Expression {
+public:
+  enum class Op : u8 {
+    Literal, Symbol,                        // Leaves
+    Neg, Not,                               // Unary
+    Add, Sub, Mul, Div, Mod,                // Arithmetic
+    Shl, Shr, And, Or, Xor                  // Bitwise
+  };
+
+  using Resolver = std::function<std::optional<SymbolValue>(const std::string&)>;
+
+  static ExpressionPtr literal(i64 value);
+  static ExpressionPtr symbol(std::string name);
+  static ExpressionPtr unary(Op op, ExpressionPtr operand);
+  static ExpressionPtr binary(Op op, ExpressionPtr lhs, ExpressionPtr rhs);
+
+  /**
+   * @brief Parse an expression
+   * @param text Expression source, e.g. "(@end - @start) * 4"
+   * @return Parsed expression, or nullptr if the text is not a valid expression
+   */
+  static ExpressionPtr parse(std::string_view text);
+
+  /**
+   * @brief Evaluate the expression
+   * @param resolve Lookup for @symbol references, returning nullopt for undefined symbols
+   * @return Value of the expression
+   * @throws ExpressionException for undefined symbols, division by zero, bad
+   *         shift counts and results that still depend on a label
+   */
+  i64 evaluate(const Resolver& resolve) const;
+
+  /**
+   * @brief Get the value of an expression that references no symbols
+   * @return Value, or nullopt if the expression references symbols
+   * @throws ExpressionException for division by zero and bad shift counts
+   */
+  std::optional<i64> constantValue() const;
+
+  /**
+   * @brief Visit every symbol the expression references
+   * @param visit Callable taking (const std::string& name)
+   */
+  template <typename Visitor>
+  void forEachSymbol(Visitor&& visit) const {
+    if (m_op == Op::Symbol) {
+      visit(m_symbol);
+    }
+    if (m_lhs) {
+      m_lhs->forEachSymbol(visit);
+    }
+    if (m_rhs) {
+      m_rhs->forEachSymbol(visit);
+    }
+  }
+
+  Op getOp() const { return m_op; }
+
+  /**
+   * @brief Format the expression, fully parenthesized
+   * @return Expression source
+   */
+  std::string toString() const;
+
+private:
+  struct Value;
+
+  Value evaluateNode(const Resolver& resolve) const;
+
+  Op m_op = Op::Literal;
+  i64 m_value = 0;             // Literal value
+  std::string m_symbol;        // Referenced symbol name
+  ExpressionPtr m_lhs;         // Operand of unary, left operand of binary nodes
+  ExpressionPtr m_rhs;         // Right operand of binary nodes
+};
+
+} // namespace casm
@@ -0,0 +1,74 @@
+#pragma once
+#include "casm/cfg.hpp"
+#include "casm/parser.hpp"
+#include <set>
+#include <string>
+#include <vector>
+
+namespace casm {
+
+/**
+ * @brief Set of lowercase register names, with Liveness::FLAGS for the flags
+ */
+using RegisterSet = std::set<std::string>;
+
+/**
+ * @brief Registers live after each instruction of a program
+ *
+ * A backward dataflow analysis over the blocks of each function. Nothing is
+ * known about the calling convention, so every physical register of the
+ * function and the flags are live at a ret, before a call and where control
+ * leaves the function by a jump. Virtual registers are local to their
+ * function and never live outside it. Instructions with condition parameters
+ * read the flags and may not execute, so their writes do not end a live range.
+ */
+class Liveness {
+public:
+  static constexpr const char* FLAGS = "flags";
+
+  /**
+   * @brief Analyze the statements a control-flow graph was built from
+   * @param statements Parsed statements
+   * @param graph Graph built from the same statements
+   * @return Live registers of every statement in a function
+   */
+  static Liveness analyze(const std::vector<Statement>& statements, const ControlFlowGraph& graph);
+
+  /**
+   * @brief Get the registers live after a statement
+   * @param statement Statement index
+   * @return Live registers, empty for statements outside functions
+   */
+  const RegisterSet& liveAfter(size_t statement) const;
+
+  /**
+   * @brief Check whether a register is live after a statement
+   * @param statement Statement index
+   * @param reg Lowercase register name, or FLAGS
+   * @return True if the value may be read later
+   */
+  bool isLiveAfter(size_t statement, const std::string& reg) const {
+    return liveAfter(statement).count(reg) != 0;
+  }
+
+  /**
+   * @brief Get the registers live on entry to a block
+   * @param block Block index
+   * @return Live registers
+   */
+  const RegisterSet& liveIn(size_t block) const { return m_blockIn[block]; }
+
+  /**
+   * @brief Get the registers live at the end of a block
+   * @param block Block index
+   * @return Live registers
+   */
+  const RegisterSet& liveOut(size_t block) const { return m_blockOut[block]; }
+
+private:
+  std::vector<RegisterSet> m_after;      // Per statement
+  std::vector<RegisterSet> m_blockIn;    // Per block
+  std::vector<RegisterSet> m_blockOut;   // Per block
+};
+
+} // namespace casm
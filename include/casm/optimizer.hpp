@@ -0,0 +1,222 @@
+#pragma once
+#include "casm/parser.hpp"
+#include "casm/profile.hpp"
+#include <string>
+#include <vector>
+
+namespace casm {
+
+/**
+ * @brief Values local value numbering removed from one function
+ */
+struct FunctionValueCounts {
+  std::string function;           // Entry label, empty for code before the first entry
+  size_t computations = 0;        // Recomputed arithmetic removed or turned into mov
+  size_t loads = 0;               // Reloads of known memory removed or turned into mov
+  size_t copies = 0;              // Register uses replaced by the original, and redundant moves
+};
+
+/**
+ * @brief Counts of the rewrites applied by the optimizer
+ */
+struct OptimizationStats {
+  // Peephole rewrites
+  size_t selfMoves = 0;           // mov %rX, %rX removed
+  size_t zeroArithmetic = 0;      // add/sub of zero removed or turned into mov
+  size_t strengthReductions = 0;  // mul by a power of two turned into shl
+  size_t zeroCompares = 0;        // cmp with zero turned into test
+  size_t incDecPairs = 0;         // Adjacent inc/dec pairs folded away
+
+  // Dead-code elimination
+  size_t unreachableBlocks = 0;   // Dead blocks removed, including those of dead functions
+  size_t deadFunctions = 0;       // Named functions removed entirely
+  size_t deadInstructions = 0;    // Instructions removed with their blocks
+
+  // Local value numbering
+  size_t redundantComputations = 0;  // Recomputed arithmetic removed or turned into mov
+  size_t redundantLoads = 0;         // Reloads of known memory removed or turned into mov
+  size_t propagatedCopies = 0;       // Register uses replaced by the original, and redundant moves
+  std::vector<FunctionValueCounts> functionValues;  // Per function, for functions with any
+
+  // Liveness
+  size_t deadStores = 0;          // Writes to registers and flags never read removed
+  size_t redundantSaves = 0;      // push/pop pairs of a register dead after the pop removed
+
+  // Calls
+  size_t inlinedCalls = 0;        // Calls replaced by a copy of the callee's body
+  size_t tailCalls = 0;           // call followed by ret turned into jmp
+
+  // Jumps
+  size_t threadedJumps = 0;       // Jumps retargeted past blocks holding only a jmp
+  size_t invertedBranches = 0;    // br over a jmp inverted to take the jmp's target
+  size_t fallThroughJumps = 0;    // Jumps to the next statement removed
+
+  // Profile-guided layout
+  size_t reorderedFunctions = 0;  // Functions whose blocks were reordered
+
+  // Function ordering
+  size_t orderedFunctions = 0;    // Functions moved to sit next to their callers or callees
+
+  /**
+   * @brief Get the number of peephole rewrites
+   * @return Sum of the peephole counters
+   */
+  size_t peephole() const {
+    return selfMoves + zeroArithmetic + strengthReductions + zeroCompares + incDecPairs;
+  }
+
+  /**
+   * @brief Get the number of value numbering rewrites
+   * @return Sum of the value numbering counters
+   */
+  size_t valueNumbering() const { return redundantComputations + redundantLoads + propagatedCopies; }
+
+  /**
+   * @brief Get the number of jump rewrites
+   * @return Sum of the jump threading and branch folding counters
+   */
+  size_t jumps() const { return threadedJumps + invertedBranches + fallThroughJumps; }
+
+  /**
+   * @brief Get the number of rewrites of any kind
+   * @return Sum of all counters
+   */
+  size_t total() const {
+    return peephole() + unreachableBlocks + valueNumbering() + deadStores + redundantSaves + inlinedCalls +
+           tailCalls + jumps() + reorderedFunctions + orderedFunctions;
+  }
+};
+
+/**
+ * @brief Statement-level optimizer run before layout
+ *
+ * Passes rewrite the parsed statements, so label offsets and relocations are
+ * computed afterwards from the optimized program and stay consistent.
+ */
+class Optimizer {
+public:
+  static constexpr size_t DEFAULT_INLINE_LIMIT = 4;
+
+  /**
+   * @brief Construct an optimizer
+   * @param inlineLimit Most instructions, besides the ret, of a function inlined at its calls; 0 disables inlining
+   * @param profile Block execution counts to lay out functions by, or nullptr for source order
+   */
+  explicit Optimizer(size_t inlineLimit = DEFAULT_INLINE_LIMIT, const Profile* profile = nullptr)
+    : m_inlineLimit(inlineLimit), m_profile(profile) {}
+
+  /**
+   * @brief Run all passes over the statements in place
+   * @param statements Statements to optimize
+   * @return Counts of the rewrites applied
+   */
+  const OptimizationStats& run(std::vector<Statement>& statements);
+
+  /**
+   * @brief Replace calls to small local leaf functions with their bodies
+   *
+   * A function is inlined when its entry block holds at most the inline limit
+   * of instructions, none of them a call, and ends in a ret. Its virtual
+   * registers are renamed to ones the caller does not use.
+   * @param statements Statements to rewrite in place
+   * @return Number of calls replaced
+   */
+  size_t inlineCalls(std::vector<Statement>& statements);
+
+  /**
+   * @brief Remove blocks and local functions that cannot be reached
+   * @param statements Statements to rewrite in place
+   * @return Number of statements removed
+   */
+  size_t eliminateDeadCode(std::vector<Statement>& statements);
+
+  /**
+   * @brief Remove recomputed values within each basic block
+   *
+   * Arithmetic on the same values, reloads of memory not stored to since, and
+   * copies of a value already in the destination are removed or turned into
+   * moves from the register holding the value. Uses of a copy are replaced by
+   * the register it was copied from.
+   * @param statements Statements to rewrite in place
+   * @return Number of rewrites applied
+   */
+  size_t numberValues(std::vector<Statement>& statements);
+
+  /**
+   * @brief Remove register writes and saves that nothing reads
+   *
+   * Uses Liveness to remove instructions whose results are never read, and
+   * push/pop pairs whose register is dead after the pop.
+   * @param statements Statements to rewrite in place
+   * @return Number of instructions and push/pop pairs removed
+   */
+  size_t eliminateDeadStores(std::vector<Statement>& statements);
+
+  /**
+   * @brief Turn calls followed by a ret into jumps
+   *
+   * The ret may follow directly or after labels. Calls made with values still
+   * pushed on the stack, or where the depth is not known, are left alone.
+   * @param statements Statements to rewrite in place
+   * @return Number of calls converted
+   */
+  size_t convertTailCalls(std::vector<Statement>& statements);
+
+  /**
+   * @brief Remove jumps that lead to other jumps or to the next block
+   *
+   * Jumps to a block holding only a jmp are retargeted to its target, a br
+   * over a jmp is inverted to branch to the jmp's target instead, and jumps
+   * to the next statement are removed.
+   * @param statements Statements to rewrite in place
+   * @return Number of rewrites applied
+   */
+  size_t threadJumps(std::vector<Statement>& statements);
+
+  /**
+   * @brief Reorder the blocks of profiled functions so hot paths fall through
+   *
+   * The entry stays first, blocks that ran follow the hottest successor and
+   * blocks that never ran move to the end. Branches are inverted, and jumps
+   * added or removed, to keep every edge.
+   * @param statements Statements to rewrite in place
+   * @param profile Block execution counts
+   * @return Number of functions reordered
+   */
+  size_t reorderBlocks(std::vector<Statement>& statements, const Profile& profile);
+
+  /**
+   * @brief Reorder the functions of each section so callers and callees are adjacent
+   *
+   * Functions are clustered along the heaviest edges of the call graph, built
+   * from call and jump targets and weighted by the profile where it has counts.
+   * The first function of a section stays first, and a function that runs off
+   * its end stays in front of the next. Not part of run().
+   * @param statements Statements to rewrite in place
+   * @param profile Block execution counts, empty to weigh every call the same
+   * @return Number of functions moved
+   */
+  size_t orderFunctions(std::vector<Statement>& statements, const Profile& profile);
+
+  /**
+   * @brief Apply local rewrites to single and adjacent instructions
+   *
+   * A label attached to a removed instruction moves to the next instruction.
+   * @param statements Statements to rewrite in place
+   * @return Number of rewrites applied
+   */
+  size_t peephole(std::vector<Statement>& statements);
+
+  /**
+   * @brief Get the rewrites counted so far
+   * @return Rewrite counts
+   */
+  const OptimizationStats& getStats() const { return m_stats; }
+
+private:
+  size_t m_inlineLimit;
+  const Profile* m_profile;
+  OptimizationStats m_stats;
+};
+
+} // namespace casm
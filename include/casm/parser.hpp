@@ -164,16 +164,20 @@ public:
   Directive(std::string name, 
             std::vector<std::unique_ptr<Operand>> operands = {});
   
+  // Directive whose kind was already resolved by the lexer
+  Directive(std::string name, DirectiveKind kind);
+  
   void addOperand(std::unique_ptr<Operand> operand);
   
   const std::string& getName() const { return m_name; }
+  DirectiveKind getKind() const { return m_kind; }
   const std::vector<std::unique_ptr<Operand>>& getOperands() const { return m_operands; }
   
   std::string toString() const;
   
   // Copy constructor
   Directive(const Directive& other)
-    : m_name(other.m_name) 
+    : m_name(other.m_name), m_kind(other.m_kind)
   {
     // Deep copy the operands
     for (const auto& op : other.m_operands) {
@@ -207,6 +211,7 @@ public:
 
 private:
   std::string m_name;
+  DirectiveKind m_kind;
   std::vector<std::unique_ptr<Operand>> m_operands;
 };
 
@@ -0,0 +1,74 @@
+#pragma once
+#include "casm/types.hpp"
+#include <istream>
+#include <map>
+#include <string>
+#include <string_view>
+
+namespace casm {
+
+/**
+ * @brief Execution counts of labelled blocks, keyed by function and block label
+ *
+ * The text format has one block per line: the function's entry label, the
+ * label starting the block and the number of times it ran, separated by
+ * whitespace. Labels may be written with or without a leading @ or #, and a
+ * semicolon starts a comment:
+ *
+ *   ; function  block   count
+ *   @fact       @fact   1000
+ *   @fact       @loop   250000
+ *   @fact       @error  0
+ *
+ * A function's entry block is named by the entry label itself. Blocks missing
+ * from the profile of a listed function count as never run.
+ */
+class Profile {
+public:
+  /**
+   * @brief Parse a profile
+   * @param input Profile text
+   * @param filename Name used in error messages
+   * @return Parsed profile
+   * @throws ProfileException on malformed lines
+   */
+  static Profile parse(std::istream& input, const std::string& filename = "<profile>");
+
+  /**
+   * @brief Read and parse a profile file
+   * @param path Path of the profile
+   * @return Parsed profile
+   * @throws ProfileException if the file cannot be read or is malformed
+   */
+  static Profile load(const std::string& path);
+
+  /**
+   * @brief Add to the count of a block
+   * @param function Entry label of the function, without @ or #
+   * @param block Label starting the block, without @ or #
+   * @param count Number of executions to add
+   */
+  void addCount(const std::string& function, const std::string& block, u64 count);
+
+  /**
+   * @brief Get the count of a block
+   * @param function Entry label of the function
+   * @param block Label starting the block
+   * @return Executions recorded, 0 if the block is not in the profile
+   */
+  u64 count(std::string_view function, std::string_view block) const;
+
+  /**
+   * @brief Check whether a function has counts
+   * @param function Entry label of the function
+   * @return True if any block of the function is in the profile
+   */
+  bool hasFunction(std::string_view function) const { return m_counts.find(function) != m_counts.end(); }
+
+  bool empty() const { return m_counts.empty(); }
+
+private:
+  std::map<std::string, std::map<std::string, u64, std::less<>>, std::less<>> m_counts;
+};
+
+} // namespace casm
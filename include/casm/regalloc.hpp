@@ -0,0 +1,79 @@
+#pragma once
+#include "casm/parser.hpp"
+#include "casm/types.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+namespace casm {
+
+/**
+ * @brief Where the virtual registers of one function were placed
+ */
+struct FunctionAllocation {
+  std::string function;                          // Entry label, empty for code before the first entry
+  std::map<std::string, std::string> registers;  // Virtual register to the physical register assigned
+  std::map<std::string, std::string> spills;     // Virtual register to the label of its spill slot
+  size_t frameSize = 0;                          // Bytes of spill slots the function needs
+  size_t spillLoads = 0;                         // Loads inserted before uses of spilled registers
+  size_t spillStores = 0;                        // Stores inserted after writes of spilled registers
+  size_t callSaves = 0;                          // Registers and slots pushed before a call and popped after it
+};
+
+/**
+ * @brief Linear-scan allocator mapping virtual registers onto physical ones
+ *
+ * Each function is allocated on its own. A virtual register's live interval
+ * spans every instruction where it is live; intervals are visited in order of
+ * their start and given the lowest free physical register. When none is free,
+ * the interval ending last is spilled to a slot the allocator reserves for the
+ * function. The physical registers a function names itself are never
+ * assigned. Spilled registers are loaded into scratch registers, reserved
+ * from the top of the pool, around each use.
+ *
+ * Around each call, the registers holding values live after it are pushed
+ * and popped again if the callee, or anything it calls, writes them, and the
+ * slots of spilled values are if the callee may call back into the function,
+ * so every activation keeps its own copy on the stack. Calls through a
+ * register or to labels outside the program may do either.
+ */
+class RegisterAllocator {
+public:
+  static constexpr i64 SLOT_SIZE = 8;
+
+  /**
+   * @brief Construct an allocator for a register file
+   * @param registerCount Physical registers %r0 to %rN-1 that may be assigned
+   */
+  explicit RegisterAllocator(u32 registerCount) : m_registerCount(registerCount) {}
+
+  /**
+   * @brief Check whether any instruction names a virtual register
+   * @param statements Statements to check
+   * @return True if allocation is needed before the statements can be encoded
+   */
+  static bool usesVirtualRegisters(const std::vector<Statement>& statements);
+
+  /**
+   * @brief Replace every virtual register with a physical register or spill slot
+   *
+   * Spill slots are 8-byte words appended to the .bss section after the
+   * statements, labelled __spill_<function>_<k>, or with more leading
+   * underscores where the program already uses that name.
+   * @param statements Statements to rewrite in place
+   * @throws RegisterAllocationException if a function leaves too few registers to allocate from
+   */
+  void allocate(std::vector<Statement>& statements);
+
+  /**
+   * @brief Get the placement of each function's virtual registers
+   * @return Allocations of the functions that use virtual registers
+   */
+  const std::vector<FunctionAllocation>& getAllocations() const { return m_allocations; }
+
+private:
+  u32 m_registerCount;
+  std::vector<FunctionAllocation> m_allocations;
+};
+
+} // namespace casm
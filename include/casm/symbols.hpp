@@ -0,0 +1,143 @@
+#pragma once
+#include "casm/types.hpp"
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace casm {
+
+// Dense symbol identifier, assigned in insertion order
+using SymbolId = u32;
+inline constexpr SymbolId NO_SYMBOL = ~SymbolId{0};
+
+/**
+ * @brief Name-keyed table with dense IDs and insertion-order iteration
+ *
+ * Entries and their interned names are stored contiguously in insertion
+ * order and addressed by SymbolId. Lookup by name goes through a flat
+ * open-addressing index with linear probing whose slots hold only a hash
+ * and an ID, so most probes touch a single cache line.
+ */
+template <typename T>
+class SymbolTable {
+public:
+  /**
+   * @brief Find the ID of a name
+   * @param name Name to look up
+   * @return ID of the entry, or NO_SYMBOL if absent
+   */
+  SymbolId find(std::string_view name) const {
+    return m_slots.empty() ? NO_SYMBOL : m_slots[findSlot(name, hashName(name))].id;
+  }
+
+  /**
+   * @brief Get the ID of a name, adding a default entry if absent
+   * @param name Name to intern
+   * @return ID of the entry
+   */
+  SymbolId intern(std::string_view name) {
+    // Keep the load factor at or below 3/4
+    if ((m_names.size() + 1) * 4 > m_slots.size() * 3) {
+      grow();
+    }
+
+    u32 hash = hashName(name);
+    Slot& slot = m_slots[findSlot(name, hash)];
+    if (slot.id == NO_SYMBOL) {
+      slot = {hash, static_cast<SymbolId>(m_names.size())};
+      m_names.emplace_back(name);
+      m_entries.emplace_back();
+    }
+    return slot.id;
+  }
+
+  /**
+   * @brief Get the entry for a name
+   * @param name Name to look up
+   * @return Pointer to the entry, or nullptr if absent
+   */
+  T* get(std::string_view name) {
+    SymbolId id = find(name);
+    return id == NO_SYMBOL ? nullptr : &m_entries[id];
+  }
+
+  const T* get(std::string_view name) const {
+    SymbolId id = find(name);
+    return id == NO_SYMBOL ? nullptr : &m_entries[id];
+  }
+
+  T& operator[](SymbolId id) { return m_entries[id]; }
+  const T& operator[](SymbolId id) const { return m_entries[id]; }
+
+  /**
+   * @brief Get the interned name of an entry
+   * @param id Entry ID
+   * @return Entry name
+   */
+  const std::string& name(SymbolId id) const { return m_names[id]; }
+
+  // Entries in insertion order
+  auto begin() { return m_entries.begin(); }
+  auto end() { return m_entries.end(); }
+  auto begin() const { return m_entries.begin(); }
+  auto end() const { return m_entries.end(); }
+
+  size_t size() const { return m_entries.size(); }
+  bool empty() const { return m_entries.empty(); }
+
+  /**
+   * @brief Remove all entries
+   */
+  void clear() {
+    m_slots.clear();
+    m_names.clear();
+    m_entries.clear();
+  }
+
+private:
+  struct Slot {
+    u32 hash;                     // Hash of the entry name
+    SymbolId id = NO_SYMBOL;      // Entry ID, NO_SYMBOL for an empty slot
+  };
+
+  static u32 hashName(std::string_view name) {
+    u64 hash = std::hash<std::string_view>{}(name);
+    return static_cast<u32>(hash ^ (hash >> 32));
+  }
+
+  // Slot holding the name, or the empty slot where it would be inserted
+  size_t findSlot(std::string_view name, u32 hash) const {
+    size_t mask = m_slots.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+      const Slot& slot = m_slots[i];
+      if (slot.id == NO_SYMBOL || (slot.hash == hash && m_names[slot.id] == name)) {
+        return i;
+      }
+    }
+  }
+
+  void grow() {
+    std::vector<Slot> slots(m_slots.empty() ? 16 : m_slots.size() * 2);
+    size_t mask = slots.size() - 1;
+
+    for (const Slot& slot : m_slots) {
+      if (slot.id == NO_SYMBOL) {
+        continue;
+      }
+      size_t i = slot.hash & mask;
+      while (slots[i].id != NO_SYMBOL) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = slot;
+    }
+
+    m_slots = std::move(slots);
+  }
+
+  std::vector<Slot> m_slots;        // Open-addressing index, power of two size
+  std::vector<std::string> m_names; // Interned names by ID
+  std::vector<T> m_entries;         // Entries by ID
+};
+
+} // namespace casm
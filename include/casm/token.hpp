@@ -22,6 +22,31 @@ enum class TokenType {
   Error             // Invalid token
 };
 
+// Directive kinds, resolved from the directive name at lex time
+enum class DirectiveKind {
+  Unknown,          // Not a known directive
+  Section,          // .section
+  Global,           // .global
+  Local,            // .local
+  I8,               // .i8
+  I16,              // .i16
+  I32,              // .i32
+  I64,              // .i64
+  U8,               // .u8
+  U16,              // .u16
+  U32,              // .u32
+  U64,              // .u64
+  F32,              // .f32
+  F64,              // .f64
+  Ascii,            // .ascii
+  Asciiz,           // .asciiz
+  Zero,             // .zero
+  Align,            // .align
+  Equ,              // .equ
+  Set,              // .set
+  Count             // Number of directive kinds
+};
+
 // Token structure
 struct Token {
   TokenType type;
@@ -31,6 +56,7 @@ struct Token {
   // Additional data for specific token types
   std::optional<ImmediateValue> immediateValue;
   std::optional<MemoryReference> memoryRef;
+  DirectiveKind directiveKind = DirectiveKind::Unknown;
   
   Token() = default;
   
@@ -42,7 +68,7 @@ struct Token {
   // Helper methods for creating tokens
   static Token makeLabel(const std::string& name, const SourceLocation& location);
   static Token makeInstruction(const std::string& name, const SourceLocation& location);
-  static Token makeDirective(const std::string& name, const SourceLocation& location);
+  static Token makeDirective(const std::string& name, DirectiveKind kind, const SourceLocation& location);
   static Token makeRegister(const std::string& name, const SourceLocation& location);
   static Token makeImmediate(const std::string& value, const SourceLocation& location);
   static Token makeMemoryRef(const std::string& expr, const SourceLocation& location);
@@ -58,4 +84,7 @@ struct Token {
 // Helper functions
 const char* tokenTypeToString(TokenType type);
 
+// Resolve a directive name (without the leading '.') to its kind
+DirectiveKind lookupDirective(const std::string& name);
+
 } // namespace casm
\ No newline at end of file
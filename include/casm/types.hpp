@@ -5,6 +5,9 @@
 #include <optional>
 #include <variant>
 #include <memory>
+#include <bit>
+#include <cstring>
+#include <utility>
 
 namespace casm {
 
@@ -20,6 +23,17 @@ using i64 = int64_t;
 using f32 = float;
 using f64 = double;
 
+// Store a scalar (integer or IEEE float) at dest in little-endian byte order
+template <typename T>
+inline void storeLittleEndian(u8* dest, T value) {
+  std::memcpy(dest, &value, sizeof(T));
+  if constexpr (std::endian::native == std::endian::big) {
+    for (size_t i = 0; i < sizeof(T) / 2; ++i) {
+      std::swap(dest[i], dest[sizeof(T) - 1 - i]);
+    }
+  }
+}
+
 // Source location information
 struct SourceLocation {
   std::string filename;
@@ -32,12 +46,17 @@ struct SourceLocation {
   std::string toString() const;
 };
 
+// Assembly-time expression (see expression.hpp)
+class Expression;
+using ExpressionPtr = std::shared_ptr<const Expression>;
+
 // Immediate value formats
 enum class ImmediateFormat {
   Integer,      // Integer value
   Float,        // Floating point value
   Character,    // Character value
-  String        // String value
+  String,       // String value
+  Expression    // Expression referencing symbols, evaluated during assembly
 };
 
 // Immediate base
@@ -52,22 +71,24 @@ enum class ImmediateBase {
 struct MemoryReference {
   std::string reg;    // Register name
   i64 offset;     // Offset value
+  ExpressionPtr offsetExpr;   // Offset expression referencing symbols, null for literal offsets
   
-  MemoryReference(std::string reg = "", i64 offset = 0)
-    : reg(std::move(reg)), offset(offset) {}
+  MemoryReference(std::string reg = "", i64 offset = 0, ExpressionPtr offsetExpr = nullptr)
+    : reg(std::move(reg)), offset(offset), offsetExpr(std::move(offsetExpr)) {}
 };
 
 // Immediate value
 struct ImmediateValue {
   ImmediateFormat format;
   ImmediateBase base;
-  std::variant<i64, f64, char, std::string> value;
+  std::variant<i64, f64, char, std::string, ExpressionPtr> value;
   
   // Constructors for different types
   static ImmediateValue createInteger(i64 value, ImmediateBase base = ImmediateBase::Decimal);
   static ImmediateValue createFloat(f64 value);
   static ImmediateValue createChar(char value);
   static ImmediateValue createString(std::string value);
+  static ImmediateValue createExpression(ExpressionPtr value);
   
   std::string toString() const;
 };
@@ -103,4 +124,22 @@ public:
     : CasmException("Assembler error: " + message) {}
 };
 
+class ExpressionException : public CasmException {
+public:
+  explicit ExpressionException(const std::string& message)
+    : CasmException("Expression error: " + message) {}
+};
+
+class RegisterAllocationException : public CasmException {
+public:
+  explicit RegisterAllocationException(const std::string& message)
+    : CasmException("Register allocation error: " + message) {}
+};
+
+class ProfileException : public CasmException {
+public:
+  explicit ProfileException(const std::string& message)
+    : CasmException("Profile error: " + message) {}
+};
+
 } // namespace casm
\ No newline at end of file
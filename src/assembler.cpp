@@ -9,6 +9,7 @@
 #include <cstring>
 #include <array>
 #include <functional>
+#include <utility>
 
 namespace casm {
 
@@ -27,16 +28,57 @@ Assembler::Assembler(const Options& options)
 AssemblyResult Assembler::assemble(const std::vector<Statement>& statements) {
     // Clear any previous state
     m_errors.clear();
+    m_optimizationStats = OptimizationStats();
+    m_registerAllocations.clear();
     
     // Create assembly context
     AssemblyContext ctx(m_options);
     
     try {
+        // Optimize and allocate a copy of the program; layout only ever sees the result
+        std::vector<Statement> rewritten;
+        const std::vector<Statement>* program = &statements;
+        if (m_options.optimize) {
+            rewritten = statements;
+            Optimizer optimizer(m_options.inlineLimit, &m_options.profile);
+            m_optimizationStats = optimizer.run(rewritten);
+            log("Optimizer applied " + std::to_string(m_optimizationStats.total()) + " rewrite(s)");
+            program = &rewritten;
+        }
+        
+        if (m_options.orderFunctions) {
+            if (program == &statements) {
+                rewritten = statements;
+                program = &rewritten;
+            }
+            Optimizer orderer;
+            m_optimizationStats.orderedFunctions = orderer.orderFunctions(rewritten, m_options.profile);
+            log("Moved " + std::to_string(m_optimizationStats.orderedFunctions) + " function(s) next to their callers");
+        }
+        
+        if (RegisterAllocator::usesVirtualRegisters(*program)) {
+            if (program == &statements) {
+                rewritten = statements;
+                program = &rewritten;
+            }
+            RegisterAllocator allocator(m_options.registerCount);
+            try {
+                allocator.allocate(rewritten);
+            } catch (const RegisterAllocationException& e) {
+                throw AssemblyException(e.what());
+            }
+            m_registerAllocations = allocator.getAllocations();
+            log("Allocated virtual registers in " + std::to_string(m_registerAllocations.size()) + " function(s)");
+        }
+        
         // First pass - collect symbols
-        collectSymbols(statements, ctx);
+        collectSymbols(*program, ctx);
         
         // Second pass - generate code
-        generateCode(statements, ctx);
+        generateCode(*program, ctx);
+        
+        // Patch references known at assembly time
+        resolveRelocations(ctx);
         
         // Generate object
         coil::Object obj = generateObject(ctx);
@@ -92,19 +134,7 @@ void Assembler::collectSymbols(const std::vector<Statement>& statements, Assembl
         
         // Process label-only statements
         if (stmt.getType() == Statement::Type::Label) {
-            Section& section = ctx.getCurrentSection();
-            const std::string& label = stmt.getLabel();
-            
-            // Define the symbol at the current offset
-            Symbol sym;
-            sym.name = label;
-            sym.value = section.currentOffset;
-            sym.section = ctx.getCurrentSectionName();
-            sym.type = coil::SymbolType::NoType;
-            sym.binding = coil::SymbolBinding::Local;
-            sym.defined = true;
-            
-            ctx.addSymbol(label, sym);
+            defineLabel(stmt.getLabel(), ctx);
             continue;
         }
         
@@ -113,277 +143,58 @@ void Assembler::collectSymbols(const std::vector<Statement>& statements, Assembl
             const Directive* directive = stmt.getDirective();
             if (!directive) continue;
             
-            const std::string& name = directive->getName();
-            
-            // Handle section directive
-            if (name == "section") {
-                if (directive->getOperands().empty()) {
-                    error("Section directive requires a name operand");
-                    continue;
-                }
-                
-                // Get section name
-                std::string sectionName;
-                const Operand* op = directive->getOperands()[0].get();
-                
-                if (op->getType() == Operand::Type::Label) {
-                    sectionName = static_cast<const LabelOperand*>(op)->getLabel();
-                } else if (op->getType() == Operand::Type::Immediate) {
-                    // Handle immediate string
-                    const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op);
-                    const ImmediateValue& value = immOp->getValue();
-                    
-                    if (value.format == ImmediateFormat::String) {
-                        sectionName = std::get<std::string>(value.value);
-                    } else {
-                        std::ostringstream ss;
-                        if (value.format == ImmediateFormat::Character) {
-                            ss << std::get<char>(value.value);
-                        } else if (value.format == ImmediateFormat::Integer) {
-                            ss << std::get<i64>(value.value);
-                        } else if (value.format == ImmediateFormat::Float) {
-                            ss << std::get<f64>(value.value);
-                        }
-                        sectionName = ss.str();
-                    }
-                } else {
-                    error("Section name must be a label reference or immediate value");
-                    continue;
-                }
-                
-                // Switch to the new section
-                ctx.switchSection(sectionName);
-                
-                // Process section flags and attributes
-                for (size_t i = 1; i < directive->getOperands().size(); ++i) {
-                    const Operand* param = directive->getOperands()[i].get();
-                    if (param->getType() != Operand::Type::Label) {
-                        error("Section parameter must be a label reference");
-                        continue;
-                    }
-                    
-                    const std::string& paramName = static_cast<const LabelOperand*>(param)->getLabel();
-                    std::string paramNameLower = paramName;
-                    std::transform(paramNameLower.begin(), paramNameLower.end(), paramNameLower.begin(), ::tolower);
-                    
-                    Section& section = ctx.getCurrentSection();
-                    
-                    // Set section type
-                    if (paramNameLower == "progbits") {
-                        section.type = coil::SectionType::ProgBits;
-                    } else if (paramNameLower == "nobits") {
-                        section.type = coil::SectionType::NoBits;
-                    } else if (paramNameLower == "symtab") {
-                        section.type = coil::SectionType::SymTab;
-                    } else if (paramNameLower == "strtab") {
-                        section.type = coil::SectionType::StrTab;
-                    }
-                    // Set section flags
-                    else if (paramNameLower == "write") {
-                        section.flags = section.flags | coil::SectionFlag::Write;
-                    } else if (paramNameLower == "code") {
-                        section.flags = section.flags | coil::SectionFlag::Code;
-                    } else if (paramNameLower == "alloc") {
-                        section.flags = section.flags | coil::SectionFlag::Alloc;
-                    } else if (paramNameLower == "merge") {
-                        section.flags = section.flags | coil::SectionFlag::Merge;
-                    } else if (paramNameLower == "tls") {
-                        section.flags = section.flags | coil::SectionFlag::TLS;
-                    } else {
-                        error("Unknown section parameter: " + paramName);
-                    }
-                }
-                
-                continue;
-            }
-            
-            // Handle global directive
-            if (name == "global") {
-                if (directive->getOperands().empty()) {
-                    error("Global directive requires a label operand");
-                    continue;
-                }
-                
-                const Operand* op = directive->getOperands()[0].get();
-                if (op->getType() != Operand::Type::Label) {
-                    error("Global symbol must be a label reference");
-                    continue;
-                }
-                
-                const std::string& label = static_cast<const LabelOperand*>(op)->getLabel();
-                ctx.addGlobalSymbol(label);
-                continue;
-            }
-            
-            // Handle data directives - estimate size
-            if (name == "i8" || name == "u8") {
-                ctx.getCurrentSection().currentOffset += directive->getOperands().size();
-                continue;
-            }
-            
-            if (name == "i16" || name == "u16") {
-                ctx.getCurrentSection().currentOffset += directive->getOperands().size() * 2;
-                continue;
-            }
-            
-            if (name == "i32" || name == "u32" || name == "f32") {
-                ctx.getCurrentSection().currentOffset += directive->getOperands().size() * 4;
-                continue;
-            }
-            
-            if (name == "i64" || name == "u64" || name == "f64") {
-                ctx.getCurrentSection().currentOffset += directive->getOperands().size() * 8;
-                continue;
-            }
-            
-            // Handle string directives
-            if (name == "ascii" || name == "asciiz") {
-                for (const auto& op : directive->getOperands()) {
-                    if (op->getType() != Operand::Type::Immediate) {
-                        error("String operand must be an immediate value");
-                        continue;
-                    }
-                    
-                    const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op.get());
-                    const ImmediateValue& value = immOp->getValue();
-                    
-                    if (value.format != ImmediateFormat::String) {
-                        error("String operand must be a string literal");
-                        continue;
-                    }
-                    
-                    const std::string& str = std::get<std::string>(value.value);
-                    size_t strSize = str.size();
-                    
-                    // Add null terminator for asciiz
-                    if (name == "asciiz") {
-                        strSize++;
-                    }
-                    
-                    ctx.getCurrentSection().currentOffset += strSize;
-                }
-                continue;
-            }
-            
-            // Handle zero directive (reserve space)
-            if (name == "zero") {
-                if (directive->getOperands().empty()) {
-                    error("Zero directive requires a size operand");
-                    continue;
-                }
-                
-                const Operand* op = directive->getOperands()[0].get();
-                if (op->getType() != Operand::Type::Immediate) {
-                    error("Zero size must be an immediate value");
-                    continue;
-                }
-                
-                const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op);
-                const ImmediateValue& value = immOp->getValue();
-                
-                if (value.format != ImmediateFormat::Integer) {
-                    error("Zero size must be an integer");
-                    continue;
-                }
-                
-                size_t zeroSize = static_cast<size_t>(std::get<i64>(value.value));
-                ctx.getCurrentSection().currentOffset += zeroSize;
-                continue;
-            }
-            
-            // Handle align directive
-            if (name == "align") {
-                if (directive->getOperands().empty()) {
-                    error("Align directive requires an alignment operand");
-                    continue;
-                }
-                
-                const Operand* op = directive->getOperands()[0].get();
-                if (op->getType() != Operand::Type::Immediate) {
-                    error("Alignment must be an immediate value");
-                    continue;
-                }
-                
-                const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op);
-                const ImmediateValue& value = immOp->getValue();
-                
-                if (value.format != ImmediateFormat::Integer) {
-                    error("Alignment must be an integer");
-                    continue;
-                }
-                
-                size_t alignment = static_cast<size_t>(std::get<i64>(value.value));
-                if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
-                    error("Alignment must be a power of 2");
-                    continue;
-                }
-                
-                // Calculate padding needed
-                Section& section = ctx.getCurrentSection();
-                size_t padding = (alignment - (section.currentOffset % alignment)) % alignment;
-                section.currentOffset += padding;
-                continue;
-            }
-            
-            // Add label to section if present with directive
-            if (!stmt.getLabel().empty()) {
-                Section& section = ctx.getCurrentSection();
-                const std::string& label = stmt.getLabel();
-                
-                // Define the symbol at the current offset
-                Symbol sym;
-                sym.name = label;
-                sym.value = section.currentOffset;
-                sym.section = ctx.getCurrentSectionName();
-                sym.type = coil::SymbolType::NoType;
-                sym.binding = coil::SymbolBinding::Local;
-                sym.defined = true;
-                
-                ctx.addSymbol(label, sym);
-            }
+            processDirective(*directive, stmt.getLabel(), Pass::Layout, ctx);
+            continue;
         }
         
-        // Process instructions - calculate size
+        // Process instructions - record exact size and branch form
         if (stmt.getType() == Statement::Type::Instruction) {
-            Section& section = ctx.getCurrentSection();
+            const Instruction* instruction = stmt.getInstruction();
+            if (!instruction) continue;
             
             // Add label if present
             if (!stmt.getLabel().empty()) {
-                const std::string& label = stmt.getLabel();
-                
-                // Define the symbol at the current offset
-                Symbol sym;
-                sym.name = label;
-                sym.value = section.currentOffset;
-                sym.section = ctx.getCurrentSectionName();
-                sym.type = coil::SymbolType::NoType;
-                sym.binding = coil::SymbolBinding::Local;
-                sym.defined = true;
-                
-                ctx.addSymbol(label, sym);
+                defineLabel(stmt.getLabel(), ctx);
             }
             
-            // Estimate instruction size - will be refined in code generation
-            section.currentOffset += 8; // Conservative estimate
+            layoutInstruction(*instruction, ctx);
+        }
+    }
+    
+    // Code labels that are exported or called start functions
+    for (const std::string& name : ControlFlowGraph::functionEntries(statements)) {
+        SymbolId id = ctx.findSymbol(name);
+        if (id != NO_SYMBOL && ctx.getSymbol(id).defined) {
+            ctx.getSymbol(id).type = coil::SymbolType::Func;
         }
     }
     
+    // Fix the size of every instruction and the offset of every label
+    relaxBranches(ctx);
+    ctx.finishLayout();
+    
     log("Symbol collection complete");
 }
 
 void Assembler::generateCode(const std::vector<Statement>& statements, AssemblyContext& ctx) {
     log("Second pass - generating code");
     
-    // Reset section data
-    auto& sections = const_cast<std::unordered_map<std::string, Section>&>(ctx.getSections());
-    for (auto& [name, section] : sections) {
+    // Reset section data, reserving the exact size computed by the layout
+    for (Section& section : ctx.getSections()) {
         section.data.clear();
+        section.zeroRuns.clear();
+        if (section.type != coil::SectionType::NoBits) {
+            section.data.reserve(section.dataSize);
+        }
         section.currentOffset = 0;
     }
     
     // Reset current section
     ctx.switchSection(".text");
     
+    // Instructions are visited in the same order as in the first pass
+    size_t instructionIndex = 0;
+    
     for (const auto& stmt : statements) {
         // Skip empty statements
         if (stmt.getType() == Statement::Type::Empty) {
@@ -397,7 +208,7 @@ void Assembler::generateCode(const std::vector<Statement>& statements, AssemblyC
             if (sym) {
                 sym->value = ctx.getCurrentSection().currentOffset;
                 sym->defined = true;
-                sym->section = ctx.getCurrentSectionName();
+                sym->section = ctx.getCurrentSectionId();
             }
             continue;
         }
@@ -408,7 +219,7 @@ void Assembler::generateCode(const std::vector<Statement>& statements, AssemblyC
             if (!directive) continue;
             
             // Process directive
-            processDirective(*directive, stmt.getLabel(), ctx);
+            processDirective(*directive, stmt.getLabel(), Pass::Emit, ctx);
             continue;
         }
         
@@ -418,7 +229,8 @@ void Assembler::generateCode(const std::vector<Statement>& statements, AssemblyC
             if (!instruction) continue;
             
             // Process instruction
-            processInstruction(*instruction, stmt.getLabel(), ctx);
+            processInstruction(*instruction, stmt.getLabel(),
+                               ctx.getInstructionLayout(instructionIndex++), ctx);
             continue;
         }
     }
@@ -435,11 +247,16 @@ coil::Object Assembler::generateObject(AssemblyContext& ctx) {
     // Initialize string table
     obj.initStringTable();
     
-    // Add section names to string table and create sections
-    for (const auto& [name, section] : ctx.getSections()) {
+    // COIL section index for each section ID, 0 for sections left out
+    const SymbolTable<Section>& sections = ctx.getSections();
+    std::vector<u16> sectionIndices(sections.size(), 0);
+    
+    // Add section names to string table and create sections, in creation order
+    for (const Section& section : sections) {
+        const std::string& name = section.name;
+        
         // Skip empty sections
-        if ((section.type != coil::SectionType::NoBits && section.data.empty()) ||
-            (section.type == coil::SectionType::NoBits && section.currentOffset == 0)) {
+        if (section.currentOffset == 0) {
             continue;
         }
         
@@ -450,9 +267,17 @@ coil::Object Assembler::generateObject(AssemblyContext& ctx) {
         uint16_t flags = static_cast<uint16_t>(section.flags);
         uint8_t type = static_cast<uint8_t>(section.type);
         
-        obj.addSection(nameOffset, flags, type, section.data.size(), section.data);
+        // NoBits sections carry only their size; zero runs are expanded for the rest
+        if (section.type == coil::SectionType::NoBits) {
+            obj.addSection(nameOffset, flags, type, section.currentOffset, {});
+        } else if (section.zeroRuns.empty()) {
+            obj.addSection(nameOffset, flags, type, section.data.size(), section.data.toVector());
+        } else {
+            obj.addSection(nameOffset, flags, type, section.currentOffset, section.materialize());
+        }
+        sectionIndices[section.id] = obj.getSectionIndex(name);
         
-        log("Added section '" + name + "', size: " + std::to_string(section.data.size()) + 
+        log("Added section '" + name + "', size: " + std::to_string(section.currentOffset) + 
             " bytes, type: " + std::to_string(type) + ", flags: 0x" + 
             std::to_string(flags));
     }
@@ -460,32 +285,51 @@ coil::Object Assembler::generateObject(AssemblyContext& ctx) {
     // Initialize symbol table
     obj.initSymbolTable();
     
-    // Add symbols to object
-    for (const auto& [name, symbol] : ctx.getSymbols()) {
-        // Skip symbols that weren't defined if we don't allow unresolved symbols
-        if (!symbol.defined && !ctx.getOptions().allowUnresolvedSymbols) {
-            error("Undefined symbol: " + name);
+    // Add symbols to object, in insertion order; COIL index per symbol ID for relocations
+    const SymbolTable<Symbol>& symbols = ctx.getSymbols();
+    std::vector<u16> symbolIndices(symbols.size(), 0);
+    
+    for (SymbolId id = 0; id < symbols.size(); ++id) {
+        const std::string& name = symbols.name(id);
+        const Symbol& symbol = symbols[id];
+        
+        // Constants are only written when exported, as absolute symbols
+        if (ctx.isConstant(name)) {
+            if (symbol.binding == coil::SymbolBinding::Global) {
+                symbolIndices[id] = obj.addSymbol(obj.addString(name), static_cast<u32>(ctx.getConstantValue(name)),
+                                                  ABSOLUTE_SECTION_INDEX, static_cast<u8>(coil::SymbolType::NoType),
+                                                  static_cast<u8>(symbol.binding));
+                log("Added constant '" + name + "' = " + std::to_string(ctx.getConstantValue(name)));
+            }
             continue;
         }
         
-        // Skip local symbols in sections that weren't added
-        auto section = ctx.getSection(symbol.section);
-        if (!section) {
+        // Skip symbols that weren't defined if we don't allow unresolved symbols
+        if (!symbol.defined && !ctx.getOptions().allowUnresolvedSymbols) {
+            error("Undefined symbol: " + name);
             continue;
         }
         
-        // Get section index
-        uint16_t sectionIndex = obj.getSectionIndex(symbol.section);
-        if (sectionIndex == 0) {
-            error("Could not find section '" + symbol.section + "' for symbol '" + name + "'");
-            continue;
+        // Undefined symbols are left to the linker with section index 0
+        uint16_t sectionIndex = 0;
+        if (symbol.defined) {
+            // Skip local symbols in sections that weren't added
+            if (symbol.section == NO_SECTION) {
+                continue;
+            }
+            
+            sectionIndex = sectionIndices[symbol.section];
+            if (sectionIndex == 0) {
+                error("Could not find section '" + sections[symbol.section].name + "' for symbol '" + name + "'");
+                continue;
+            }
         }
         
         // Add symbol name to string table
         u64 nameOffset = obj.addString(name);
         
         // Add symbol to object
-        obj.addSymbol(
+        symbolIndices[id] = obj.addSymbol(
             nameOffset,                                    // name
             static_cast<u32>(symbol.value),                // value
             sectionIndex,                                  // section_index
@@ -494,247 +338,371 @@ coil::Object Assembler::generateObject(AssemblyContext& ctx) {
         );
         
         log("Added symbol '" + name + "' at offset " + std::to_string(symbol.value) + 
-            " in section '" + symbol.section + "'");
+            (symbol.defined ? " in section '" + sections[symbol.section].name + "'" : " (undefined)"));
     }
     
-    log("COIL object generation complete");
-    return obj;
-}
-
-void Assembler::processDirective(const Directive& directive, const std::string& label, AssemblyContext& ctx) {
-    const std::string& name = directive.getName();
-    
-    // Handle section directive
-    if (name == "section") {
-        if (directive.getOperands().empty()) {
-            error("Section directive requires a name operand");
-            return;
-        }
-        
-        // Get section name
-        std::string sectionName;
-        const Operand* op = directive.getOperands()[0].get();
+    // Add relocations not resolved at assembly time
+    const std::vector<RelocationEntry>& relocations = ctx.getRelocations();
+    if (!relocations.empty()) {
+        obj.initRelocationTable();
         
-        if (op->getType() == Operand::Type::Label) {
-            sectionName = static_cast<const LabelOperand*>(op)->getLabel();
-        } else if (op->getType() == Operand::Type::Immediate) {
-            // Handle immediate string
-            const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op);
-            const ImmediateValue& value = immOp->getValue();
-            
-            if (value.format == ImmediateFormat::String) {
-                sectionName = std::get<std::string>(value.value);
-            } else {
-                std::ostringstream ss;
-                if (value.format == ImmediateFormat::Character) {
-                    ss << std::get<char>(value.value);
-                } else if (value.format == ImmediateFormat::Integer) {
-                    ss << std::get<i64>(value.value);
-                } else if (value.format == ImmediateFormat::Float) {
-                    ss << std::get<f64>(value.value);
-                }
-                sectionName = ss.str();
-            }
-        } else {
-            error("Section name must be a label reference or immediate value");
-            return;
-        }
-        
-        // Switch to the new section
-        ctx.switchSection(sectionName);
-        
-        // Process section flags and attributes
-        for (size_t i = 1; i < directive.getOperands().size(); ++i) {
-            const Operand* param = directive.getOperands()[i].get();
-            if (param->getType() != Operand::Type::Label) {
-                error("Section parameter must be a label reference");
+        size_t added = 0;
+        for (const RelocationEntry& reloc : relocations) {
+            // References to symbols reported as undefined above are dropped
+            u16 symbolIndex = symbolIndices[reloc.symbol];
+            if (symbolIndex == 0) {
                 continue;
             }
             
-            const std::string& paramName = static_cast<const LabelOperand*>(param)->getLabel();
-            std::string paramNameLower = paramName;
-            std::transform(paramNameLower.begin(), paramNameLower.end(), paramNameLower.begin(), ::tolower);
-            
-            Section& section = ctx.getCurrentSection();
-            
-            // Set section type
-            if (paramNameLower == "progbits") {
-                section.type = coil::SectionType::ProgBits;
-            } else if (paramNameLower == "nobits") {
-                section.type = coil::SectionType::NoBits;
-            } else if (paramNameLower == "symtab") {
-                section.type = coil::SectionType::SymTab;
-            } else if (paramNameLower == "strtab") {
-                section.type = coil::SectionType::StrTab;
-            }
-            // Set section flags
-            else if (paramNameLower == "write") {
-                section.flags = section.flags | coil::SectionFlag::Write;
-            } else if (paramNameLower == "code") {
-                section.flags = section.flags | coil::SectionFlag::Code;
-            } else if (paramNameLower == "alloc") {
-                section.flags = section.flags | coil::SectionFlag::Alloc;
-            } else if (paramNameLower == "merge") {
-                section.flags = section.flags | coil::SectionFlag::Merge;
-            } else if (paramNameLower == "tls") {
-                section.flags = section.flags | coil::SectionFlag::TLS;
-            } else {
-                error("Unknown section parameter: " + paramName);
-            }
+            RelocationType type = reloc.isRelative() ? RelocationType::Relative : RelocationType::Absolute;
+            obj.addRelocation(
+                reloc.offset,                              // offset
+                symbolIndex,                               // symbol_index
+                sectionIndices[reloc.section],             // section_index
+                static_cast<u8>(type),                     // type
+                static_cast<u8>(reloc.size()),             // size
+                reloc.addend                               // addend
+            );
+            ++added;
         }
         
-        return;
+        log("Added " + std::to_string(added) + " relocation(s)");
     }
     
-    // Handle global directive
-    if (name == "global") {
-        if (directive.getOperands().empty()) {
-            error("Global directive requires a label operand");
-            return;
-        }
-        
-        const Operand* op = directive.getOperands()[0].get();
-        if (op->getType() != Operand::Type::Label) {
-            error("Global symbol must be a label reference");
-            return;
-        }
-        
-        const std::string& label = static_cast<const LabelOperand*>(op)->getLabel();
-        ctx.addGlobalSymbol(label);
+    log("COIL object generation complete");
+    return obj;
+}
+
+//
+// Directive dispatch
+//
+
+const std::array<Assembler::DirectiveDescriptor, static_cast<size_t>(DirectiveKind::Count)> Assembler::DIRECTIVES = {{
+    // elementSize, valueType, labelsData, handler
+    {0, coil::ValueType::Void, true, nullptr},                      // Unknown
+    {0, coil::ValueType::Void, false, &Assembler::handleSection},   // .section
+    {0, coil::ValueType::Void, false, &Assembler::handleGlobal},    // .global
+    {0, coil::ValueType::Void, true, nullptr},                      // .local
+    {1, coil::ValueType::I8, true, &Assembler::handleData},         // .i8
+    {2, coil::ValueType::I16, true, &Assembler::handleData},        // .i16
+    {4, coil::ValueType::I32, true, &Assembler::handleData},        // .i32
+    {8, coil::ValueType::I64, true, &Assembler::handleData},        // .i64
+    {1, coil::ValueType::U8, true, &Assembler::handleData},         // .u8
+    {2, coil::ValueType::U16, true, &Assembler::handleData},        // .u16
+    {4, coil::ValueType::U32, true, &Assembler::handleData},        // .u32
+    {8, coil::ValueType::U64, true, &Assembler::handleData},        // .u64
+    {4, coil::ValueType::F32, true, &Assembler::handleData},        // .f32
+    {8, coil::ValueType::F64, true, &Assembler::handleData},        // .f64
+    {1, coil::ValueType::Void, true, &Assembler::handleString},     // .ascii
+    {1, coil::ValueType::Void, true, &Assembler::handleString},     // .asciiz
+    {1, coil::ValueType::Void, true, &Assembler::handleZero},       // .zero
+    {0, coil::ValueType::Void, true, &Assembler::handleAlign},      // .align
+    {0, coil::ValueType::Void, false, &Assembler::handleConstant},  // .equ
+    {0, coil::ValueType::Void, false, &Assembler::handleConstant}   // .set
+}};
+
+void Assembler::processDirective(const Directive& directive, const std::string& label, Pass pass, AssemblyContext& ctx) {
+    const DirectiveDescriptor& desc = DIRECTIVES[static_cast<size_t>(directive.getKind())];
+    
+    if (!desc.handler) {
+        directiveError("Unknown directive: " + directive.getName(), pass);
         return;
     }
     
-    // Add label if present
-    if (!label.empty()) {
-        Symbol* sym = ctx.getSymbol(label);
-        if (sym) {
+    // Labels on data directives mark the start of the data
+    if (desc.labelsData && !label.empty()) {
+        if (pass == Pass::Layout) {
+            defineLabel(label, ctx);
+        } else if (Symbol* sym = ctx.getSymbol(label)) {
             sym->value = ctx.getCurrentSection().currentOffset;
             sym->defined = true;
-            sym->section = ctx.getCurrentSectionName();
+            sym->section = ctx.getCurrentSectionId();
         }
     }
     
-    // Handle data directives
-    if (name == "i8" || name == "u8" || name == "i16" || name == "u16" || 
-        name == "i32" || name == "u32" || name == "i64" || name == "u64" || 
-        name == "f32" || name == "f64") {
-        
-        // Determine value type
-        coil::ValueType type = stringToValueType(name);
+    (this->*desc.handler)(directive, desc, pass, ctx);
+}
+
+void Assembler::directiveError(const std::string& message, Pass pass) {
+    // Both passes validate operands; report each problem only once
+    if (pass == Pass::Layout) {
+        error(message);
+    }
+}
+
+void Assembler::handleSection(const Directive& directive, const DirectiveDescriptor&, Pass pass, AssemblyContext& ctx) {
+    if (directive.getOperands().empty()) {
+        directiveError("Section directive requires a name operand", pass);
+        return;
+    }
+    
+    // Get section name
+    std::string sectionName;
+    const Operand* op = directive.getOperands()[0].get();
+    
+    if (op->getType() == Operand::Type::Label) {
+        sectionName = static_cast<const LabelOperand*>(op)->getLabel();
+    } else if (op->getType() == Operand::Type::Immediate) {
+        // Handle immediate string
+        const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op);
+        const ImmediateValue& value = immOp->getValue();
         
-        // Process all operands as values
-        for (const auto& op : directive.getOperands()) {
-            if (op->getType() != Operand::Type::Immediate) {
-                error("Data directive operand must be an immediate value");
-                continue;
+        if (value.format == ImmediateFormat::String) {
+            sectionName = std::get<std::string>(value.value);
+        } else {
+            std::ostringstream ss;
+            if (value.format == ImmediateFormat::Character) {
+                ss << std::get<char>(value.value);
+            } else if (value.format == ImmediateFormat::Integer) {
+                ss << std::get<i64>(value.value);
+            } else if (value.format == ImmediateFormat::Float) {
+                ss << std::get<f64>(value.value);
             }
-            
-            const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op.get());
-            ctx.addImmediate(immOp->getValue(), type);
+            sectionName = ss.str();
+        }
+    } else {
+        directiveError("Section name must be a label reference or immediate value", pass);
+        return;
+    }
+    
+    // Switch to the new section
+    ctx.switchSection(sectionName);
+    
+    // Process section flags and attributes
+    for (size_t i = 1; i < directive.getOperands().size(); ++i) {
+        const Operand* param = directive.getOperands()[i].get();
+        if (param->getType() != Operand::Type::Label) {
+            directiveError("Section parameter must be a label reference", pass);
+            continue;
         }
         
+        const std::string& paramName = static_cast<const LabelOperand*>(param)->getLabel();
+        std::string paramNameLower = paramName;
+        std::transform(paramNameLower.begin(), paramNameLower.end(), paramNameLower.begin(), ::tolower);
+        
+        Section& section = ctx.getCurrentSection();
+        
+        // Set section type
+        if (paramNameLower == "progbits") {
+            section.type = coil::SectionType::ProgBits;
+        } else if (paramNameLower == "nobits") {
+            section.type = coil::SectionType::NoBits;
+        } else if (paramNameLower == "symtab") {
+            section.type = coil::SectionType::SymTab;
+        } else if (paramNameLower == "strtab") {
+            section.type = coil::SectionType::StrTab;
+        }
+        // Set section flags
+        else if (paramNameLower == "write") {
+            section.flags = section.flags | coil::SectionFlag::Write;
+        } else if (paramNameLower == "code") {
+            section.flags = section.flags | coil::SectionFlag::Code;
+        } else if (paramNameLower == "alloc") {
+            section.flags = section.flags | coil::SectionFlag::Alloc;
+        } else if (paramNameLower == "merge") {
+            section.flags = section.flags | coil::SectionFlag::Merge;
+        } else if (paramNameLower == "tls") {
+            section.flags = section.flags | coil::SectionFlag::TLS;
+        } else {
+            directiveError("Unknown section parameter: " + paramName, pass);
+        }
+    }
+}
+
+void Assembler::handleGlobal(const Directive& directive, const DirectiveDescriptor&, Pass pass, AssemblyContext& ctx) {
+    if (directive.getOperands().empty()) {
+        directiveError("Global directive requires a label operand", pass);
+        return;
+    }
+    
+    const Operand* op = directive.getOperands()[0].get();
+    if (op->getType() != Operand::Type::Label) {
+        directiveError("Global symbol must be a label reference", pass);
         return;
     }
     
-    // Handle string directives
-    if (name == "ascii" || name == "asciiz") {
+    // Applied in both passes, since a later label definition resets the binding
+    const std::string& label = static_cast<const LabelOperand*>(op)->getLabel();
+    ctx.addGlobalSymbol(label);
+}
+
+void Assembler::handleData(const Directive& directive, const DirectiveDescriptor& desc, Pass pass, AssemblyContext& ctx) {
+    if (pass == Pass::Emit) {
+        // Constants may be defined after their use, so label operands are checked now
         for (const auto& op : directive.getOperands()) {
-            if (op->getType() != Operand::Type::Immediate) {
-                error("String operand must be an immediate value");
-                continue;
+            if (op->getType() == Operand::Type::Label &&
+                !ctx.isConstant(static_cast<const LabelOperand*>(op.get())->getLabel())) {
+                error("Data directive operand must be an immediate value or constant: @" +
+                      static_cast<const LabelOperand*>(op.get())->getLabel());
             }
-            
-            const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op.get());
-            const ImmediateValue& value = immOp->getValue();
-            
-            if (value.format != ImmediateFormat::String) {
-                error("String operand must be a string literal");
-                continue;
-            }
-            
-            const std::string& str = std::get<std::string>(value.value);
-            ctx.addString(str, name == "asciiz");
         }
         
+        // Emit the whole operand list in one bulk conversion
+        ctx.addImmediates(directive.getOperands(), desc.valueType);
         return;
     }
     
-    // Handle zero directive
-    if (name == "zero") {
-        if (directive.getOperands().empty()) {
-            error("Zero directive requires a size operand");
-            return;
+    size_t count = 0;
+    for (const auto& op : directive.getOperands()) {
+        if (op->getType() != Operand::Type::Immediate && op->getType() != Operand::Type::Label) {
+            directiveError("Data directive operand must be an immediate value", pass);
+            continue;
         }
-        
-        const Operand* op = directive.getOperands()[0].get();
+        ++count;
+    }
+    
+    ctx.getCurrentSection().layout.push_back({LayoutItem::Kind::Fixed, count * desc.elementSize});
+}
+
+void Assembler::handleString(const Directive& directive, const DirectiveDescriptor&, Pass pass, AssemblyContext& ctx) {
+    bool nullTerminated = directive.getKind() == DirectiveKind::Asciiz;
+    size_t size = 0;
+    
+    for (const auto& op : directive.getOperands()) {
         if (op->getType() != Operand::Type::Immediate) {
-            error("Zero size must be an immediate value");
-            return;
+            directiveError("String operand must be an immediate value", pass);
+            continue;
         }
         
-        const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op);
+        const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op.get());
         const ImmediateValue& value = immOp->getValue();
         
-        if (value.format != ImmediateFormat::Integer) {
-            error("Zero size must be an integer");
-            return;
+        if (value.format != ImmediateFormat::String) {
+            directiveError("String operand must be a string literal", pass);
+            continue;
         }
         
-        size_t zeroSize = static_cast<size_t>(std::get<i64>(value.value));
-        std::vector<u8> zeros(zeroSize, 0);
-        ctx.getCurrentSection().addData(zeros);
-        
+        const std::string& str = std::get<std::string>(value.value);
+        if (pass == Pass::Emit) {
+            ctx.addString(str, nullTerminated);
+        }
+        size += str.size() + (nullTerminated ? 1 : 0);
+    }
+    
+    if (pass == Pass::Layout) {
+        ctx.getCurrentSection().layout.push_back({LayoutItem::Kind::Fixed, size});
+    }
+}
+
+void Assembler::handleZero(const Directive& directive, const DirectiveDescriptor&, Pass pass, AssemblyContext& ctx) {
+    if (directive.getOperands().empty()) {
+        directiveError("Zero directive requires a size operand", pass);
         return;
     }
     
-    // Handle align directive
-    if (name == "align") {
-        if (directive.getOperands().empty()) {
-            error("Align directive requires an alignment operand");
-            return;
-        }
-        
-        const Operand* op = directive.getOperands()[0].get();
-        if (op->getType() != Operand::Type::Immediate) {
-            error("Alignment must be an immediate value");
-            return;
-        }
-        
-        const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op);
-        const ImmediateValue& value = immOp->getValue();
-        
-        if (value.format != ImmediateFormat::Integer) {
-            error("Alignment must be an integer");
-            return;
+    const Operand* op = directive.getOperands()[0].get();
+    if (op->getType() != Operand::Type::Immediate) {
+        directiveError("Zero size must be an immediate value", pass);
+        return;
+    }
+    
+    const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op);
+    const ImmediateValue& value = immOp->getValue();
+    
+    if (value.format != ImmediateFormat::Integer) {
+        directiveError("Zero size must be an integer", pass);
+        return;
+    }
+    
+    size_t zeroSize = static_cast<size_t>(std::get<i64>(value.value));
+    
+    if (pass == Pass::Layout) {
+        ctx.getCurrentSection().layout.push_back({LayoutItem::Kind::Zero, zeroSize});
+        return;
+    }
+    
+    ctx.getCurrentSection().addZeros(zeroSize);
+}
+
+void Assembler::handleConstant(const Directive& directive, const DirectiveDescriptor&, Pass pass, AssemblyContext& ctx) {
+    const auto& operands = directive.getOperands();
+    if (operands.size() != 2 || operands[0]->getType() != Operand::Type::Label) {
+        directiveError("Constant directive requires a name and a value", pass);
+        return;
+    }
+    
+    // The value is an integer, an expression or another constant
+    ExpressionPtr value;
+    const Operand* op = operands[1].get();
+    if (op->getType() == Operand::Type::Label) {
+        value = Expression::symbol(static_cast<const LabelOperand*>(op)->getLabel());
+    } else if (op->getType() == Operand::Type::Immediate) {
+        const ImmediateValue& imm = static_cast<const ImmediateOperand*>(op)->getValue();
+        if (imm.format == ImmediateFormat::Integer) {
+            value = Expression::literal(std::get<i64>(imm.value));
+        } else if (imm.format == ImmediateFormat::Character) {
+            value = Expression::literal(std::get<char>(imm.value));
+        } else if (imm.format == ImmediateFormat::Expression) {
+            value = std::get<ExpressionPtr>(imm.value);
         }
-        
-        size_t alignment = static_cast<size_t>(std::get<i64>(value.value));
-        if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
-            error("Alignment must be a power of 2");
+    }
+    if (!value) {
+        directiveError("Constant value must be an integer expression", pass);
+        return;
+    }
+    
+    // Only .set may redefine a constant, and only one defined by .set
+    const std::string& name = static_cast<const LabelOperand*>(operands[0].get())->getLabel();
+    bool redefinable = directive.getKind() == DirectiveKind::Set;
+    if (pass == Pass::Layout) {
+        const Constant* existing = ctx.getConstant(name);
+        const Symbol* label = ctx.getSymbol(name);
+        if ((existing && !(existing->redefinable && redefinable)) || (label && label->defined)) {
+            directiveError("Symbol already defined: " + name, pass);
             return;
         }
-        
-        // Calculate padding needed
-        Section& section = ctx.getCurrentSection();
-        size_t padding = (alignment - (section.currentOffset % alignment)) % alignment;
-        std::vector<u8> zeros(padding, 0);
-        section.addData(zeros);
-        
+    }
+    
+    // Redefined in the emit pass, so every use sees the definition in effect at that point
+    ctx.defineConstant(name, std::move(value), redefinable);
+}
+
+void Assembler::handleAlign(const Directive& directive, const DirectiveDescriptor&, Pass pass, AssemblyContext& ctx) {
+    if (directive.getOperands().empty()) {
+        directiveError("Align directive requires an alignment operand", pass);
+        return;
+    }
+    
+    const Operand* op = directive.getOperands()[0].get();
+    if (op->getType() != Operand::Type::Immediate) {
+        directiveError("Alignment must be an immediate value", pass);
+        return;
+    }
+    
+    const ImmediateOperand* immOp = static_cast<const ImmediateOperand*>(op);
+    const ImmediateValue& value = immOp->getValue();
+    
+    if (value.format != ImmediateFormat::Integer) {
+        directiveError("Alignment must be an integer", pass);
+        return;
+    }
+    
+    size_t alignment = static_cast<size_t>(std::get<i64>(value.value));
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        directiveError("Alignment must be a power of 2", pass);
         return;
     }
     
-    error("Unknown directive: " + name);
+    if (pass == Pass::Layout) {
+        // Padding depends on the final offset, resolved during layout
+        ctx.getCurrentSection().layout.push_back({LayoutItem::Kind::Align, alignment});
+        return;
+    }
+    
+    // Calculate padding needed
+    Section& section = ctx.getCurrentSection();
+    section.addZeros((alignment - (section.currentOffset % alignment)) % alignment);
 }
 
-void Assembler::processInstruction(const Instruction& instruction, const std::string& label, AssemblyContext& ctx) {
+void Assembler::processInstruction(const Instruction& instruction, const std::string& label,
+                                   const InstructionLayout& layout, AssemblyContext& ctx) {
     // Add label if present
     if (!label.empty()) {
         Symbol* sym = ctx.getSymbol(label);
         if (sym) {
             sym->value = ctx.getCurrentSection().currentOffset;
             sym->defined = true;
-            sym->section = ctx.getCurrentSectionName();
-            sym->type = coil::SymbolType::Func;  // Assume function
+            sym->section = ctx.getCurrentSectionId();
         }
     }
     
@@ -757,66 +725,59 @@ void Assembler::processInstruction(const Instruction& instruction, const std::st
     }
     
     // Map instruction name to COIL opcode
-    coil::Opcode opcode;
-    
-    if (name == "nop") opcode = coil::Opcode::Nop;
-    else if (name == "jmp") opcode = coil::Opcode::Jump;
-    else if (name == "br") opcode = coil::Opcode::Br;
-    else if (name == "call") opcode = coil::Opcode::Call;
-    else if (name == "ret") opcode = coil::Opcode::Ret;
-    else if (name == "load") opcode = coil::Opcode::Load;
-    else if (name == "store") opcode = coil::Opcode::Store;
-    else if (name == "push") opcode = coil::Opcode::Push;
-    else if (name == "pop") opcode = coil::Opcode::Pop;
-    else if (name == "mov") opcode = coil::Opcode::Mov;
-    else if (name == "add") opcode = coil::Opcode::Add;
-    else if (name == "sub") opcode = coil::Opcode::Sub;
-    else if (name == "mul") opcode = coil::Opcode::Mul;
-    else if (name == "div") opcode = coil::Opcode::Div;
-    else if (name == "rem") opcode = coil::Opcode::Rem;
-    else if (name == "inc") opcode = coil::Opcode::Inc;
-    else if (name == "dec") opcode = coil::Opcode::Dec;
-    else if (name == "neg") opcode = coil::Opcode::Neg;
-    else if (name == "and") opcode = coil::Opcode::And;
-    else if (name == "or") opcode = coil::Opcode::Or;
-    else if (name == "xor") opcode = coil::Opcode::Xor;
-    else if (name == "not") opcode = coil::Opcode::Not;
-    else if (name == "shl") opcode = coil::Opcode::Shl;
-    else if (name == "shr") opcode = coil::Opcode::Shr;
-    else if (name == "sar") opcode = coil::Opcode::Sar;
-    else if (name == "cmp") opcode = coil::Opcode::Cmp;
-    else if (name == "test") opcode = coil::Opcode::Test;
-    else if (name == "cvt") opcode = coil::Opcode::Cvt;
-    else {
+    std::optional<coil::Opcode> opcode = lookupOpcode(name);
+    if (!opcode) {
         error("Unknown instruction: " + name);
         return;
     }
     
     // Create COIL instruction based on operand count
     coil::Instruction coilInstr;
-    coilInstr.opcode = opcode;
+    coilInstr.opcode = *opcode;
     coilInstr.flag0 = flag0;
     
     const auto& operands = instruction.getOperands();
     size_t opCount = operands.size();
     
+    // Section offset of each operand's field, following the header
+    std::array<size_t, 3> fields{};
+    size_t field = layout.offset + INSTRUCTION_HEADER_SIZE;
+    for (size_t i = 0; i < std::min<size_t>(opCount, fields.size()); ++i) {
+        fields[i] = field;
+        field += m_options.compactEncoding ? compactOperandSize(*operands[i]) : OPERAND_SIZE;
+    }
+    
+    // Memory offsets at full width; COIL's operand keeps only 32 bits of them
+    std::array<i64, 3> memoryOffsets{};
+    
     if (opCount == 0) {
         // No operands (e.g., nop, ret)
     }
+    else if (opCount == 1 && layout.form != BranchForm::None) {
+        // Relaxed branch - displacement from the end of the instruction
+        const Symbol& target = ctx.getSymbol(layout.targetId);
+        i64 displacement = static_cast<i64>(target.value) - static_cast<i64>(layout.offset + layout.size);
+        
+        coil::ValueType dispType = coil::ValueType::I32;
+        if (layout.form == BranchForm::Rel8) dispType = coil::ValueType::I8;
+        else if (layout.form == BranchForm::Rel16) dispType = coil::ValueType::I16;
+        
+        coilInstr.dest = coil::createImmOpInt(displacement, dispType);
+    }
     else if (opCount == 1) {
         // One operand (e.g., push, pop, jmp)
-        coilInstr.dest = convertOperand(*operands[0], ctx);
+        coilInstr.dest = convertOperand(*operands[0], ctx, layout, fields[0], coil::ValueType::I32, &memoryOffsets[0]);
     }
     else if (opCount == 2) {
         // Two operands (e.g., mov, load, store)
-        coilInstr.dest = convertOperand(*operands[0], ctx);
-        coilInstr.src1 = convertOperand(*operands[1], ctx);
+        coilInstr.dest = convertOperand(*operands[0], ctx, layout, fields[0], coil::ValueType::I32, &memoryOffsets[0]);
+        coilInstr.src1 = convertOperand(*operands[1], ctx, layout, fields[1], coil::ValueType::I32, &memoryOffsets[1]);
     }
     else if (opCount == 3) {
         // Three operands (e.g., add, sub, mul)
-        coilInstr.dest = convertOperand(*operands[0], ctx);
-        coilInstr.src1 = convertOperand(*operands[1], ctx);
-        coilInstr.src2 = convertOperand(*operands[2], ctx);
+        coilInstr.dest = convertOperand(*operands[0], ctx, layout, fields[0], coil::ValueType::I32, &memoryOffsets[0]);
+        coilInstr.src1 = convertOperand(*operands[1], ctx, layout, fields[1], coil::ValueType::I32, &memoryOffsets[1]);
+        coilInstr.src2 = convertOperand(*operands[2], ctx, layout, fields[2], coil::ValueType::I32, &memoryOffsets[2]);
     }
     else {
         error("Too many operands for instruction: " + name);
@@ -824,135 +785,335 @@ void Assembler::processInstruction(const Instruction& instruction, const std::st
     }
     
     // Encode the instruction
-    std::vector<u8> encoded = encodeInstruction(coilInstr);
+    std::array<u8, MAX_INSTRUCTION_SIZE> encoded;
+    size_t encodedSize = 0;
+    if (m_options.compactEncoding) {
+        // Label operands are relocation fields and, like expressions naming
+        // symbols, were sized before their value was known; they keep their full width
+        u8 fixedWidthMask = 0;
+        for (size_t i = 0; i < opCount; ++i) {
+            if (isSymbolicOperand(*operands[i]) && !(i == 0 && layout.form != BranchForm::None)) {
+                fixedWidthMask |= static_cast<u8>(1u << i);
+            }
+        }
+        encodedSize = encodeCompactInstruction(coilInstr, encoded.data(), layout.form, fixedWidthMask, memoryOffsets);
+    } else {
+        encodedSize = encodeInstruction(coilInstr, encoded.data(), layout.form);
+    }
+    
+    // The first pass must have predicted the size exactly, or every later label is off
+    if (encodedSize != layout.size) {
+        throw AssemblyException("Instruction size mismatch for '" + name + "': laid out " +
+                                std::to_string(layout.size) + " bytes, encoded " +
+                                std::to_string(encodedSize));
+    }
     
     // Add to section
-    ctx.getCurrentSection().addData(encoded);
+    ctx.getCurrentSection().addBytes(encoded.data(), encodedSize);
 }
 
-std::vector<u8> Assembler::encodeInstruction(const coil::Instruction& instr) {
-    // Simple encoding for COIL instruction
-    // In a real implementation, this would be more sophisticated
-    
-    // Encode the instruction into bytes
-    std::vector<u8> encoded;
-    
+namespace {
+
+// Operand kinds that select a fixed store sequence in the 4-byte slot encoding.
+// Immediates are split by width so their value type is examined only once.
+enum class SlotKind : u8 { None, Zero, Reg, Mem, Label, Imm8, Imm16, Imm32, Imm64, Count };
+
+constexpr size_t SLOT_KINDS = static_cast<size_t>(SlotKind::Count);
+constexpr size_t SLOT_SIZE = sizeof(u32);
+
+SlotKind slotKind(const coil::Operand& op) {
+    switch (op.type) {
+        case coil::OperandType::None:  return SlotKind::None;
+        case coil::OperandType::Reg:   return SlotKind::Reg;
+        case coil::OperandType::Mem:   return SlotKind::Mem;
+        case coil::OperandType::Label: return SlotKind::Label;
+        case coil::OperandType::Imm:
+            switch (op.value_type) {
+                case coil::ValueType::I8:
+                case coil::ValueType::U8:
+                    return SlotKind::Imm8;
+                case coil::ValueType::I16:
+                case coil::ValueType::U16:
+                    return SlotKind::Imm16;
+                case coil::ValueType::I32:
+                case coil::ValueType::U32:
+                case coil::ValueType::F32:
+                    return SlotKind::Imm32;
+                case coil::ValueType::I64:
+                case coil::ValueType::U64:
+                case coil::ValueType::F64:
+                    return SlotKind::Imm64;
+                default:
+                    return SlotKind::Zero;
+            }
+        default:
+            return SlotKind::Zero;
+    }
+}
+
+// Store one operand in its little-endian 4-byte slot
+template <SlotKind Kind>
+void storeSlot(u8* slot, const coil::Operand& op) {
+    if constexpr (Kind == SlotKind::Reg) {
+        storeLittleEndian<u32>(slot, op.reg);
+    } else if constexpr (Kind == SlotKind::Mem) {
+        // 16-bit base register and 16-bit offset
+        storeLittleEndian<u16>(slot, static_cast<u16>(op.mem.base));
+        storeLittleEndian<u16>(slot + 2, static_cast<u16>(op.mem.offset));
+    } else if constexpr (Kind == SlotKind::Label) {
+        storeLittleEndian<u32>(slot, op.label);
+    } else if constexpr (Kind == SlotKind::Imm8) {
+        storeLittleEndian<u32>(slot, static_cast<u8>(op.imm.i8_val));
+    } else if constexpr (Kind == SlotKind::Imm16) {
+        storeLittleEndian<u32>(slot, static_cast<u16>(op.imm.i16_val));
+    } else if constexpr (Kind == SlotKind::Imm32) {
+        storeLittleEndian<u32>(slot, static_cast<u32>(op.imm.i32_val));
+    } else if constexpr (Kind == SlotKind::Imm64) {
+        // For 64-bit values, we truncate to 32 bits for now
+        storeLittleEndian<u32>(slot, static_cast<u32>(op.imm.i64_val));
+    } else {
+        storeLittleEndian<u32>(slot, 0);
+    }
+}
+
+// Operand slots of one (dest, src1, src2) shape; returns the bytes written
+template <SlotKind Dest, SlotKind Src1, SlotKind Src2>
+size_t encodeShape(const coil::Instruction& instr, u8* out) {
+    size_t size = 0;
+    if constexpr (Dest != SlotKind::None) {
+        storeSlot<Dest>(out + size, instr.dest);
+        size += SLOT_SIZE;
+    }
+    if constexpr (Src1 != SlotKind::None) {
+        storeSlot<Src1>(out + size, instr.src1);
+        size += SLOT_SIZE;
+    }
+    if constexpr (Src2 != SlotKind::None) {
+        storeSlot<Src2>(out + size, instr.src2);
+        size += SLOT_SIZE;
+    }
+    return size;
+}
+
+using ShapeEncoder = size_t (*)(const coil::Instruction&, u8*);
+
+template <size_t... Shape>
+constexpr std::array<ShapeEncoder, sizeof...(Shape)> makeShapeEncoders(std::index_sequence<Shape...>) {
+    return {{&encodeShape<static_cast<SlotKind>(Shape / (SLOT_KINDS * SLOT_KINDS)),
+                          static_cast<SlotKind>(Shape / SLOT_KINDS % SLOT_KINDS),
+                          static_cast<SlotKind>(Shape % SLOT_KINDS)>...}};
+}
+
+// One encoder per operand shape, indexed by the three slot kinds
+constexpr auto SHAPE_ENCODERS = makeShapeEncoders(std::make_index_sequence<SLOT_KINDS * SLOT_KINDS * SLOT_KINDS>{});
+
+size_t shapeIndex(SlotKind dest, SlotKind src1, SlotKind src2) {
+    return (static_cast<size_t>(dest) * SLOT_KINDS + static_cast<size_t>(src1)) * SLOT_KINDS +
+           static_cast<size_t>(src2);
+}
+
+} // namespace
+
+size_t Assembler::encodeInstruction(const coil::Instruction& instr, u8* out, BranchForm form) {
     // First byte: opcode
-    encoded.push_back(static_cast<u8>(instr.opcode));
+    out[0] = static_cast<u8>(instr.opcode);
     
     // Second byte: flags
-    encoded.push_back(static_cast<u8>(instr.flag0));
+    out[1] = static_cast<u8>(instr.flag0);
     
     // Encode operand types (dest, src1, src2)
     u8 opTypes = 0;
     opTypes |= static_cast<u8>(instr.dest.type) << 4;
     opTypes |= static_cast<u8>(instr.src1.type) << 2;
     opTypes |= static_cast<u8>(instr.src2.type);
-    encoded.push_back(opTypes);
-    
-    // Reserve another byte for future use or alignment
-    encoded.push_back(0);
-    
-    // Encode operands
-    auto encodeOperand = [&encoded](const coil::Operand& op) {
-        switch (op.type) {
-            case coil::OperandType::Reg: {
-                // Encode register index (4 bytes for alignment)
-                encoded.push_back(op.reg & 0xFF);
-                encoded.push_back((op.reg >> 8) & 0xFF);
-                encoded.push_back((op.reg >> 16) & 0xFF);
-                encoded.push_back((op.reg >> 24) & 0xFF);
-                break;
-            }
-            case coil::OperandType::Imm: {
-                // Encode immediate value based on type
-                switch (op.value_type) {
-                    case coil::ValueType::I8:
-                    case coil::ValueType::U8:
-                        encoded.push_back(op.imm.i8_val);
-                        // Pad for alignment
-                        encoded.push_back(0);
-                        encoded.push_back(0);
-                        encoded.push_back(0);
-                        break;
-                    case coil::ValueType::I16:
-                    case coil::ValueType::U16:
-                        encoded.push_back(op.imm.i16_val & 0xFF);
-                        encoded.push_back((op.imm.i16_val >> 8) & 0xFF);
-                        // Pad for alignment
-                        encoded.push_back(0);
-                        encoded.push_back(0);
-                        break;
-                    case coil::ValueType::I32:
-                    case coil::ValueType::U32:
-                    case coil::ValueType::F32:
-                        encoded.push_back(op.imm.i32_val & 0xFF);
-                        encoded.push_back((op.imm.i32_val >> 8) & 0xFF);
-                        encoded.push_back((op.imm.i32_val >> 16) & 0xFF);
-                        encoded.push_back((op.imm.i32_val >> 24) & 0xFF);
-                        break;
-                    case coil::ValueType::I64:
-                    case coil::ValueType::U64:
-                    case coil::ValueType::F64:
-                        encoded.push_back(op.imm.i64_val & 0xFF);
-                        encoded.push_back((op.imm.i64_val >> 8) & 0xFF);
-                        encoded.push_back((op.imm.i64_val >> 16) & 0xFF);
-                        encoded.push_back((op.imm.i64_val >> 24) & 0xFF);
-                        // For 64-bit values, we truncate to 32 bits for now
-                        break;
-                    default:
-                        // For other types, encode as zeros
-                        encoded.push_back(0);
-                        encoded.push_back(0);
-                        encoded.push_back(0);
-                        encoded.push_back(0);
-                        break;
-                }
-                break;
-            }
-            case coil::OperandType::Mem: {
-                // Encode memory reference (base register and offset)
-                encoded.push_back(op.mem.base & 0xFF);
-                encoded.push_back((op.mem.base >> 8) & 0xFF);
-                encoded.push_back(op.mem.offset & 0xFF);
-                encoded.push_back((op.mem.offset >> 8) & 0xFF);
-                break;
-            }
-            case coil::OperandType::Label: {
-                // Encode label reference (index)
-                encoded.push_back(op.label & 0xFF);
-                encoded.push_back((op.label >> 8) & 0xFF);
-                encoded.push_back((op.label >> 16) & 0xFF);
-                encoded.push_back((op.label >> 24) & 0xFF);
-                break;
+    out[2] = opTypes;
+    
+    // Fourth byte: encoding form (branch displacement width)
+    out[3] = static_cast<u8>(form);
+    
+    static_assert(SLOT_SIZE == OPERAND_SIZE, "shape encoders assume fixed operand slots");
+    
+    size_t size = INSTRUCTION_HEADER_SIZE;
+    SlotKind dest = slotKind(instr.dest);
+    
+    if (form != BranchForm::None) {
+        // Branch displacement uses exactly the width of its form
+        if (form == BranchForm::Rel8) {
+            out[size] = static_cast<u8>(instr.dest.imm.i8_val);
+        } else if (form == BranchForm::Rel16) {
+            storeLittleEndian<i16>(out + size, instr.dest.imm.i16_val);
+        } else {
+            storeLittleEndian<i32>(out + size, instr.dest.imm.i32_val);
+        }
+        size += displacementSize(form);
+        dest = SlotKind::None;
+    }
+    
+    // The operand shape picks a specialized store sequence once per instruction
+    ShapeEncoder encode = SHAPE_ENCODERS[shapeIndex(dest, slotKind(instr.src1), slotKind(instr.src2))];
+    return size + encode(instr, out + size);
+}
+
+namespace {
+
+// Store the low width bytes of a value in little-endian order
+void storeWidth(u8* dest, u64 value, size_t width) {
+    u8 bytes[8];
+    storeLittleEndian<u64>(bytes, value);
+    std::memcpy(dest, bytes, width);
+}
+
+// 2-bit code for a payload width of 1, 2, 4 or 8 bytes
+u8 widthCode(size_t width) {
+    return width == 1 ? 0 : width == 2 ? 1 : width == 4 ? 2 : 3;
+}
+
+} // namespace
+
+size_t Assembler::encodeCompactInstruction(const coil::Instruction& instr, u8* out, BranchForm form, u8 fixedWidthMask,
+                                           const std::array<i64, 3>& memoryOffsets) {
+    // Header as in the fixed encoding
+    out[0] = static_cast<u8>(instr.opcode);
+    out[1] = static_cast<u8>(instr.flag0);
+    out[2] = static_cast<u8>((static_cast<u8>(instr.dest.type) << 4) |
+                             (static_cast<u8>(instr.src1.type) << 2) |
+                             static_cast<u8>(instr.src2.type));
+    
+    // Fourth byte: encoding form plus the width code of each operand
+    u8 formByte = static_cast<u8>(form);
+    size_t size = INSTRUCTION_HEADER_SIZE;
+    
+    auto encodeOperand = [out, &size, &formByte, fixedWidthMask, &memoryOffsets](const coil::Operand& op, size_t index) {
+        u8* slot = out + size;
+        size_t width = OPERAND_SIZE;
+        size_t payload = 0;
+        
+        if (fixedWidthMask & (1u << index) && op.type == coil::OperandType::Mem) {
+            // Symbol-dependent memory offset
+            storeLittleEndian<u32>(slot, op.mem.base);
+            storeLittleEndian<u32>(slot + OPERAND_SIZE, static_cast<u32>(memoryOffsets[index]));
+            payload = 2 * OPERAND_SIZE;
+        } else if (fixedWidthMask & (1u << index)) {
+            // Relocation field patched or relocated later, or a symbol-dependent value
+            storeLittleEndian<u32>(slot, static_cast<u32>(op.imm.i32_val));
+            payload = OPERAND_SIZE;
+        } else {
+            switch (op.type) {
+                case coil::OperandType::Reg:
+                    width = unsignedWidth(op.reg);
+                    storeWidth(slot, op.reg, width);
+                    payload = width;
+                    break;
+                    
+                case coil::OperandType::Imm:
+                    switch (op.value_type) {
+                        case coil::ValueType::I8:  width = signedWidth(op.imm.i8_val); break;
+                        case coil::ValueType::I16: width = signedWidth(op.imm.i16_val); break;
+                        case coil::ValueType::I32: width = signedWidth(op.imm.i32_val); break;
+                        case coil::ValueType::I64: width = signedWidth(op.imm.i64_val); break;
+                        case coil::ValueType::U8:  width = unsignedWidth(static_cast<u8>(op.imm.i8_val)); break;
+                        case coil::ValueType::U16: width = unsignedWidth(static_cast<u16>(op.imm.i16_val)); break;
+                        case coil::ValueType::U32: width = unsignedWidth(static_cast<u32>(op.imm.i32_val)); break;
+                        case coil::ValueType::U64: width = unsignedWidth(static_cast<u64>(op.imm.i64_val)); break;
+                        case coil::ValueType::F32: width = sizeof(f32); break;
+                        case coil::ValueType::F64: width = sizeof(f64); break;
+                        default: width = 1; break;
+                    }
+                    
+                    // Narrow values are stored sign- or zero-extended by their type
+                    switch (op.value_type) {
+                        case coil::ValueType::I8:  storeWidth(slot, static_cast<u64>(op.imm.i8_val), width); break;
+                        case coil::ValueType::I16: storeWidth(slot, static_cast<u64>(op.imm.i16_val), width); break;
+                        case coil::ValueType::I32: storeWidth(slot, static_cast<u64>(op.imm.i32_val), width); break;
+                        case coil::ValueType::I64: storeWidth(slot, static_cast<u64>(op.imm.i64_val), width); break;
+                        case coil::ValueType::U8:  storeWidth(slot, static_cast<u8>(op.imm.i8_val), width); break;
+                        case coil::ValueType::U16: storeWidth(slot, static_cast<u16>(op.imm.i16_val), width); break;
+                        case coil::ValueType::U32: storeWidth(slot, static_cast<u32>(op.imm.i32_val), width); break;
+                        case coil::ValueType::U64: storeWidth(slot, static_cast<u64>(op.imm.i64_val), width); break;
+                        case coil::ValueType::F32: storeLittleEndian<f32>(slot, op.imm.f32_val); break;
+                        case coil::ValueType::F64: storeLittleEndian<f64>(slot, op.imm.f64_val); break;
+                        default: slot[0] = 0; break;
+                    }
+                    payload = width;
+                    break;
+                    
+                case coil::OperandType::Mem:
+                    // Base register and full 64-bit offset, sharing one width
+                    width = std::max(unsignedWidth(op.mem.base), signedWidth(memoryOffsets[index]));
+                    storeWidth(slot, op.mem.base, width);
+                    storeWidth(slot + width, static_cast<u64>(memoryOffsets[index]), width);
+                    payload = 2 * width;
+                    break;
+                    
+                case coil::OperandType::Label:
+                    storeLittleEndian<u32>(slot, op.label);
+                    payload = OPERAND_SIZE;
+                    break;
+                    
+                default:
+                    width = 1;
+                    slot[0] = 0;
+                    payload = 1;
+                    break;
             }
-            default:
-                // For None or other types, encode as zeros
-                encoded.push_back(0);
-                encoded.push_back(0);
-                encoded.push_back(0);
-                encoded.push_back(0);
-                break;
         }
+        
+        formByte |= static_cast<u8>(widthCode(width) << (2 + 2 * index));
+        size += payload;
     };
     
-    // Encode operands if present
-    if (instr.dest.type != coil::OperandType::None) {
-        encodeOperand(instr.dest);
+    if (form != BranchForm::None) {
+        // Branch displacement uses exactly the width of its form
+        size_t width = displacementSize(form);
+        storeWidth(out + size, static_cast<u64>(static_cast<i64>(
+            form == BranchForm::Rel8 ? instr.dest.imm.i8_val :
+            form == BranchForm::Rel16 ? instr.dest.imm.i16_val : instr.dest.imm.i32_val)), width);
+        formByte |= static_cast<u8>(widthCode(width) << 2);
+        size += width;
+    } else if (instr.dest.type != coil::OperandType::None) {
+        encodeOperand(instr.dest, 0);
     }
     
     if (instr.src1.type != coil::OperandType::None) {
-        encodeOperand(instr.src1);
+        encodeOperand(instr.src1, 1);
     }
     
     if (instr.src2.type != coil::OperandType::None) {
-        encodeOperand(instr.src2);
+        encodeOperand(instr.src2, 2);
     }
     
-    return encoded;
+    out[3] = formByte;
+    return size;
+}
+
+std::optional<coil::Opcode> Assembler::lookupOpcode(const std::string& name) {
+    static const std::unordered_map<std::string, coil::Opcode> OPCODES = {
+        {"nop", coil::Opcode::Nop},     {"jmp", coil::Opcode::Jump},
+        {"br", coil::Opcode::Br},       {"call", coil::Opcode::Call},
+        {"ret", coil::Opcode::Ret},     {"load", coil::Opcode::Load},
+        {"store", coil::Opcode::Store}, {"push", coil::Opcode::Push},
+        {"pop", coil::Opcode::Pop},     {"mov", coil::Opcode::Mov},
+        {"add", coil::Opcode::Add},     {"sub", coil::Opcode::Sub},
+        {"mul", coil::Opcode::Mul},     {"div", coil::Opcode::Div},
+        {"rem", coil::Opcode::Rem},     {"inc", coil::Opcode::Inc},
+        {"dec", coil::Opcode::Dec},     {"neg", coil::Opcode::Neg},
+        {"and", coil::Opcode::And},     {"or", coil::Opcode::Or},
+        {"xor", coil::Opcode::Xor},     {"not", coil::Opcode::Not},
+        {"shl", coil::Opcode::Shl},     {"shr", coil::Opcode::Shr},
+        {"sar", coil::Opcode::Sar},     {"cmp", coil::Opcode::Cmp},
+        {"test", coil::Opcode::Test},   {"cvt", coil::Opcode::Cvt}
+    };
+    
+    auto it = OPCODES.find(name);
+    if (it != OPCODES.end()) {
+        return it->second;
+    }
+    return std::nullopt;
 }
 
-coil::Operand Assembler::convertOperand(const Operand& operand, AssemblyContext& ctx, coil::ValueType defaultType) {
+coil::Operand Assembler::convertOperand(const Operand& operand, AssemblyContext& ctx,
+                                       const InstructionLayout& layout, size_t fieldOffset,
+                                       coil::ValueType defaultType, i64* memoryOffset) {
     switch (operand.getType()) {
         case Operand::Type::Register: {
             const RegisterOperand* regOp = static_cast<const RegisterOperand*>(&operand);
@@ -966,13 +1127,21 @@ coil::Operand Assembler::convertOperand(const Operand& operand, AssemblyContext&
             
             // Convert immediate value based on format
             if (value.format == ImmediateFormat::Integer) {
-                return coil::createImmOpInt(std::get<i64>(value.value), defaultType);
+                // Values outside 32 bits keep their full width
+                i64 intValue = std::get<i64>(value.value);
+                coil::ValueType type = defaultType;
+                if (type == coil::ValueType::I32 && signedWidth(intValue) > 4) {
+                    type = coil::ValueType::I64;
+                }
+                return coil::createImmOpInt(intValue, type);
             } else if (value.format == ImmediateFormat::Float) {
                 return coil::createImmOpFp(std::get<f64>(value.value), 
                     defaultType == coil::ValueType::F32 || defaultType == coil::ValueType::F64 
                     ? defaultType : coil::ValueType::F64);
             } else if (value.format == ImmediateFormat::Character) {
                 return coil::createImmOpInt(std::get<char>(value.value), defaultType);
+            } else if (value.format == ImmediateFormat::Expression) {
+                return symbolicImmediate(ctx.evaluate(*std::get<ExpressionPtr>(value.value)));
             } else {
                 // Can't represent string as immediate operand directly
                 error("String immediate not supported as operand");
@@ -985,44 +1154,51 @@ coil::Operand Assembler::convertOperand(const Operand& operand, AssemblyContext&
             const MemoryReference& memRef = memOp->getReference();
             
             uint32_t regIndex = getRegisterIndex(memRef.reg);
-            return coil::createMemOp(regIndex, static_cast<int32_t>(memRef.offset), defaultType);
+            i64 offset = memRef.offsetExpr ? ctx.evaluate(*memRef.offsetExpr) : memRef.offset;
+            
+            // The compact form sizes literal offsets by value, but offsets computed from symbols
+            // were laid out with a 32-bit field; the fixed form has a 16-bit field
+            size_t fieldWidth = !m_options.compactEncoding ? 2 : memRef.offsetExpr ? 4 : 8;
+            if (fieldWidth < 8 && signedWidth(offset) > fieldWidth &&
+                unsignedWidth(static_cast<u64>(offset)) > fieldWidth) {
+                error("Memory offset does not fit in a " + std::to_string(8 * fieldWidth) + "-bit field: " +
+                      std::to_string(offset));
+            }
+            if (memoryOffset) {
+                *memoryOffset = offset;
+            }
+            return coil::createMemOp(regIndex, static_cast<int32_t>(offset), defaultType);
         }
         
         case Operand::Type::Label: {
             const LabelOperand* labelOp = static_cast<const LabelOperand*>(&operand);
             const std::string& labelName = labelOp->getLabel();
             
-            // Add a label reference
-            // For COIL, we need to create a proper label reference with relocation
-            // In a real implementation, this would involve relocation entries
+            // Named constants are substituted as immediates
+            if (ctx.isConstant(labelName)) {
+                return symbolicImmediate(ctx.getConstantValue(labelName));
+            }
             
+            // Every label operand is left as a placeholder for the relocation stage.
+            // References within the section are PC-relative, measured from the end
+            // of the instruction, and are resolved once all offsets are final;
+            // the rest need an absolute relocation in the object.
             Symbol* sym = ctx.getSymbol(labelName);
-            if (sym && sym->defined) {
-                // Symbol is already defined
-                if (sym->section == ctx.getCurrentSectionName()) {
-                    // Same section, can use relative addressing
-                    i64 relativeOffset = sym->value - ctx.getCurrentSection().currentOffset - 4;
-                    return coil::createImmOpInt(relativeOffset, coil::ValueType::I32);
-                } else {
-                    // Different section, need absolute reference
-                    return coil::createImmOpInt(sym->value, coil::ValueType::I32);
-                }
-            } else {
-                // Symbol not yet defined or from another section
-                // Add a relocation entry
-                RelocationEntry reloc;
-                reloc.symbolName = labelName;
-                reloc.sectionName = ctx.getCurrentSectionName();
-                reloc.offset = ctx.getCurrentSection().currentOffset;
-                reloc.size = 4;  // 32-bit reference
-                reloc.isRelative = false;
-                reloc.addend = 0;
-                
-                ctx.addRelocation(reloc);
-                
-                // Return a placeholder value
-                return coil::createImmOpInt(0, coil::ValueType::I32);
-            }
+            bool sameSection = sym && sym->defined && sym->section == ctx.getCurrentSectionId();
+            
+            size_t fieldEnd = fieldOffset + OPERAND_SIZE;
+            
+            RelocationEntry reloc;
+            reloc.offset = static_cast<u32>(fieldOffset);
+            reloc.symbol = ctx.referenceSymbol(labelName);
+            reloc.section = ctx.getCurrentSectionId();
+            reloc.kind = packRelocKind(OPERAND_SIZE, sameSection);
+            reloc.addend = sameSection ? static_cast<i64>(fieldEnd) - static_cast<i64>(layout.offset + layout.size) : 0;
+            
+            ctx.addRelocation(reloc);
+            
+            // Return a placeholder value
+            return coil::createImmOpInt(0, coil::ValueType::I32);
         }
         
         default:
@@ -1031,23 +1207,24 @@ coil::Operand Assembler::convertOperand(const Operand& operand, AssemblyContext&
     }
 }
 
-coil::ValueType Assembler::stringToValueType(const std::string& typeStr) {
-    if (typeStr == "i8") return coil::ValueType::I8;
-    if (typeStr == "i16") return coil::ValueType::I16;
-    if (typeStr == "i32") return coil::ValueType::I32;
-    if (typeStr == "i64") return coil::ValueType::I64;
-    if (typeStr == "u8") return coil::ValueType::U8;
-    if (typeStr == "u16") return coil::ValueType::U16;
-    if (typeStr == "u32") return coil::ValueType::U32;
-    if (typeStr == "u64") return coil::ValueType::U64;
-    if (typeStr == "f32") return coil::ValueType::F32;
-    if (typeStr == "f64") return coil::ValueType::F64;
-    
-    error("Unknown type string: " + typeStr);
-    return coil::ValueType::I32; // Default to I32
+coil::Operand Assembler::symbolicImmediate(i64 value) {
+    // Laid out before symbols were known, so always 32 bits wide
+    if (signedWidth(value) > 4 && unsignedWidth(static_cast<u64>(value)) > 4) {
+        error("Value does not fit in a 32-bit operand: " + std::to_string(value));
+    }
+    return coil::createImmOpInt(value, coil::ValueType::I32);
 }
 
 uint32_t Assembler::getRegisterIndex(const std::string& name) {
+    std::optional<u32> index = parseRegisterIndex(name);
+    if (!index) {
+        error("Invalid register name: " + name);
+        return 0;
+    }
+    return *index;
+}
+
+std::optional<u32> Assembler::parseRegisterIndex(const std::string& name) {
     // Extract numeric part of register name
     std::string numStr = name;
     if (numStr.size() > 1 && numStr[0] == 'r') {
@@ -1055,10 +1232,9 @@ uint32_t Assembler::getRegisterIndex(const std::string& name) {
     }
     
     try {
-        return static_cast<uint32_t>(std::stoul(numStr));
-    } catch (const std::exception& e) {
-        error("Invalid register name: " + name);
-        return 0;
+        return static_cast<u32>(std::stoul(numStr));
+    } catch (const std::exception&) {
+        return std::nullopt;
     }
 }
 
@@ -1111,20 +1287,19 @@ Assembler::AssemblyContext::AssemblyContext(const Options& options)
 }
 
 void Assembler::AssemblyContext::ensureSection(const std::string& name) {
-    if (m_sections.find(name) == m_sections.end()) {
-        switchSection(name);
-    } else {
-        m_currentSection = name;
-    }
+    switchSection(name);
 }
 
 void Assembler::AssemblyContext::switchSection(const std::string& name) {
-    m_currentSection = name;
+    // One lookup per switch; emission then goes through the cached pointer
+    SectionId id = m_sections.find(name);
     
     // Create section if it doesn't exist
-    if (m_sections.find(name) == m_sections.end()) {
-        Section section;
+    if (id == NO_SYMBOL) {
+        id = m_sections.intern(name);
+        Section& section = m_sections[id];
         section.name = name;
+        section.id = id;
         
         // Set default flags based on section name
         if (name == ".text") {
@@ -1140,58 +1315,45 @@ void Assembler::AssemblyContext::switchSection(const std::string& name) {
             section.flags = coil::SectionFlag::Alloc;
             section.type = coil::SectionType::ProgBits;
         }
-        
-        m_sections[name] = section;
-    }
-}
-
-Assembler::Section& Assembler::AssemblyContext::getCurrentSection() {
-    if (m_currentSection.empty()) {
-        ensureSection(".text");
     }
     
-    return m_sections[m_currentSection];
+    // Creating a section may move the others, so refresh the cache every time
+    m_currentSection = &m_sections[id];
 }
 
-Assembler::Section* Assembler::AssemblyContext::getSection(const std::string& name) {
-    auto it = m_sections.find(name);
-    if (it != m_sections.end()) {
-        return &it->second;
+SymbolId Assembler::AssemblyContext::addSymbol(const std::string& name, const Symbol& symbol) {
+    // Labels and constants share one namespace
+    if (symbol.defined && isConstant(name)) {
+        throw AssemblyException("Symbol already defined: " + name, symbol.location);
     }
-    return nullptr;
-}
-
-void Assembler::AssemblyContext::addSymbol(const std::string& name, const Symbol& symbol) {
+    
     // Check if symbol already exists
-    auto it = m_symbols.find(name);
-    if (it != m_symbols.end()) {
+    SymbolId id = m_symbols.find(name);
+    if (id != NO_SYMBOL) {
         // Update existing symbol if it's not defined yet
-        if (!it->second.defined) {
-            it->second = symbol;
+        if (!m_symbols[id].defined) {
+            m_symbols[id] = symbol;
         } else if (symbol.defined) {
             // Symbol already defined - error
             throw AssemblyException("Symbol already defined: " + name, symbol.location);
         }
     } else {
         // Add new symbol
-        m_symbols[name] = symbol;
+        id = m_symbols.intern(name);
+        m_symbols[id] = symbol;
     }
+    return id;
 }
 
 Assembler::Symbol* Assembler::AssemblyContext::getSymbol(const std::string& name) {
-    auto it = m_symbols.find(name);
-    if (it != m_symbols.end()) {
-        return &it->second;
-    }
-    return nullptr;
+    return m_symbols.get(name);
 }
 
-void Assembler::AssemblyContext::markSymbolDefined(const std::string& name, u64 value, const std::string& section) {
+void Assembler::AssemblyContext::markSymbolDefined(const std::string& name, u64 value, SectionId section) {
     // Get or create symbol
-    Symbol& sym = m_symbols[name];
+    Symbol& sym = m_symbols[m_symbols.intern(name)];
     
     // Update symbol info
-    sym.name = name;
     sym.value = value;
     sym.section = section;
     sym.defined = true;
@@ -1199,138 +1361,222 @@ void Assembler::AssemblyContext::markSymbolDefined(const std::string& name, u64
 
 void Assembler::AssemblyContext::addGlobalSymbol(const std::string& name) {
     // Get or create symbol
-    Symbol& sym = m_symbols[name];
+    Symbol& sym = m_symbols[m_symbols.intern(name)];
     
     // Mark as global
-    sym.name = name;
     sym.binding = coil::SymbolBinding::Global;
 }
 
+void Assembler::AssemblyContext::defineConstant(const std::string& name, ExpressionPtr value, bool redefinable) {
+    // Evaluate now where possible, so .set may refer to the value it replaces
+    std::optional<i64> result;
+    try {
+        result = evaluateExpression(*value);
+    } catch (const ExpressionException& e) {
+        // Values depending on labels are evaluated once layout is final
+        if (m_layoutFinal) {
+            throw AssemblyException(e.what());
+        }
+    }
+    
+    Constant& constant = m_constants[m_constants.intern(name)];
+    constant.expr = std::move(value);
+    constant.value = result;
+    constant.redefinable = redefinable;
+}
+
+i64 Assembler::AssemblyContext::getConstantValue(const std::string& name) const {
+    try {
+        return constantValue(m_constants.find(name));
+    } catch (const ExpressionException& e) {
+        throw AssemblyException(e.what());
+    }
+}
+
+i64 Assembler::AssemblyContext::evaluate(const Expression& expr) const {
+    try {
+        return evaluateExpression(expr);
+    } catch (const ExpressionException& e) {
+        throw AssemblyException(e.what());
+    }
+}
+
+std::optional<SymbolValue> Assembler::AssemblyContext::resolveSymbol(const std::string& name) const {
+    SymbolId constant = m_constants.find(name);
+    if (constant != NO_SYMBOL) {
+        return SymbolValue{constantValue(constant), SymbolValue::ABSOLUTE};
+    }
+    
+    // Labels have no offset until the layout is final
+    SymbolId id = m_symbols.find(name);
+    if (!m_layoutFinal || id == NO_SYMBOL || !m_symbols[id].defined) {
+        return std::nullopt;
+    }
+    return SymbolValue{static_cast<i64>(m_symbols[id].value), m_symbols[id].section};
+}
+
+i64 Assembler::AssemblyContext::constantValue(SymbolId id) const {
+    const Constant& constant = m_constants[id];
+    if (constant.value) {
+        return *constant.value;
+    }
+    
+    // A chain longer than the number of constants must contain a cycle
+    if (m_constantDepth >= m_constants.size()) {
+        throw ExpressionException("Circular constant definition: @" + m_constants.name(id));
+    }
+    
+    ++m_constantDepth;
+    try {
+        i64 value = evaluateExpression(*constant.expr);
+        --m_constantDepth;
+        return value;
+    } catch (...) {
+        --m_constantDepth;
+        throw;
+    }
+}
+
+i64 Assembler::AssemblyContext::evaluateExpression(const Expression& expr) const {
+    return expr.evaluate([this](const std::string& name) { return resolveSymbol(name); });
+}
+
 void Assembler::AssemblyContext::addRelocation(const RelocationEntry& reloc) {
     m_relocations.push_back(reloc);
 }
 
-void Assembler::AssemblyContext::addImmediate(const ImmediateValue& value, coil::ValueType type) {
-    Section& section = getCurrentSection();
-    
-    switch (type) {
-        case coil::ValueType::I8:
-        case coil::ValueType::U8: {
-            uint8_t byteValue = 0;
-            
-            if (value.format == ImmediateFormat::Integer) {
-                byteValue = static_cast<uint8_t>(std::get<i64>(value.value));
-            } else if (value.format == ImmediateFormat::Character) {
-                byteValue = static_cast<uint8_t>(std::get<char>(value.value));
+size_t Assembler::AssemblyContext::addInstructionLayout(const InstructionLayout& layout) {
+    m_instructionLayouts.push_back(layout);
+    return m_instructionLayouts.size() - 1;
+}
+
+namespace {
+
+// Raw bits of an immediate stored into an integer data slot
+u64 rawIntegerValue(const ImmediateValue& value, coil::ValueType type) {
+    switch (value.format) {
+        case ImmediateFormat::Integer:
+            return static_cast<u64>(std::get<i64>(value.value));
+        case ImmediateFormat::Character:
+            return static_cast<u64>(std::get<char>(value.value));
+        case ImmediateFormat::Float:
+            // Float literals in 32/64-bit integer slots keep their IEEE bit pattern
+            if (type == coil::ValueType::I32 || type == coil::ValueType::U32) {
+                return std::bit_cast<u32>(static_cast<f32>(std::get<f64>(value.value)));
             }
-            
-            section.addByte(byteValue);
-            break;
-        }
-        
-        case coil::ValueType::I16:
-        case coil::ValueType::U16: {
-            uint16_t shortValue = 0;
-            
-            if (value.format == ImmediateFormat::Integer) {
-                shortValue = static_cast<uint16_t>(std::get<i64>(value.value));
-            } else if (value.format == ImmediateFormat::Character) {
-                shortValue = static_cast<uint16_t>(std::get<char>(value.value));
+            if (type == coil::ValueType::I64 || type == coil::ValueType::U64) {
+                return std::bit_cast<u64>(std::get<f64>(value.value));
             }
-            
-            section.addByte(shortValue & 0xFF);
-            section.addByte((shortValue >> 8) & 0xFF);
-            break;
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+// Value of an immediate stored into a floating point data slot
+f64 rawFloatValue(const ImmediateValue& value) {
+    switch (value.format) {
+        case ImmediateFormat::Integer:
+            return static_cast<f64>(std::get<i64>(value.value));
+        case ImmediateFormat::Float:
+            return std::get<f64>(value.value);
+        default:
+            return 0.0;
+    }
+}
+
+// Convert and store a homogeneous array of raw values. Each chunk is
+// converted in a simple loop the compiler can vectorize, then appended
+template <typename T, typename Raw, typename Append>
+void storeArray(const std::vector<Raw>& values, Append&& append) {
+    constexpr size_t CHUNK_ELEMENTS = 4096 / sizeof(T);
+    std::array<u8, CHUNK_ELEMENTS * sizeof(T)> chunk;
+    
+    for (size_t base = 0; base < values.size(); base += CHUNK_ELEMENTS) {
+        const size_t count = std::min(CHUNK_ELEMENTS, values.size() - base);
+        const Raw* src = values.data() + base;
+        for (size_t i = 0; i < count; ++i) {
+            storeLittleEndian<T>(chunk.data() + i * sizeof(T), static_cast<T>(src[i]));
         }
-        
-        case coil::ValueType::I32:
-        case coil::ValueType::U32: {
-            uint32_t wordValue = 0;
-            
-            if (value.format == ImmediateFormat::Integer) {
-                wordValue = static_cast<uint32_t>(std::get<i64>(value.value));
-            } else if (value.format == ImmediateFormat::Character) {
-                wordValue = static_cast<uint32_t>(std::get<char>(value.value));
-            } else if (value.format == ImmediateFormat::Float) {
-                float floatValue = static_cast<float>(std::get<f64>(value.value));
-                std::memcpy(&wordValue, &floatValue, sizeof(float));
-            }
-            
-            section.addByte(wordValue & 0xFF);
-            section.addByte((wordValue >> 8) & 0xFF);
-            section.addByte((wordValue >> 16) & 0xFF);
-            section.addByte((wordValue >> 24) & 0xFF);
-            break;
+        append(chunk.data(), count * sizeof(T));
+    }
+}
+
+} // namespace
+
+void Assembler::AssemblyContext::addImmediates(const std::vector<std::unique_ptr<Operand>>& operands, coil::ValueType type) {
+    bool floating = type == coil::ValueType::F32 || type == coil::ValueType::F64;
+    
+    // Lower the operands to raw scalars; other operands were already reported,
+    // and labels that are not constants still take their slot
+    m_rawIntegers.clear();
+    m_rawFloats.clear();
+    for (const auto& op : operands) {
+        if (op->getType() != Operand::Type::Immediate && op->getType() != Operand::Type::Label) {
+            continue;
         }
         
-        case coil::ValueType::I64:
-        case coil::ValueType::U64: {
-            uint64_t longValue = 0;
-            
-            if (value.format == ImmediateFormat::Integer) {
-                longValue = static_cast<uint64_t>(std::get<i64>(value.value));
-            } else if (value.format == ImmediateFormat::Character) {
-                longValue = static_cast<uint64_t>(std::get<char>(value.value));
-            } else if (value.format == ImmediateFormat::Float) {
-                double doubleValue = std::get<f64>(value.value);
-                std::memcpy(&longValue, &doubleValue, sizeof(double));
+        const ImmediateValue* value = nullptr;
+        i64 result = 0;
+        if (op->getType() == Operand::Type::Label) {
+            const std::string& name = static_cast<const LabelOperand*>(op.get())->getLabel();
+            result = isConstant(name) ? getConstantValue(name) : 0;
+        } else {
+            value = &static_cast<const ImmediateOperand*>(op.get())->getValue();
+            if (value->format == ImmediateFormat::Expression) {
+                result = evaluate(*std::get<ExpressionPtr>(value->value));
+                value = nullptr;
             }
-            
-            section.addByte(longValue & 0xFF);
-            section.addByte((longValue >> 8) & 0xFF);
-            section.addByte((longValue >> 16) & 0xFF);
-            section.addByte((longValue >> 24) & 0xFF);
-            section.addByte((longValue >> 32) & 0xFF);
-            section.addByte((longValue >> 40) & 0xFF);
-            section.addByte((longValue >> 48) & 0xFF);
-            section.addByte((longValue >> 56) & 0xFF);
-            break;
         }
         
-        case coil::ValueType::F32: {
-            float floatValue = 0.0f;
-            
-            if (value.format == ImmediateFormat::Integer) {
-                floatValue = static_cast<float>(std::get<i64>(value.value));
-            } else if (value.format == ImmediateFormat::Float) {
-                floatValue = static_cast<float>(std::get<f64>(value.value));
+        if (!value) {
+            // Value computed from constants or labels
+            if (floating) {
+                m_rawFloats.push_back(static_cast<f64>(result));
+            } else {
+                m_rawIntegers.push_back(static_cast<u64>(result));
             }
+        } else if (floating) {
+            m_rawFloats.push_back(rawFloatValue(*value));
+        } else {
+            m_rawIntegers.push_back(rawIntegerValue(*value, type));
+        }
+    }
+    
+    Section& section = getCurrentSection();
+    auto append = [&section](const u8* bytes, size_t count) {
+        section.addBytes(bytes, count);
+    };
+    
+    switch (type) {
+        case coil::ValueType::I8:
+        case coil::ValueType::U8:
+            storeArray<u8>(m_rawIntegers, append);
+            break;
             
-            // Add float to section (as 4 bytes)
-            uint32_t bits;
-            std::memcpy(&bits, &floatValue, sizeof(float));
+        case coil::ValueType::I16:
+        case coil::ValueType::U16:
+            storeArray<u16>(m_rawIntegers, append);
+            break;
             
-            section.addByte(bits & 0xFF);
-            section.addByte((bits >> 8) & 0xFF);
-            section.addByte((bits >> 16) & 0xFF);
-            section.addByte((bits >> 24) & 0xFF);
+        case coil::ValueType::I32:
+        case coil::ValueType::U32:
+            storeArray<u32>(m_rawIntegers, append);
             break;
-        }
-        
-        case coil::ValueType::F64: {
-            double doubleValue = 0.0;
             
-            if (value.format == ImmediateFormat::Integer) {
-                doubleValue = static_cast<double>(std::get<i64>(value.value));
-            } else if (value.format == ImmediateFormat::Float) {
-                doubleValue = std::get<f64>(value.value);
-            }
+        case coil::ValueType::I64:
+        case coil::ValueType::U64:
+            storeArray<u64>(m_rawIntegers, append);
+            break;
             
-            // Add double to section (as 8 bytes)
-            uint64_t bits;
-            std::memcpy(&bits, &doubleValue, sizeof(double));
+        case coil::ValueType::F32:
+            storeArray<f32>(m_rawFloats, append);
+            break;
             
-            section.addByte(bits & 0xFF);
-            section.addByte((bits >> 8) & 0xFF);
-            section.addByte((bits >> 16) & 0xFF);
-            section.addByte((bits >> 24) & 0xFF);
-            section.addByte((bits >> 32) & 0xFF);
-            section.addByte((bits >> 40) & 0xFF);
-            section.addByte((bits >> 48) & 0xFF);
-            section.addByte((bits >> 56) & 0xFF);
+        case coil::ValueType::F64:
+            storeArray<f64>(m_rawFloats, append);
             break;
-        }
-        
+            
         default:
             throw AssemblyException("Unsupported value type for immediate");
     }
@@ -1345,11 +1591,10 @@ void Assembler::AssemblyContext::addLabelReference(const std::string& label, siz
     
     // Add relocation entry
     RelocationEntry reloc;
-    reloc.symbolName = label;
-    reloc.sectionName = m_currentSection;
-    reloc.offset = section.currentOffset - size;
-    reloc.size = size;
-    reloc.isRelative = isRelative;
+    reloc.offset = static_cast<u32>(section.currentOffset - size);
+    reloc.symbol = m_symbols.intern(label);
+    reloc.section = section.id;
+    reloc.kind = packRelocKind(size, isRelative);
     reloc.addend = addend;
     
     m_relocations.push_back(reloc);
@@ -1359,9 +1604,7 @@ void Assembler::AssemblyContext::addString(const std::string& str, bool nullTerm
     Section& section = getCurrentSection();
     
     // Add string data
-    for (char c : str) {
-        section.addByte(static_cast<u8>(c));
-    }
+    section.addBytes(reinterpret_cast<const u8*>(str.data()), str.size());
     
     // Add null terminator if requested
     if (nullTerminated) {
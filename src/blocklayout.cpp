@@ -0,0 +1,237 @@
+#include <casm/optimizer.hpp>
+#include <casm/cfg.hpp>
+#include <casm/effects.hpp>
+#include <algorithm>
+#include <cctype>
+
+namespace casm {
+
+//
+// Profile-guided block layout
+//
+// Each function with a profile is cut into segments: a labelled block and
+// the unlabelled blocks after it, which control can only enter by falling
+// into them. Segments keep their statements and are reordered as units. The
+// entry segment stays first; from there the layout follows the hotter of the
+// current segment's successors, taken branch or fall-through, while it has
+// run at all. When the chain ends, it restarts at the hottest segment left.
+// Segments that never ran follow in source order. Ties go to the fall-through
+// and then to source order, so a profile always gives the same layout.
+//
+// The transfer ending each segment is then fixed for its new successor: a jmp
+// to the next segment is removed, a br whose target now follows is inverted
+// to branch to its old fall-through, and a lost fall-through becomes a jmp to
+// the segment's label. Functions that run off their end into the next are
+// left alone, since their last segment must stay last.
+//
+
+namespace {
+
+constexpr size_t NO_SEGMENT = ~size_t{0};
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// Label a jmp or br transfers to, if its target is a label
+const std::string* jumpTarget(const Instruction& instr) {
+  std::string name = lowercase(instr.getName());
+  const auto& operands = instr.getOperands();
+  if ((name != "jmp" && name != "br") || operands.size() != 1 || operands[0]->getType() != Operand::Type::Label) {
+    return nullptr;
+  }
+  return &static_cast<const LabelOperand&>(*operands[0]).getLabel();
+}
+
+std::unique_ptr<Instruction> jumpInstruction(const std::string& name, std::vector<std::string> parameters,
+                                             const std::string& target) {
+  auto instr = std::make_unique<Instruction>(name, std::move(parameters));
+  instr->addOperand(Operand::createLabel(target));
+  return instr;
+}
+
+struct Segment {
+  size_t begin = 0;               // First statement
+  size_t end = 0;                 // One past the last statement
+  size_t last = 0;                // Statement index of the last block's final statement
+  std::string label;              // Label jumps to the segment use
+  u64 count = 0;                  // Executions of the head block
+  size_t taken = NO_SEGMENT;      // Segment the final jmp or br transfers to
+  size_t fallThrough = NO_SEGMENT; // Segment control falls into
+};
+
+// Segments of a function, or none if it cannot be reordered
+std::vector<Segment> segmentsOf(const std::vector<Statement>& statements, const ControlFlowGraph& graph,
+                                const Function& function, const Profile& profile) {
+  const auto& blocks = graph.getBlocks();
+  std::vector<Segment> segments;
+  std::vector<size_t> segmentOf(blocks.size(), NO_SEGMENT);
+
+  for (size_t b : function.blocks) {
+    const BasicBlock& block = blocks[b];
+    if (block.fallsOut) {
+      return {};
+    }
+    if (segments.empty() || !block.labels.empty()) {
+      if (!segments.empty()) {
+        segments.back().end = block.begin;
+      }
+      Segment segment;
+      segment.begin = block.begin;
+      segment.label = block.labels.front();
+      for (const std::string& label : block.labels) {
+        segment.count = std::max(segment.count, profile.count(function.name, label));
+      }
+      segments.push_back(std::move(segment));
+    }
+    segments.back().last = block.end - 1;
+    segmentOf[b] = segments.size() - 1;
+  }
+  segments.back().end = function.end;
+
+  for (size_t s = 0; s < segments.size(); ++s) {
+    Segment& segment = segments[s];
+    const Instruction* instr = statements[segment.last].getInstruction();
+    std::string name = instr ? lowercase(instr->getName()) : "";
+    bool conditional = instr && !instr->getParameters().empty();
+
+    if (const std::string* target = instr ? jumpTarget(*instr) : nullptr) {
+      size_t to = graph.findBlock(*target);
+      if (to != ControlFlowGraph::NO_BLOCK && blocks[to].function == blocks[graph.blockOf(segment.last)].function) {
+        segment.taken = segmentOf[to];
+      }
+    }
+
+    // Every segment but the last is followed by another, since none runs off the function
+    bool transfers = name == "jmp" || name == "br" || name == "ret";
+    if ((!transfers || conditional) && s + 1 < segments.size()) {
+      segment.fallThrough = s + 1;
+    }
+  }
+
+  return segments;
+}
+
+// Order of the segments: hot chains from the entry, then the segments that never ran
+std::vector<size_t> layoutOrder(const std::vector<Segment>& segments) {
+  std::vector<bool> placed(segments.size(), false);
+  std::vector<size_t> order;
+  auto place = [&placed, &order](size_t s) {
+    placed[s] = true;
+    order.push_back(s);
+  };
+
+  place(0);
+  size_t current = 0;
+  while (true) {
+    size_t next = NO_SEGMENT;
+    for (size_t candidate : {segments[current].fallThrough, segments[current].taken}) {
+      if (candidate != NO_SEGMENT && !placed[candidate] && segments[candidate].count > 0 &&
+          (next == NO_SEGMENT || segments[candidate].count > segments[next].count)) {
+        next = candidate;
+      }
+    }
+
+    // Otherwise the hottest segment left, the first of equal ones
+    if (next == NO_SEGMENT) {
+      for (size_t s = 0; s < segments.size(); ++s) {
+        if (!placed[s] && segments[s].count > 0 && (next == NO_SEGMENT || segments[s].count > segments[next].count)) {
+          next = s;
+        }
+      }
+    }
+    if (next == NO_SEGMENT) {
+      break;
+    }
+    place(next);
+    current = next;
+  }
+
+  for (size_t s = 0; s < segments.size(); ++s) {
+    if (!placed[s]) {
+      place(s);
+    }
+  }
+  return order;
+}
+
+} // namespace
+
+size_t Optimizer::reorderBlocks(std::vector<Statement>& statements, const Profile& profile) {
+  if (profile.empty()) {
+    return 0;
+  }
+
+  ControlFlowGraph graph = ControlFlowGraph::build(statements);
+  std::vector<Statement> out;
+  out.reserve(statements.size());
+  size_t reordered = 0;
+  size_t copied = 0;
+
+  for (const Function& function : graph.getFunctions()) {
+    if (function.name.empty() || !profile.hasFunction(function.name)) {
+      continue;
+    }
+    std::vector<Segment> segments = segmentsOf(statements, graph, function, profile);
+    if (segments.size() < 2) {
+      continue;
+    }
+    std::vector<size_t> order = layoutOrder(segments);
+    if (std::is_sorted(order.begin(), order.end())) {
+      continue;
+    }
+
+    for (; copied < function.begin; ++copied) {
+      out.push_back(std::move(statements[copied]));
+    }
+
+    for (size_t position = 0; position < order.size(); ++position) {
+      const Segment& segment = segments[order[position]];
+      size_t next = position + 1 < order.size() ? order[position + 1] : NO_SEGMENT;
+      for (size_t i = segment.begin; i < segment.end; ++i) {
+        if (i != segment.last) {
+          out.push_back(std::move(statements[i]));
+        }
+      }
+
+      Statement& last = statements[segment.last];
+      const Instruction* instr = last.getInstruction();
+      bool fallsThrough = segment.fallThrough != NO_SEGMENT;
+      auto inverse = instr && instr->getParameters().size() == 1 ? inverseCondition(instr->getParameters()[0])
+                                                                  : std::nullopt;
+
+      if (segment.taken != NO_SEGMENT && segment.taken == next && !fallsThrough) {
+        // A jmp to the segment placed next does nothing
+        if (!last.getLabel().empty()) {
+          out.emplace_back(last.getLabel());
+        }
+      } else if (segment.taken != NO_SEGMENT && segment.taken == next && fallsThrough &&
+                 segment.fallThrough != next && inverse) {
+        // A br to the segment placed next branches to the old fall-through instead
+        out.emplace_back(jumpInstruction(instr->getName(), {*inverse}, segments[segment.fallThrough].label),
+                         last.getLabel());
+      } else {
+        out.push_back(std::move(last));
+        if (fallsThrough && segment.fallThrough != next) {
+          out.emplace_back(jumpInstruction("jmp", {}, segments[segment.fallThrough].label));
+        }
+      }
+    }
+
+    copied = function.end;
+    ++reordered;
+  }
+
+  if (reordered == 0) {
+    return 0;
+  }
+  for (; copied < statements.size(); ++copied) {
+    out.push_back(std::move(statements[copied]));
+  }
+  statements = std::move(out);
+  m_stats.reorderedFunctions += reordered;
+  return reordered;
+}
+
+} // namespace casm
@@ -0,0 +1,108 @@
+#include <casm/buffer.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace casm {
+
+void SectionBuffer::clear() {
+  m_pages.clear();
+  m_size = 0;
+  m_reserved = 0;
+}
+
+void SectionBuffer::reserve(size_t count) {
+  size_t spare = m_pages.empty() ? 0 : m_pages.back().capacity - m_pages.back().size;
+  m_reserved = count > spare ? count - spare : 0;
+}
+
+void SectionBuffer::append(const u8* bytes, size_t count) {
+  while (count > 0) {
+    if (m_pages.empty() || m_pages.back().size == m_pages.back().capacity) {
+      addPage(count);
+    }
+
+    Page& page = m_pages.back();
+    size_t chunk = std::min(count, page.capacity - page.size);
+    std::memcpy(page.bytes.get() + page.size, bytes, chunk);
+
+    page.size += chunk;
+    m_size += chunk;
+    bytes += chunk;
+    count -= chunk;
+  }
+}
+
+void SectionBuffer::patch(size_t offset, const u8* bytes, size_t count) {
+  if (offset > m_size || count > m_size - offset) {
+    throw std::out_of_range("Section buffer patch out of range");
+  }
+
+  for (size_t index = findPage(offset); count > 0; ++index) {
+    Page& page = m_pages[index];
+    size_t pageOffset = offset - page.start;
+    size_t chunk = std::min(count, page.size - pageOffset);
+    std::memcpy(page.bytes.get() + pageOffset, bytes, chunk);
+
+    offset += chunk;
+    bytes += chunk;
+    count -= chunk;
+  }
+}
+
+void SectionBuffer::read(size_t offset, u8* dest, size_t count) const {
+  if (offset > m_size || count > m_size - offset) {
+    throw std::out_of_range("Section buffer read out of range");
+  }
+
+  for (size_t index = findPage(offset); count > 0; ++index) {
+    const Page& page = m_pages[index];
+    size_t pageOffset = offset - page.start;
+    size_t chunk = std::min(count, page.size - pageOffset);
+    std::memcpy(dest, page.bytes.get() + pageOffset, chunk);
+
+    offset += chunk;
+    dest += chunk;
+    count -= chunk;
+  }
+}
+
+u8 SectionBuffer::operator[](size_t offset) const {
+  u8 value;
+  read(offset, &value, 1);
+  return value;
+}
+
+std::vector<u8> SectionBuffer::toVector() const {
+  std::vector<u8> bytes;
+  bytes.reserve(m_size);
+  forEachSpan([&bytes](const u8* span, size_t count) {
+    bytes.insert(bytes.end(), span, span + count);
+  });
+  return bytes;
+}
+
+SectionBuffer::Page& SectionBuffer::addPage(size_t needed) {
+  // Grow geometrically up to the page limit, or take the reserved size at once
+  size_t capacity = m_pages.empty() ? MIN_PAGE_SIZE : m_pages.back().capacity * 2;
+  capacity = std::max({capacity, needed, m_reserved});
+  capacity = std::clamp(capacity, MIN_PAGE_SIZE, MAX_PAGE_SIZE);
+
+  // An exact reservation smaller than a minimum page is allocated as is
+  if (m_pages.empty() && m_reserved > 0 && m_reserved < MIN_PAGE_SIZE && needed <= m_reserved) {
+    capacity = m_reserved;
+  }
+
+  m_reserved = m_reserved > capacity ? m_reserved - capacity : 0;
+  m_pages.push_back({std::unique_ptr<u8[]>(new u8[capacity]), m_size, 0, capacity});
+  return m_pages.back();
+}
+
+size_t SectionBuffer::findPage(size_t offset) const {
+  // Last page starting at or before the offset
+  auto it = std::upper_bound(m_pages.begin(), m_pages.end(), offset,
+    [](size_t value, const Page& page) { return value < page.start; });
+  return static_cast<size_t>(it - m_pages.begin()) - 1;
+}
+
+} // namespace casm
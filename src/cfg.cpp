@@ -0,0 +1,246 @@
+#include <casm/cfg.hpp>
+#include <algorithm>
+#include <cctype>
+
+namespace casm {
+
+//
+// Control-flow graph
+//
+// Built in two sweeps over the statements. The first splits the code into
+// functions and basic blocks; the second reads the instruction that ends each
+// block and adds its edges. jmp, and br without a condition parameter, are
+// unconditional; br with a condition, and a conditional ret, also fall through.
+// call returns to the next instruction, so it does not end a block.
+//
+
+namespace {
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// Label named by the first operand, if it is a label reference
+const std::string* firstLabel(const std::vector<std::unique_ptr<Operand>>& operands) {
+  if (operands.empty() || operands[0]->getType() != Operand::Type::Label) {
+    return nullptr;
+  }
+  return &static_cast<const LabelOperand&>(*operands[0]).getLabel();
+}
+
+enum class Flow {
+  Next,               // Continues with the next instruction
+  Jump,               // Always transfers to a label
+  Branch,             // Transfers to a label or continues
+  IndirectJump,       // Always transfers to a computed target
+  IndirectBranch,     // Transfers to a computed target or continues
+  Return,             // Always returns
+  ConditionalReturn   // Returns or continues
+};
+
+Flow flowOf(const Instruction& instr) {
+  std::string name = lowercase(instr.getName());
+  bool conditional = !instr.getParameters().empty();
+
+  if (name == "ret") {
+    return conditional ? Flow::ConditionalReturn : Flow::Return;
+  }
+  if (name != "jmp" && name != "br") {
+    return Flow::Next;
+  }
+  if (firstLabel(instr.getOperands())) {
+    return conditional ? Flow::Branch : Flow::Jump;
+  }
+  return conditional ? Flow::IndirectBranch : Flow::IndirectJump;
+}
+
+std::string sectionName(const Directive& directive) {
+  const auto& operands = directive.getOperands();
+  if (const std::string* label = firstLabel(operands)) {
+    return *label;
+  }
+  if (!operands.empty() && operands[0]->getType() == Operand::Type::Immediate) {
+    const ImmediateValue& value = static_cast<const ImmediateOperand&>(*operands[0]).getValue();
+    if (value.format == ImmediateFormat::String) {
+      return std::get<std::string>(value.value);
+    }
+  }
+  return "";
+}
+
+// Whether the statement is an instruction, or labels one through a run of labels
+bool labelsCode(const std::vector<Statement>& statements, size_t index) {
+  for (; index < statements.size(); ++index) {
+    Statement::Type type = statements[index].getType();
+    if (type != Statement::Type::Label && type != Statement::Type::Empty) {
+      return type == Statement::Type::Instruction;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+std::unordered_set<std::string> ControlFlowGraph::functionEntries(const std::vector<Statement>& statements) {
+  // Labels that are exported or called
+  std::unordered_set<std::string> candidates;
+  for (const Statement& stmt : statements) {
+    if (const Directive* directive = stmt.getDirective()) {
+      const std::string* label = firstLabel(directive->getOperands());
+      if (label && directive->getKind() == DirectiveKind::Global) {
+        candidates.insert(*label);
+      }
+    } else if (const Instruction* instr = stmt.getInstruction()) {
+      const std::string* label = firstLabel(instr->getOperands());
+      if (label && lowercase(instr->getName()) == "call") {
+        candidates.insert(*label);
+      }
+    }
+  }
+
+  // Only those defined on code are functions
+  std::unordered_set<std::string> entries;
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const std::string& label = statements[i].getLabel();
+    if (!label.empty() && candidates.count(label) && labelsCode(statements, i)) {
+      entries.insert(label);
+    }
+  }
+  return entries;
+}
+
+ControlFlowGraph ControlFlowGraph::build(const std::vector<Statement>& statements) {
+  ControlFlowGraph graph;
+  graph.m_statementBlocks.assign(statements.size(), NO_BLOCK);
+
+  std::unordered_set<std::string> entries = functionEntries(statements);
+  std::string section = ".text";
+  size_t function = NO_FUNCTION;
+  size_t block = NO_BLOCK;
+  bool blockHasCode = false;    // Current block holds more than labels
+  bool blockEnded = false;      // Current block ends in a control transfer
+
+  auto openFunction = [&](const std::string& name, size_t begin) {
+    function = graph.m_functions.size();
+    graph.m_functions.push_back({name, section, begin, begin, {}, {}});
+    if (!name.empty()) {
+      graph.m_functionIndex[graph.m_functionIndex.intern(name)] = function;
+    }
+    block = NO_BLOCK;
+  };
+
+  // First sweep: functions and blocks
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const Statement& stmt = statements[i];
+    if (stmt.getType() == Statement::Type::Empty) {
+      continue;
+    }
+
+    const Directive* directive = stmt.getDirective();
+    if (directive && directive->getKind() == DirectiveKind::Section) {
+      section = sectionName(*directive);
+      function = NO_FUNCTION;
+      continue;
+    }
+
+    const std::string& label = stmt.getLabel();
+    if (!label.empty() && entries.count(label)) {
+      openFunction(label, i);
+    } else if (function == NO_FUNCTION) {
+      // Data outside functions is not part of the graph
+      if (!labelsCode(statements, i)) {
+        continue;
+      }
+      openFunction("", i);
+    }
+
+    if (block == NO_BLOCK || blockEnded || (!label.empty() && blockHasCode)) {
+      block = graph.m_blocks.size();
+      graph.m_blocks.emplace_back();
+      graph.m_blocks[block].begin = i;
+      graph.m_blocks[block].function = function;
+      graph.m_functions[function].blocks.push_back(block);
+      blockHasCode = false;
+      blockEnded = false;
+    }
+
+    BasicBlock& current = graph.m_blocks[block];
+    if (!label.empty()) {
+      current.labels.push_back(label);
+      graph.m_labelBlocks[graph.m_labelBlocks.intern(label)] = block;
+    }
+    current.end = i + 1;
+    graph.m_functions[function].end = i + 1;
+    graph.m_statementBlocks[i] = block;
+
+    if (stmt.getType() != Statement::Type::Label) {
+      blockHasCode = true;
+    }
+
+    if (const Instruction* instr = stmt.getInstruction()) {
+      blockEnded = flowOf(*instr) != Flow::Next;
+
+      const std::string* callee = firstLabel(instr->getOperands());
+      auto& callees = graph.m_functions[function].callees;
+      if (callee && lowercase(instr->getName()) == "call" &&
+          std::find(callees.begin(), callees.end(), *callee) == callees.end()) {
+        callees.push_back(*callee);
+      }
+    }
+  }
+
+  // Second sweep: edges from the instruction ending each block
+  for (size_t f = 0; f < graph.m_functions.size(); ++f) {
+    const std::vector<size_t>& blocks = graph.m_functions[f].blocks;
+
+    for (size_t k = 0; k < blocks.size(); ++k) {
+      size_t id = blocks[k];
+      BasicBlock& current = graph.m_blocks[id];
+      const Instruction* last = statements[current.end - 1].getInstruction();
+      Flow flow = last ? flowOf(*last) : Flow::Next;
+
+      auto addEdge = [&graph, &current, id](size_t to) {
+        if (std::find(current.successors.begin(), current.successors.end(), to) == current.successors.end()) {
+          current.successors.push_back(to);
+          graph.m_blocks[to].predecessors.push_back(id);
+        }
+      };
+
+      if (flow == Flow::Jump || flow == Flow::Branch) {
+        const std::string& target = *firstLabel(last->getOperands());
+        size_t to = graph.findBlock(target);
+        if (to != NO_BLOCK && graph.m_blocks[to].function == f) {
+          addEdge(to);
+        } else {
+          current.exits.push_back(target);
+        }
+      }
+
+      current.returns = flow == Flow::Return;
+      current.indirect = flow == Flow::IndirectJump || flow == Flow::IndirectBranch;
+
+      if (flow != Flow::Jump && flow != Flow::IndirectJump && flow != Flow::Return) {
+        if (k + 1 < blocks.size()) {
+          addEdge(blocks[k + 1]);
+        } else {
+          current.fallsOut = true;
+        }
+      }
+    }
+  }
+
+  return graph;
+}
+
+size_t ControlFlowGraph::findFunction(std::string_view name) const {
+  SymbolId id = m_functionIndex.find(name);
+  return id == NO_SYMBOL ? NO_FUNCTION : m_functionIndex[id];
+}
+
+size_t ControlFlowGraph::findBlock(std::string_view label) const {
+  SymbolId id = m_labelBlocks.find(label);
+  return id == NO_SYMBOL ? NO_BLOCK : m_labelBlocks[id];
+}
+
+} // namespace casm
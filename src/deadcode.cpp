@@ -0,0 +1,177 @@
+#include <casm/optimizer.hpp>
+#include <casm/cfg.hpp>
+#include <casm/expression.hpp>
+#include <algorithm>
+
+namespace casm {
+
+//
+// Dead-code elimination
+//
+// Blocks are marked live from the roots: the entries of exported and unnamed
+// functions, exported labels, and labels referenced from data or from the
+// directives a dead block would keep. A live block
+// keeps alive its successors and every block whose label it references, so a
+// call or an address taken in live code keeps the target alive. A block that
+// runs off the end of its function keeps alive the next function placed in
+// the same section. Everything else in a function is dead: its instructions,
+// data and label definitions are removed. Alignment, symbol and constant
+// directives are kept, since they may still apply to the code that follows.
+//
+
+namespace {
+
+// Every label named by an operand of the statement, including in expressions
+template <typename Visitor>
+void forEachLabelReference(const Statement& stmt, Visitor&& visit) {
+  const std::vector<std::unique_ptr<Operand>>* operands = nullptr;
+  if (const Instruction* instr = stmt.getInstruction()) {
+    operands = &instr->getOperands();
+  } else if (const Directive* directive = stmt.getDirective()) {
+    // Section names and exports are not references
+    if (directive->getKind() == DirectiveKind::Section || directive->getKind() == DirectiveKind::Global) {
+      return;
+    }
+    operands = &directive->getOperands();
+  }
+  if (!operands) {
+    return;
+  }
+
+  for (const auto& operand : *operands) {
+    if (operand->getType() == Operand::Type::Label) {
+      visit(static_cast<const LabelOperand&>(*operand).getLabel());
+    } else if (operand->getType() == Operand::Type::Immediate) {
+      const ImmediateValue& value = static_cast<const ImmediateOperand&>(*operand).getValue();
+      if (value.format == ImmediateFormat::Expression) {
+        std::get<ExpressionPtr>(value.value)->forEachSymbol(visit);
+      }
+    } else if (operand->getType() == Operand::Type::Memory) {
+      const MemoryReference& ref = static_cast<const MemoryOperand&>(*operand).getReference();
+      if (ref.offsetExpr) {
+        ref.offsetExpr->forEachSymbol(visit);
+      }
+    }
+  }
+}
+
+// Whether a statement in a dead block is removed with it
+bool removedWithBlock(const Statement& stmt) {
+  const Directive* directive = stmt.getDirective();
+  if (!directive) {
+    return true;
+  }
+
+  switch (directive->getKind()) {
+    case DirectiveKind::Align:
+    case DirectiveKind::Global:
+    case DirectiveKind::Local:
+    case DirectiveKind::Equ:
+    case DirectiveKind::Set:
+    case DirectiveKind::Unknown:
+      return false;
+    default:
+      return true;
+  }
+}
+
+} // namespace
+
+size_t Optimizer::eliminateDeadCode(std::vector<Statement>& statements) {
+  ControlFlowGraph graph = ControlFlowGraph::build(statements);
+  const auto& blocks = graph.getBlocks();
+  const auto& functions = graph.getFunctions();
+
+  std::vector<bool> live(blocks.size(), false);
+  std::vector<size_t> worklist;
+
+  auto markLive = [&live, &worklist](size_t block) {
+    if (block != ControlFlowGraph::NO_BLOCK && !live[block]) {
+      live[block] = true;
+      worklist.push_back(block);
+    }
+  };
+
+  // Roots: unnamed functions, exports and labels used outside functions or by kept directives
+  for (const Function& function : functions) {
+    if (function.name.empty()) {
+      markLive(function.blocks.front());
+    }
+  }
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const Directive* directive = statements[i].getDirective();
+    if (directive && directive->getKind() == DirectiveKind::Global && !directive->getOperands().empty() &&
+        directive->getOperands()[0]->getType() == Operand::Type::Label) {
+      markLive(graph.findBlock(static_cast<const LabelOperand&>(*directive->getOperands()[0]).getLabel()));
+    } else if (graph.blockOf(i) == ControlFlowGraph::NO_BLOCK || !removedWithBlock(statements[i])) {
+      forEachLabelReference(statements[i], [&](const std::string& label) { markLive(graph.findBlock(label)); });
+    }
+  }
+
+  while (!worklist.empty()) {
+    size_t id = worklist.back();
+    worklist.pop_back();
+    const BasicBlock& block = blocks[id];
+
+    for (size_t successor : block.successors) {
+      markLive(successor);
+    }
+    for (size_t i = block.begin; i < block.end; ++i) {
+      forEachLabelReference(statements[i], [&](const std::string& label) { markLive(graph.findBlock(label)); });
+    }
+
+    // Falling out of a function continues in the next one in the section
+    if (block.fallsOut) {
+      for (size_t f = block.function + 1; f < functions.size(); ++f) {
+        if (functions[f].section == functions[block.function].section) {
+          markLive(functions[f].blocks.front());
+          break;
+        }
+      }
+    }
+  }
+
+  for (const Function& function : functions) {
+    bool dead = std::none_of(function.blocks.begin(), function.blocks.end(), [&live](size_t id) { return live[id]; });
+    if (dead && !function.name.empty()) {
+      ++m_stats.deadFunctions;
+    }
+  }
+
+  std::vector<Statement> out;
+  out.reserve(statements.size());
+  size_t removed = 0;
+  size_t lastBlock = ControlFlowGraph::NO_BLOCK;
+
+  for (size_t i = 0; i < statements.size(); ++i) {
+    Statement& stmt = statements[i];
+    size_t block = graph.blockOf(i);
+    if (block == ControlFlowGraph::NO_BLOCK || live[block]) {
+      out.push_back(std::move(stmt));
+      continue;
+    }
+
+    if (stmt.getInstruction()) {
+      ++m_stats.deadInstructions;
+    }
+
+    if (removedWithBlock(stmt)) {
+      // Blocks holding only kept directives are not counted
+      if (block != lastBlock) {
+        ++m_stats.unreachableBlocks;
+        lastBlock = block;
+      }
+      ++removed;
+    } else if (stmt.getLabel().empty()) {
+      out.push_back(std::move(stmt));
+    } else {
+      // Keep the directive but not the dead label on it
+      out.emplace_back(std::make_unique<Directive>(*stmt.getDirective()));
+    }
+  }
+
+  statements = std::move(out);
+  return removed;
+}
+
+} // namespace casm
@@ -0,0 +1,148 @@
+#include <casm/optimizer.hpp>
+#include <casm/cfg.hpp>
+#include <casm/effects.hpp>
+#include <casm/liveness.hpp>
+#include <algorithm>
+#include <cctype>
+#include <optional>
+
+namespace casm {
+
+//
+// Dead-store elimination
+//
+// An instruction whose only effect is to write registers and flags that are
+// not live afterwards is removed. A push of a register and the pop that
+// restores it are removed together when the register is not live after the
+// pop, since nothing reads the restored value. The pair must sit in one block
+// with only balanced push/pop pairs and calls between them: any other memory
+// access might address the stack, whose depth changes without the pair.
+// Removing an instruction can make the writes feeding it dead, so the pass
+// repeats until nothing changes.
+//
+
+namespace {
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// Whether nothing reads what the instruction at index writes
+bool isDeadWrite(const Instruction& instr, const InstructionEffects& effects, const Liveness& liveness,
+                 size_t index) {
+  if (effects.stores || effects.stack || effects.clobbers) {
+    return false;
+  }
+  if (effects.writes.empty() && !effects.setsFlags) {
+    return false;
+  }
+  for (size_t operand : effects.writes) {
+    if (liveness.isLiveAfter(index, *registerOf(*instr.getOperands()[operand]))) {
+      return false;
+    }
+  }
+  return !effects.setsFlags || !liveness.isLiveAfter(index, Liveness::FLAGS);
+}
+
+// Register saved by an unconditional push or restored by an unconditional pop
+std::optional<std::string> stackRegister(const Instruction& instr, const char* name) {
+  if (lowercase(instr.getName()) != name || !instr.getParameters().empty() || instr.getOperands().size() != 1) {
+    return std::nullopt;
+  }
+  return registerOf(*instr.getOperands()[0]);
+}
+
+// Index of the pop matching the push at index, if only calls and balanced pairs lie between
+std::optional<size_t> matchingPop(const std::vector<Statement>& statements, size_t index, size_t end) {
+  size_t depth = 0;
+  for (size_t i = index + 1; i < end; ++i) {
+    const Instruction* instr = statements[i].getInstruction();
+    if (!instr) {
+      if (statements[i].getDirective()) {
+        return std::nullopt;
+      }
+      continue;
+    }
+
+    InstructionEffects effects = effectsOf(*instr);
+    std::string name = lowercase(instr->getName());
+    if (effects.stack) {
+      if (effects.conditional) {
+        return std::nullopt;
+      }
+      if (name == "push") {
+        ++depth;
+      } else if (depth == 0) {
+        return i;
+      } else {
+        --depth;
+      }
+    } else if (name != "call" && (effects.clobbers || effects.loads || effects.stores)) {
+      return std::nullopt;
+    }
+  }
+  return std::nullopt;
+}
+
+} // namespace
+
+size_t Optimizer::eliminateDeadStores(std::vector<Statement>& statements) {
+  size_t before = m_stats.deadStores + m_stats.redundantSaves;
+
+  bool changed = true;
+  while (changed) {
+    ControlFlowGraph graph = ControlFlowGraph::build(statements);
+    Liveness liveness = Liveness::analyze(statements, graph);
+    std::vector<bool> removed(statements.size(), false);
+    changed = false;
+
+    for (size_t i = 0; i < statements.size(); ++i) {
+      const Instruction* instr = statements[i].getInstruction();
+      size_t block = graph.blockOf(i);
+      if (!instr || removed[i] || block == ControlFlowGraph::NO_BLOCK) {
+        continue;
+      }
+
+      if (isDeadWrite(*instr, effectsOf(*instr), liveness, i)) {
+        removed[i] = true;
+        ++m_stats.deadStores;
+        changed = true;
+        continue;
+      }
+
+      auto saved = stackRegister(*instr, "push");
+      if (!saved) {
+        continue;
+      }
+      auto pop = matchingPop(statements, i, graph.getBlocks()[block].end);
+      if (pop && stackRegister(*statements[*pop].getInstruction(), "pop") == saved &&
+          !liveness.isLiveAfter(*pop, *saved)) {
+        removed[i] = true;
+        removed[*pop] = true;
+        ++m_stats.redundantSaves;
+        changed = true;
+      }
+    }
+
+    if (!changed) {
+      break;
+    }
+
+    // Labels of removed instructions stay where they were
+    std::vector<Statement> out;
+    out.reserve(statements.size());
+    for (size_t i = 0; i < statements.size(); ++i) {
+      if (!removed[i]) {
+        out.push_back(std::move(statements[i]));
+      } else if (!statements[i].getLabel().empty()) {
+        out.emplace_back(statements[i].getLabel());
+      }
+    }
+    statements = std::move(out);
+  }
+
+  return m_stats.deadStores + m_stats.redundantSaves - before;
+}
+
+} // namespace casm
@@ -0,0 +1,227 @@
+#include <casm/effects.hpp>
+#include <algorithm>
+#include <cctype>
+#include <unordered_map>
+
+namespace casm {
+
+//
+// Instruction effects
+//
+// Classifies instructions by the operands they read and write, for passes
+// that track values through registers and memory. Binary arithmetic takes
+// three operands (dest = src1 op src2) or two (dest = dest op src). Memory is
+// written by store and push and read by load, pop and memory sources.
+// Arithmetic, cmp and test set the flags; moves, loads and stores do not.
+//
+
+namespace {
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+enum class Shape {
+  None,         // nop, ret
+  Move,         // mov, cvt: dest = src
+  Load,         // load: dest = memory
+  Store,        // store: memory = src
+  Push,         // push: stack = src
+  Pop,          // pop: dest = stack
+  Binary,       // dest = src1 op src2, or dest = dest op src
+  Unary,        // dest = op dest
+  Compare,      // cmp, test: flags = src1 op src2
+  Jump,         // jmp, br: reads a computed target
+  Call          // call
+};
+
+Shape shapeOf(const std::string& name) {
+  static const std::unordered_map<std::string, Shape> SHAPES = {
+    {"nop", Shape::None},     {"ret", Shape::None},
+    {"mov", Shape::Move},     {"cvt", Shape::Move},
+    {"load", Shape::Load},    {"store", Shape::Store},
+    {"push", Shape::Push},    {"pop", Shape::Pop},
+    {"add", Shape::Binary},   {"sub", Shape::Binary},
+    {"mul", Shape::Binary},   {"div", Shape::Binary},
+    {"rem", Shape::Binary},   {"and", Shape::Binary},
+    {"or", Shape::Binary},    {"xor", Shape::Binary},
+    {"shl", Shape::Binary},   {"shr", Shape::Binary},
+    {"sar", Shape::Binary},   {"inc", Shape::Unary},
+    {"dec", Shape::Unary},    {"neg", Shape::Unary},
+    {"not", Shape::Unary},    {"cmp", Shape::Compare},
+    {"test", Shape::Compare}, {"jmp", Shape::Jump},
+    {"br", Shape::Jump},      {"call", Shape::Call}
+  };
+
+  auto it = SHAPES.find(name);
+  return it != SHAPES.end() ? it->second : Shape::Call;
+}
+
+} // namespace
+
+bool flagsObserved(const std::vector<Statement>& statements, size_t index, size_t end) {
+  for (size_t i = index + 1; i < end; ++i) {
+    const Statement& stmt = statements[i];
+    if (stmt.getType() == Statement::Type::Empty) {
+      continue;
+    }
+
+    // Control may enter at a label with the flags as they are
+    const Instruction* instr = stmt.getInstruction();
+    if (!instr || !stmt.getLabel().empty()) {
+      return true;
+    }
+
+    InstructionEffects effects = effectsOf(*instr);
+    std::string name = lowercase(instr->getName());
+    if (effects.conditional) {
+      return true;
+    }
+    if (effects.setsFlags) {
+      return false;
+    }
+
+    // The callee or the caller may read them
+    if (effects.clobbers || name == "jmp" || name == "br" || name == "ret") {
+      return true;
+    }
+  }
+
+  // The next block may read them
+  return true;
+}
+
+std::optional<std::string> registerOf(const Operand& operand) {
+  if (operand.getType() != Operand::Type::Register) {
+    return std::nullopt;
+  }
+  return lowercase(static_cast<const RegisterOperand&>(operand).getName());
+}
+
+std::optional<std::string> inverseCondition(const std::string& condition) {
+  static const std::pair<const char*, const char*> INVERSES[] = {
+    {"eq", "neq"}, {"neq", "eq"}, {"gt", "lte"}, {"lte", "gt"}, {"lt", "gte"}, {"gte", "lt"}
+  };
+
+  std::string lower = lowercase(condition);
+  for (const auto& [from, to] : INVERSES) {
+    if (lower == from) {
+      return std::string(to);
+    }
+  }
+  return std::nullopt;
+}
+
+bool isVirtualRegister(const std::string& name) {
+  return name.size() > 1 && (name[0] == 'v' || name[0] == 'V') && std::isdigit(static_cast<unsigned char>(name[1]));
+}
+
+InstructionEffects effectsOf(const Instruction& instr) {
+  InstructionEffects effects;
+  effects.conditional = !instr.getParameters().empty();
+
+  const auto& operands = instr.getOperands();
+  std::string name = lowercase(instr.getName());
+  Shape shape = shapeOf(name);
+
+  // A read operand is a register, or memory through its base register
+  auto read = [&](size_t index) {
+    if (index >= operands.size()) {
+      return;
+    }
+    if (operands[index]->getType() == Operand::Type::Register) {
+      effects.reads.push_back(index);
+    } else if (operands[index]->getType() == Operand::Type::Memory) {
+      effects.loads = true;
+    }
+  };
+
+  // A written operand is a register, or memory at its address
+  auto write = [&](size_t index) {
+    if (index >= operands.size()) {
+      return;
+    }
+    if (operands[index]->getType() == Operand::Type::Register) {
+      effects.writes.push_back(index);
+    } else {
+      effects.stores = true;
+    }
+  };
+
+  switch (shape) {
+    case Shape::None:
+      break;
+
+    case Shape::Move:
+      write(0);
+      read(1);
+      break;
+
+    case Shape::Load:
+      write(0);
+      read(1);
+      effects.loads = true;
+      break;
+
+    case Shape::Store:
+      write(0);
+      read(1);
+      effects.stores = true;
+      break;
+
+    case Shape::Push:
+      read(0);
+      effects.stores = true;
+      effects.stack = true;
+      break;
+
+    case Shape::Pop:
+      write(0);
+      effects.loads = true;
+      effects.stack = true;
+      break;
+
+    case Shape::Binary:
+      if (operands.size() == 2) {
+        read(0);
+      }
+      write(0);
+      for (size_t i = 1; i < operands.size(); ++i) {
+        read(i);
+      }
+      effects.setsFlags = true;
+      break;
+
+    case Shape::Unary:
+      read(0);
+      write(0);
+      effects.setsFlags = true;
+      break;
+
+    case Shape::Compare:
+      for (size_t i = 0; i < operands.size(); ++i) {
+        read(i);
+      }
+      effects.setsFlags = true;
+      break;
+
+    case Shape::Jump:
+    case Shape::Call:
+      for (size_t i = 0; i < operands.size(); ++i) {
+        read(i);
+      }
+      effects.clobbers = shape == Shape::Call;
+      break;
+  }
+
+  for (const auto& operand : operands) {
+    if (operand->getType() == Operand::Type::Memory) {
+      effects.addressReads.push_back(lowercase(static_cast<const MemoryOperand&>(*operand).getReference().reg));
+    }
+  }
+
+  return effects;
+}
+
+} // namespace casm
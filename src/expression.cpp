@@ -0,0 +1,323 @@
+#include <casm/expression.hpp>
+#include <cctype>
+#include <sstream>
+
+namespace casm {
+
+//
+// Expression parsing and evaluation
+//
+// A recursive-descent parser with one function per precedence level, from
+// | (lowest) through ^, &, shifts, + -, * / % to unary operators. Evaluation
+// carries, next to each value, the section of the label it is relative to,
+// so that only label differences within one section can reach the result.
+//
+
+namespace {
+
+class ExpressionParser {
+public:
+  explicit ExpressionParser(std::string_view text) : m_text(text) {}
+
+  ExpressionPtr parse() {
+    ExpressionPtr expr = parseBinary(0);
+    skipSpace();
+    return expr && m_pos == m_text.size() ? expr : nullptr;
+  }
+
+private:
+  struct BinaryOp {
+    std::string_view token;
+    Expression::Op op;
+    int level;
+  };
+
+  // Binary operators by precedence level, lowest first; longer tokens first
+  static constexpr BinaryOp BINARY_OPS[] = {
+    {"|", Expression::Op::Or, 0},
+    {"^", Expression::Op::Xor, 1},
+    {"&", Expression::Op::And, 2},
+    {"<<", Expression::Op::Shl, 3}, {">>", Expression::Op::Shr, 3},
+    {"+", Expression::Op::Add, 4}, {"-", Expression::Op::Sub, 4},
+    {"*", Expression::Op::Mul, 5}, {"/", Expression::Op::Div, 5}, {"%", Expression::Op::Mod, 5},
+  };
+  static constexpr int UNARY_LEVEL = 6;
+
+  ExpressionPtr parseBinary(int level) {
+    if (level == UNARY_LEVEL) {
+      return parseUnary();
+    }
+
+    ExpressionPtr lhs = parseBinary(level + 1);
+    while (lhs) {
+      const BinaryOp* match = matchBinary(level);
+      if (!match) {
+        return lhs;
+      }
+      ExpressionPtr rhs = parseBinary(level + 1);
+      if (!rhs) {
+        return nullptr;
+      }
+      lhs = Expression::binary(match->op, std::move(lhs), std::move(rhs));
+    }
+    return nullptr;
+  }
+
+  const BinaryOp* matchBinary(int level) {
+    skipSpace();
+    for (const BinaryOp& candidate : BINARY_OPS) {
+      if (candidate.level == level && m_text.substr(m_pos, candidate.token.size()) == candidate.token) {
+        m_pos += candidate.token.size();
+        return &candidate;
+      }
+    }
+    return nullptr;
+  }
+
+  ExpressionPtr parseUnary() {
+    skipSpace();
+    if (m_pos >= m_text.size()) {
+      return nullptr;
+    }
+
+    char c = m_text[m_pos];
+    if (c == '-' || c == '~' || c == '+') {
+      ++m_pos;
+      ExpressionPtr operand = parseUnary();
+      if (!operand || c == '+') {
+        return operand;
+      }
+      return Expression::unary(c == '-' ? Expression::Op::Neg : Expression::Op::Not, std::move(operand));
+    }
+
+    if (c == '(') {
+      ++m_pos;
+      ExpressionPtr inner = parseBinary(0);
+      skipSpace();
+      if (!inner || m_pos >= m_text.size() || m_text[m_pos] != ')') {
+        return nullptr;
+      }
+      ++m_pos;
+      return inner;
+    }
+
+    if (c == '@') {
+      ++m_pos;
+      std::string name = scanWord();
+      return name.empty() ? nullptr : Expression::symbol(std::move(name));
+    }
+
+    return parseNumber();
+  }
+
+  // Decimal, 0x/0b/0o prefixed, or CASM style id/ix/ib/io prefixed integers
+  ExpressionPtr parseNumber() {
+    std::string word = scanWord();
+    if (word.empty() || !std::isalnum(static_cast<unsigned char>(word[0]))) {
+      return nullptr;
+    }
+
+    int base = 10;
+    std::string digits = word;
+    if (word.size() > 2 && (word[0] == '0' || word[0] == 'i')) {
+      char prefix = static_cast<char>(std::tolower(static_cast<unsigned char>(word[1])));
+      int prefixed = prefix == 'x' ? 16 : prefix == 'b' ? 2 : prefix == 'o' ? 8 :
+                     (prefix == 'd' && word[0] == 'i') ? 10 : 0;
+      if (prefixed) {
+        base = prefixed;
+        digits = word.substr(2);
+      }
+    }
+
+    try {
+      size_t used = 0;
+      u64 value = std::stoull(digits, &used, base);
+      return used == digits.size() ? Expression::literal(static_cast<i64>(value)) : nullptr;
+    } catch (const std::exception&) {
+      return nullptr;
+    }
+  }
+
+  std::string scanWord() {
+    size_t start = m_pos;
+    while (m_pos < m_text.size() && (std::isalnum(static_cast<unsigned char>(m_text[m_pos])) || m_text[m_pos] == '_')) {
+      ++m_pos;
+    }
+    return std::string(m_text.substr(start, m_pos - start));
+  }
+
+  void skipSpace() {
+    while (m_pos < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_pos]))) {
+      ++m_pos;
+    }
+  }
+
+  std::string_view m_text;
+  size_t m_pos = 0;
+};
+
+const char* opToken(Expression::Op op) {
+  switch (op) {
+    case Expression::Op::Neg: return "-";
+    case Expression::Op::Not: return "~";
+    case Expression::Op::Add: return "+";
+    case Expression::Op::Sub: return "-";
+    case Expression::Op::Mul: return "*";
+    case Expression::Op::Div: return "/";
+    case Expression::Op::Mod: return "%";
+    case Expression::Op::Shl: return "<<";
+    case Expression::Op::Shr: return ">>";
+    case Expression::Op::And: return "&";
+    case Expression::Op::Or:  return "|";
+    case Expression::Op::Xor: return "^";
+    default:                  return "";
+  }
+}
+
+} // namespace
+
+// Value with the section of the label it is relative to, if any
+struct Expression::Value {
+  i64 value = 0;
+  u32 section = SymbolValue::ABSOLUTE;
+
+  bool absolute() const { return section == SymbolValue::ABSOLUTE; }
+};
+
+ExpressionPtr Expression::literal(i64 value) {
+  auto expr = std::make_shared<Expression>();
+  expr->m_op = Op::Literal;
+  expr->m_value = value;
+  return expr;
+}
+
+ExpressionPtr Expression::symbol(std::string name) {
+  auto expr = std::make_shared<Expression>();
+  expr->m_op = Op::Symbol;
+  expr->m_symbol = std::move(name);
+  return expr;
+}
+
+ExpressionPtr Expression::unary(Op op, ExpressionPtr operand) {
+  auto expr = std::make_shared<Expression>();
+  expr->m_op = op;
+  expr->m_lhs = std::move(operand);
+  return expr;
+}
+
+ExpressionPtr Expression::binary(Op op, ExpressionPtr lhs, ExpressionPtr rhs) {
+  auto expr = std::make_shared<Expression>();
+  expr->m_op = op;
+  expr->m_lhs = std::move(lhs);
+  expr->m_rhs = std::move(rhs);
+  return expr;
+}
+
+ExpressionPtr Expression::parse(std::string_view text) {
+  return ExpressionParser(text).parse();
+}
+
+i64 Expression::evaluate(const Resolver& resolve) const {
+  Value result = evaluateNode(resolve);
+  if (!result.absolute()) {
+    throw ExpressionException("Labels in an expression must be subtracted in pairs from the same section: " +
+                              toString());
+  }
+  return result.value;
+}
+
+std::optional<i64> Expression::constantValue() const {
+  bool symbolic = false;
+  forEachSymbol([&symbolic](const std::string&) { symbolic = true; });
+  if (symbolic) {
+    return std::nullopt;
+  }
+  return evaluate([](const std::string&) { return std::nullopt; });
+}
+
+Expression::Value Expression::evaluateNode(const Resolver& resolve) const {
+  switch (m_op) {
+    case Op::Literal:
+      return {m_value, SymbolValue::ABSOLUTE};
+
+    case Op::Symbol: {
+      std::optional<SymbolValue> symbol = resolve(m_symbol);
+      if (!symbol) {
+        throw ExpressionException("Undefined symbol in expression: @" + m_symbol);
+      }
+      return {symbol->value, symbol->section};
+    }
+
+    default:
+      break;
+  }
+
+  Value lhs = m_lhs->evaluateNode(resolve);
+  Value rhs = m_rhs ? m_rhs->evaluateNode(resolve) : Value{};
+
+  // Wrapping arithmetic, as on the target
+  u64 a = static_cast<u64>(lhs.value);
+  u64 b = static_cast<u64>(rhs.value);
+
+  // Label-relative values only survive addition of a constant and subtraction
+  if (m_op == Op::Add && (lhs.absolute() || rhs.absolute())) {
+    return {static_cast<i64>(a + b), lhs.absolute() ? rhs.section : lhs.section};
+  }
+  if (m_op == Op::Sub && (rhs.absolute() || lhs.section == rhs.section)) {
+    return {static_cast<i64>(a - b), rhs.absolute() ? lhs.section : SymbolValue::ABSOLUTE};
+  }
+  if (!lhs.absolute() || !rhs.absolute()) {
+    throw ExpressionException("Labels in an expression must be subtracted in pairs from the same section: " +
+                              toString());
+  }
+
+  switch (m_op) {
+    case Op::Neg: return {static_cast<i64>(0 - a)};
+    case Op::Not: return {static_cast<i64>(~a)};
+    case Op::Mul: return {static_cast<i64>(a * b)};
+    case Op::And: return {static_cast<i64>(a & b)};
+    case Op::Or:  return {static_cast<i64>(a | b)};
+    case Op::Xor: return {static_cast<i64>(a ^ b)};
+
+    case Op::Div:
+    case Op::Mod:
+      if (rhs.value == 0) {
+        throw ExpressionException("Division by zero in expression: " + toString());
+      }
+      if (rhs.value == -1) {
+        // Avoid the INT64_MIN / -1 trap
+        return {m_op == Op::Div ? static_cast<i64>(0 - a) : 0};
+      }
+      return {m_op == Op::Div ? lhs.value / rhs.value : lhs.value % rhs.value};
+
+    case Op::Shl:
+    case Op::Shr:
+      if (rhs.value < 0 || rhs.value >= 64) {
+        throw ExpressionException("Shift count out of range in expression: " + toString());
+      }
+      // >> is arithmetic, like sar
+      return {m_op == Op::Shl ? static_cast<i64>(a << rhs.value) : lhs.value >> rhs.value};
+
+    default:
+      return {static_cast<i64>(a + b)};
+  }
+}
+
+std::string Expression::toString() const {
+  switch (m_op) {
+    case Op::Literal:
+      return std::to_string(m_value);
+    case Op::Symbol:
+      return "@" + m_symbol;
+    case Op::Neg:
+    case Op::Not:
+      return opToken(m_op) + m_lhs->toString();
+    default: {
+      std::ostringstream ss;
+      ss << "(" << m_lhs->toString() << " " << opToken(m_op) << " " << m_rhs->toString() << ")";
+      return ss.str();
+    }
+  }
+}
+
+} // namespace casm
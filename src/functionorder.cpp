@@ -0,0 +1,330 @@
+#include <casm/optimizer.hpp>
+#include <casm/cfg.hpp>
+#include <algorithm>
+#include <cctype>
+#include <map>
+
+namespace casm {
+
+//
+// Call-graph function ordering
+//
+// Functions that follow one another in a section, with nothing but empty
+// statements between them, form a run, and each run is ordered on its own.
+// A function that runs off its end stays glued to the next one, and .align
+// directives in front of a function's entry label move with it. The resulting
+// units are the nodes of an undirected call graph: every call or jump from
+// one unit to the entry label of another adds the number of times it ran to
+// their edge. That is the profile count of the labelled block holding it, or
+// 1 in functions the profile does not list.
+//
+// Units are clustered as Pettis and Hansen describe: the two clusters joined
+// by the heaviest edge are merged, in the orientation that puts the units of
+// the heaviest single edge between them closest together, until no edges are
+// left. Ties go to source order, so a program always gets the same layout.
+// The first unit of a run stays first, since code may be entered at the start
+// of its section; its cluster leads, the others follow heaviest first and
+// units with no calls at all keep their source order at the end.
+//
+
+namespace {
+
+constexpr size_t NO_UNIT = ~size_t{0};
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// Label a call, jmp or br transfers to, if its target is a label
+const std::string* transferTarget(const Instruction& instr) {
+  std::string name = lowercase(instr.getName());
+  const auto& operands = instr.getOperands();
+  if ((name != "call" && name != "jmp" && name != "br") || operands.empty() ||
+      operands[0]->getType() != Operand::Type::Label) {
+    return nullptr;
+  }
+  return &static_cast<const LabelOperand&>(*operands[0]).getLabel();
+}
+
+bool isAlign(const Statement& stmt) {
+  const Directive* directive = stmt.getDirective();
+  return directive && directive->getKind() == DirectiveKind::Align && stmt.getLabel().empty();
+}
+
+// Whether control can run off the end of a function into the next one. A
+// block of directives after the last ret falls out but is never entered.
+bool runsIntoNext(const std::vector<Statement>& statements, const ControlFlowGraph& graph, const Function& function) {
+  const BasicBlock& last = graph.getBlocks()[function.blocks.back()];
+  if (!last.fallsOut) {
+    return false;
+  }
+  if (function.blocks.size() == 1 || !last.predecessors.empty()) {
+    return true;
+  }
+  for (size_t i = last.begin; i < last.end; ++i) {
+    if (statements[i].getInstruction()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+struct Unit {
+  size_t begin = 0;               // First statement, including leading .align directives
+  size_t end = 0;                 // One past the last statement
+  size_t functions = 0;           // Functions in the unit
+};
+
+struct Cluster {
+  std::vector<size_t> units;      // Units in layout order
+  std::map<size_t, u64> edges;    // Weight of the edges to each other cluster
+  u64 weight = 0;                 // Weight of the edges inside the cluster
+};
+
+using UnitEdges = std::map<std::pair<size_t, size_t>, u64>;
+
+// Functions of each run, in source order
+std::vector<std::vector<size_t>> runsOf(const std::vector<Statement>& statements, const ControlFlowGraph& graph) {
+  const auto& functions = graph.getFunctions();
+  std::vector<std::vector<size_t>> runs;
+
+  for (size_t f = 0; f < functions.size(); ++f) {
+    bool adjacent = f > 0 && functions[f].section == functions[f - 1].section;
+    for (size_t i = f > 0 ? functions[f - 1].end : 0; adjacent && i < functions[f].begin; ++i) {
+      adjacent = statements[i].getType() == Statement::Type::Empty;
+    }
+    if (!adjacent) {
+      runs.emplace_back();
+    }
+    runs.back().push_back(f);
+  }
+  return runs;
+}
+
+// Weights of the calls and jumps between units of a run
+UnitEdges edgesOf(const std::vector<Statement>& statements, const ControlFlowGraph& graph,
+                  const std::vector<size_t>& run, const std::vector<size_t>& unitOf, const Profile& profile) {
+  const auto& functions = graph.getFunctions();
+  const auto& blocks = graph.getBlocks();
+  UnitEdges edges;
+
+  for (size_t f : run) {
+    const Function& function = functions[f];
+    bool profiled = profile.hasFunction(function.name);
+    u64 count = profiled ? 0 : 1;
+
+    for (size_t b : function.blocks) {
+      const BasicBlock& block = blocks[b];
+      if (profiled && !block.labels.empty()) {
+        count = 0;
+        for (const std::string& label : block.labels) {
+          count = std::max(count, profile.count(function.name, label));
+        }
+      }
+      if (count == 0) {
+        continue;
+      }
+
+      for (size_t i = block.begin; i < block.end; ++i) {
+        const Instruction* instr = statements[i].getInstruction();
+        const std::string* target = instr ? transferTarget(*instr) : nullptr;
+        size_t callee = target ? graph.findFunction(*target) : ControlFlowGraph::NO_FUNCTION;
+        if (callee == ControlFlowGraph::NO_FUNCTION || unitOf[callee] == NO_UNIT || unitOf[callee] == unitOf[f]) {
+          continue;
+        }
+        size_t from = unitOf[f];
+        size_t to = unitOf[callee];
+        edges[{std::min(from, to), std::max(from, to)}] += count;
+      }
+    }
+  }
+  return edges;
+}
+
+// Join cluster second onto cluster first, keeping unit 0 at the front of cluster 0
+void merge(std::vector<Cluster>& clusters, std::vector<size_t>& clusterOf, const UnitEdges& edges, size_t first,
+           size_t second) {
+  Cluster& a = clusters[first];
+  Cluster& b = clusters[second];
+
+  // The heaviest edge between the two, the first of equal ones
+  size_t x = a.units.front();
+  size_t y = b.units.front();
+  u64 heaviest = 0;
+  for (const auto& [units, weight] : edges) {
+    auto [u, v] = units;
+    if (clusterOf[u] == second && clusterOf[v] == first) {
+      std::swap(u, v);
+    }
+    if (clusterOf[u] == first && clusterOf[v] == second && weight > heaviest) {
+      x = u;
+      y = v;
+      heaviest = weight;
+    }
+  }
+
+  size_t ix = std::find(a.units.begin(), a.units.end(), x) - a.units.begin();
+  size_t iy = std::find(b.units.begin(), b.units.end(), y) - b.units.begin();
+  bool reverseA = false;
+  bool reverseB = false;
+  size_t closest = ~size_t{0};
+  for (bool ra : {false, true}) {
+    if (ra && first == 0) {
+      continue;
+    }
+    for (bool rb : {false, true}) {
+      size_t px = ra ? a.units.size() - 1 - ix : ix;
+      size_t py = a.units.size() + (rb ? b.units.size() - 1 - iy : iy);
+      if (py - px < closest) {
+        closest = py - px;
+        reverseA = ra;
+        reverseB = rb;
+      }
+    }
+  }
+
+  if (reverseA) {
+    std::reverse(a.units.begin(), a.units.end());
+  }
+  if (reverseB) {
+    std::reverse(b.units.begin(), b.units.end());
+  }
+  for (size_t unit : b.units) {
+    clusterOf[unit] = first;
+    a.units.push_back(unit);
+  }
+
+  a.weight += b.weight + a.edges[second];
+  a.edges.erase(second);
+  for (const auto& [other, weight] : b.edges) {
+    if (other == first) {
+      continue;
+    }
+    a.edges[other] += weight;
+    clusters[other].edges.erase(second);
+    clusters[other].edges[first] += weight;
+  }
+  b = Cluster();
+}
+
+// Order of the units: the cluster of unit 0, then the others heaviest first
+std::vector<size_t> orderOf(size_t unitCount, const UnitEdges& edges) {
+  std::vector<Cluster> clusters(unitCount);
+  std::vector<size_t> clusterOf(unitCount);
+  for (size_t u = 0; u < unitCount; ++u) {
+    clusters[u].units.push_back(u);
+    clusterOf[u] = u;
+  }
+  for (const auto& [units, weight] : edges) {
+    clusters[units.first].edges[units.second] += weight;
+    clusters[units.second].edges[units.first] += weight;
+  }
+
+  // Clusters are merged into the lower index, so cluster 0 always holds unit 0
+  while (true) {
+    size_t first = NO_UNIT;
+    size_t second = NO_UNIT;
+    u64 heaviest = 0;
+    for (size_t c = 0; c < clusters.size(); ++c) {
+      for (const auto& [other, weight] : clusters[c].edges) {
+        if (other > c && weight > heaviest) {
+          first = c;
+          second = other;
+          heaviest = weight;
+        }
+      }
+    }
+    if (first == NO_UNIT) {
+      break;
+    }
+    merge(clusters, clusterOf, edges, first, second);
+  }
+
+  std::vector<size_t> leaders;
+  for (size_t c = 1; c < clusters.size(); ++c) {
+    if (!clusters[c].units.empty()) {
+      leaders.push_back(c);
+    }
+  }
+  std::stable_sort(leaders.begin(), leaders.end(),
+                   [&clusters](size_t a, size_t b) { return clusters[a].weight > clusters[b].weight; });
+
+  std::vector<size_t> order = clusters[0].units;
+  for (size_t c : leaders) {
+    order.insert(order.end(), clusters[c].units.begin(), clusters[c].units.end());
+  }
+  return order;
+}
+
+} // namespace
+
+size_t Optimizer::orderFunctions(std::vector<Statement>& statements, const Profile& profile) {
+  ControlFlowGraph graph = ControlFlowGraph::build(statements);
+  const auto& functions = graph.getFunctions();
+  std::vector<Statement> out;
+  out.reserve(statements.size());
+  size_t moved = 0;
+  size_t copied = 0;
+
+  for (const std::vector<size_t>& run : runsOf(statements, graph)) {
+    if (run.size() < 2) {
+      continue;
+    }
+
+    // Units: functions glued to the ones they run into
+    std::vector<Unit> units;
+    std::vector<size_t> unitOf(functions.size(), NO_UNIT);
+    for (size_t f : run) {
+      const Function& function = functions[f];
+      if (units.empty() || !runsIntoNext(statements, graph, functions[f - 1])) {
+        size_t begin = function.begin;
+        while (!units.empty() && begin > units.back().begin + 1 &&
+               (statements[begin - 1].getType() == Statement::Type::Empty || isAlign(statements[begin - 1]))) {
+          --begin;
+        }
+        if (!units.empty()) {
+          units.back().end = begin;
+        }
+        units.push_back({begin, function.end, 0});
+      }
+      units.back().end = function.end;
+      ++units.back().functions;
+      unitOf[f] = units.size() - 1;
+    }
+    if (units.size() < 2) {
+      continue;
+    }
+
+    std::vector<size_t> order = orderOf(units.size(), edgesOf(statements, graph, run, unitOf, profile));
+    if (std::is_sorted(order.begin(), order.end())) {
+      continue;
+    }
+
+    for (; copied < units.front().begin; ++copied) {
+      out.push_back(std::move(statements[copied]));
+    }
+    for (size_t position = 0; position < order.size(); ++position) {
+      const Unit& unit = units[order[position]];
+      for (size_t i = unit.begin; i < unit.end; ++i) {
+        out.push_back(std::move(statements[i]));
+      }
+      if (order[position] != position) {
+        moved += unit.functions;
+      }
+    }
+    copied = units.back().end;
+  }
+
+  if (moved == 0) {
+    return 0;
+  }
+  for (; copied < statements.size(); ++copied) {
+    out.push_back(std::move(statements[copied]));
+  }
+  statements = std::move(out);
+  m_stats.orderedFunctions += moved;
+  return moved;
+}
+
+} // namespace casm
@@ -0,0 +1,223 @@
+#include <casm/optimizer.hpp>
+#include <casm/cfg.hpp>
+#include <casm/effects.hpp>
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <optional>
+#include <set>
+#include <unordered_map>
+
+namespace casm {
+
+//
+// Inlining
+//
+// A local function is inlined when its entry block is a leaf body: at most
+// the limit of instructions, with no call, unknown instruction or directive,
+// ending in an unconditional ret. Branches end a block, so the body is
+// straight-line code. Any push in it must be popped before the ret, which
+// would otherwise return through the value pushed. An unconditional call to
+// the function is replaced by a copy of the body without the ret; the copy
+// behaves as the call did, since no calling convention protects registers
+// across a call. The callee's virtual registers are renamed to ones the
+// caller does not use, so they cannot clobber the caller's. Functions left
+// without calls or references are removed by dead-code elimination.
+//
+
+namespace {
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// Label called by an unconditional single-operand call
+const std::string* callTarget(const Instruction& instr) {
+  const auto& operands = instr.getOperands();
+  if (lowercase(instr.getName()) != "call" || !instr.getParameters().empty() || operands.size() != 1 ||
+      operands[0]->getType() != Operand::Type::Label) {
+    return nullptr;
+  }
+  return &static_cast<const LabelOperand&>(*operands[0]).getLabel();
+}
+
+// Number of a virtual register name (v12 is 12)
+size_t virtualNumber(const std::string& name) {
+  return std::stoul(name.substr(1));
+}
+
+// Virtual registers named by an instruction, as operands or address bases
+void collectVirtualRegisters(const Instruction& instr, std::set<std::string>& registers) {
+  for (const auto& operand : instr.getOperands()) {
+    std::optional<std::string> reg = registerOf(*operand);
+    if (operand->getType() == Operand::Type::Memory) {
+      reg = lowercase(static_cast<const MemoryOperand&>(*operand).getReference().reg);
+    }
+    if (reg && isVirtualRegister(*reg)) {
+      registers.insert(*reg);
+    }
+  }
+}
+
+// Copy of an operand with its register, or memory base register, renamed
+std::unique_ptr<Operand> renameOperand(const Operand& operand, const std::map<std::string, std::string>& names) {
+  auto rename = [&names](const std::string& reg) {
+    auto it = names.find(lowercase(reg));
+    return it != names.end() ? it->second : reg;
+  };
+
+  switch (operand.getType()) {
+    case Operand::Type::Register:
+      return Operand::createRegister(rename(static_cast<const RegisterOperand&>(operand).getName()));
+    case Operand::Type::Immediate:
+      return Operand::createImmediate(static_cast<const ImmediateOperand&>(operand).getValue());
+    case Operand::Type::Memory: {
+      MemoryReference ref = static_cast<const MemoryOperand&>(operand).getReference();
+      ref.reg = rename(ref.reg);
+      return Operand::createMemory(ref);
+    }
+    case Operand::Type::Label:
+      return Operand::createLabel(static_cast<const LabelOperand&>(operand).getLabel());
+  }
+  return nullptr;
+}
+
+// Inlinable body of a function: its entry block's instructions before the ret
+struct Body {
+  std::vector<const Instruction*> instructions;
+  std::set<std::string> virtualRegisters;
+};
+
+std::optional<Body> leafBody(const std::vector<Statement>& statements, const BasicBlock& entry, size_t limit) {
+  if (!entry.returns) {
+    return std::nullopt;
+  }
+
+  Body body;
+  size_t depth = 0;
+  for (size_t i = entry.begin; i + 1 < entry.end; ++i) {
+    const Statement& stmt = statements[i];
+    if (stmt.getDirective()) {
+      return std::nullopt;
+    }
+    const Instruction* instr = stmt.getInstruction();
+    if (!instr) {
+      continue;
+    }
+
+    InstructionEffects effects = effectsOf(*instr);
+    if (effects.clobbers || body.instructions.size() == limit) {
+      return std::nullopt;
+    }
+    if (effects.stack) {
+      bool push = lowercase(instr->getName()) == "push";
+      if (effects.conditional || (!push && depth == 0)) {
+        return std::nullopt;
+      }
+      depth = push ? depth + 1 : depth - 1;
+    }
+
+    body.instructions.push_back(instr);
+    collectVirtualRegisters(*instr, body.virtualRegisters);
+  }
+
+  if (depth != 0) {
+    return std::nullopt;
+  }
+  return body;
+}
+
+} // namespace
+
+size_t Optimizer::inlineCalls(std::vector<Statement>& statements) {
+  if (m_inlineLimit == 0) {
+    return 0;
+  }
+
+  ControlFlowGraph graph = ControlFlowGraph::build(statements);
+  const auto& blocks = graph.getBlocks();
+  const auto& functions = graph.getFunctions();
+
+  std::set<std::string> exported;
+  for (const Statement& stmt : statements) {
+    const Directive* directive = stmt.getDirective();
+    if (directive && directive->getKind() == DirectiveKind::Global && !directive->getOperands().empty() &&
+        directive->getOperands()[0]->getType() == Operand::Type::Label) {
+      exported.insert(static_cast<const LabelOperand&>(*directive->getOperands()[0]).getLabel());
+    }
+  }
+
+  // Bodies of the local functions small enough to inline
+  std::unordered_map<std::string, Body> bodies;
+  for (const Function& function : functions) {
+    if (function.name.empty() || exported.count(function.name)) {
+      continue;
+    }
+    if (auto body = leafBody(statements, blocks[function.blocks.front()], m_inlineLimit)) {
+      bodies.emplace(function.name, std::move(*body));
+    }
+  }
+  if (bodies.empty()) {
+    return 0;
+  }
+
+  // Virtual registers each function uses, to pick fresh names for inlined ones
+  std::vector<size_t> nextVirtual(functions.size(), 0);
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const Instruction* instr = statements[i].getInstruction();
+    size_t block = graph.blockOf(i);
+    if (!instr || block == ControlFlowGraph::NO_BLOCK) {
+      continue;
+    }
+    std::set<std::string> registers;
+    collectVirtualRegisters(*instr, registers);
+    for (const std::string& reg : registers) {
+      size_t& next = nextVirtual[blocks[block].function];
+      next = std::max(next, virtualNumber(reg) + 1);
+    }
+  }
+
+  std::vector<Statement> out;
+  out.reserve(statements.size());
+  size_t inlined = 0;
+
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const Instruction* instr = statements[i].getInstruction();
+    const std::string* target = instr ? callTarget(*instr) : nullptr;
+    size_t block = graph.blockOf(i);
+    auto it = target ? bodies.find(*target) : bodies.end();
+    if (it == bodies.end() || block == ControlFlowGraph::NO_BLOCK) {
+      out.push_back(std::move(statements[i]));
+      continue;
+    }
+
+    const Body& body = it->second;
+    std::map<std::string, std::string> names;
+    size_t& next = nextVirtual[blocks[block].function];
+    for (const std::string& reg : body.virtualRegisters) {
+      names[reg] = "v" + std::to_string(next++);
+    }
+
+    // The call's label moves to the first instruction of the copy
+    std::string label = statements[i].getLabel();
+    for (const Instruction* bodyInstr : body.instructions) {
+      auto copy = std::make_unique<Instruction>(bodyInstr->getName(), bodyInstr->getParameters());
+      for (const auto& operand : bodyInstr->getOperands()) {
+        copy->addOperand(renameOperand(*operand, names));
+      }
+      out.emplace_back(std::move(copy), label);
+      label.clear();
+    }
+    if (!label.empty()) {
+      out.emplace_back(std::move(label));
+    }
+    ++inlined;
+  }
+
+  statements = std::move(out);
+  m_stats.inlinedCalls += inlined;
+  return inlined;
+}
+
+} // namespace casm
@@ -0,0 +1,187 @@
+#include <casm/optimizer.hpp>
+#include <casm/cfg.hpp>
+#include <casm/effects.hpp>
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <set>
+
+namespace casm {
+
+//
+// Jump threading and branch folding
+//
+// Three rewrites over the blocks of each function, repeated until nothing
+// changes:
+//
+//   jmp @a ... #a jmp @b           jmp @b          (threading, also for br)
+//   br ^eq @a; jmp @b; #a          br ^neq @b      (branch inversion)
+//   jmp @a; #a                     #a              (jump to the next block)
+//
+// A jump is threaded through blocks that hold nothing but an unconditional
+// jmp to a label; a chain that loops back on itself is left alone. A branch
+// is only inverted over an unlabelled jmp, which nothing else can reach, and
+// only for conditions with an exact inverse. Jumps and branches whose target
+// is the next statement, past labels only, do nothing and are removed. Blocks
+// left unreachable are removed by dead-code elimination.
+//
+
+namespace {
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// Label a jmp or br transfers to, if its target is a label
+const std::string* jumpTarget(const Instruction& instr) {
+  std::string name = lowercase(instr.getName());
+  const auto& operands = instr.getOperands();
+  if ((name != "jmp" && name != "br") || operands.size() != 1 || operands[0]->getType() != Operand::Type::Label) {
+    return nullptr;
+  }
+  return &static_cast<const LabelOperand&>(*operands[0]).getLabel();
+}
+
+bool isUnconditionalJump(const Instruction& instr) {
+  return instr.getParameters().empty() && jumpTarget(instr) != nullptr;
+}
+
+std::unique_ptr<Instruction> jumpInstruction(const std::string& name, std::vector<std::string> parameters,
+                                             const std::string& target) {
+  auto instr = std::make_unique<Instruction>(name, std::move(parameters));
+  instr->addOperand(Operand::createLabel(target));
+  return instr;
+}
+
+// First instruction of the block a label starts, if the block begins with code
+const Instruction* firstInstruction(const std::vector<Statement>& statements, const ControlFlowGraph& graph,
+                                    const std::string& label) {
+  size_t block = graph.findBlock(label);
+  if (block == ControlFlowGraph::NO_BLOCK) {
+    return nullptr;
+  }
+  const BasicBlock& current = graph.getBlocks()[block];
+  for (size_t i = current.begin; i < current.end; ++i) {
+    if (statements[i].getType() == Statement::Type::Instruction) {
+      return statements[i].getInstruction();
+    }
+    if (statements[i].getType() == Statement::Type::Directive) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+// Final label of a chain of blocks holding only a jmp, or the label itself if the chain loops
+std::string threadedTarget(const std::vector<Statement>& statements, const ControlFlowGraph& graph,
+                           const std::string& label) {
+  std::set<std::string> visited = {label};
+  std::string target = label;
+  while (true) {
+    const Instruction* instr = firstInstruction(statements, graph, target);
+    if (!instr || !isUnconditionalJump(*instr)) {
+      return target;
+    }
+    const std::string& next = *jumpTarget(*instr);
+    if (!visited.insert(next).second) {
+      return label;
+    }
+    target = next;
+  }
+}
+
+// Whether control after the statement reaches the label through labels only
+bool fallsInto(const std::vector<Statement>& statements, size_t index, const std::string& label) {
+  for (size_t i = index + 1; i < statements.size(); ++i) {
+    const Statement& stmt = statements[i];
+    if (stmt.getLabel() == label) {
+      return true;
+    }
+    if (stmt.getType() != Statement::Type::Empty && stmt.getType() != Statement::Type::Label) {
+      return false;
+    }
+  }
+  return false;
+}
+
+// Index of the next statement that is not empty
+size_t nextStatement(const std::vector<Statement>& statements, size_t index) {
+  for (size_t i = index + 1; i < statements.size(); ++i) {
+    if (statements[i].getType() != Statement::Type::Empty) {
+      return i;
+    }
+  }
+  return statements.size();
+}
+
+} // namespace
+
+size_t Optimizer::threadJumps(std::vector<Statement>& statements) {
+  size_t before = m_stats.jumps();
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    ControlFlowGraph graph = ControlFlowGraph::build(statements);
+    std::vector<bool> removed(statements.size(), false);
+
+    for (size_t i = 0; i < statements.size(); ++i) {
+      Statement& stmt = statements[i];
+      const Instruction* instr = stmt.getInstruction();
+      if (!instr || removed[i] || graph.blockOf(i) == ControlFlowGraph::NO_BLOCK || !jumpTarget(*instr)) {
+        continue;
+      }
+
+      // br ^c @next; jmp @other; #next becomes br ^!c @other
+      std::string target = *jumpTarget(*instr);
+      size_t skipped = nextStatement(statements, i);
+      auto inverse = instr->getParameters().size() == 1 && lowercase(instr->getName()) == "br"
+                       ? inverseCondition(instr->getParameters()[0]) : std::nullopt;
+      const Instruction* jmp = skipped < statements.size() ? statements[skipped].getInstruction() : nullptr;
+      if (inverse && jmp && statements[skipped].getLabel().empty() && isUnconditionalJump(*jmp) &&
+          fallsInto(statements, skipped, target)) {
+        target = *jumpTarget(*jmp);
+        stmt = Statement(jumpInstruction(instr->getName(), {*inverse}, target), stmt.getLabel());
+        instr = stmt.getInstruction();
+        removed[skipped] = true;
+        ++m_stats.invertedBranches;
+        changed = true;
+      }
+
+      std::string threaded = threadedTarget(statements, graph, target);
+      if (threaded != target) {
+        target = threaded;
+        stmt = Statement(jumpInstruction(instr->getName(), instr->getParameters(), target), stmt.getLabel());
+        ++m_stats.threadedJumps;
+        changed = true;
+      }
+
+      if (fallsInto(statements, i, target)) {
+        removed[i] = true;
+        ++m_stats.fallThroughJumps;
+        changed = true;
+      }
+    }
+
+    if (!changed) {
+      break;
+    }
+
+    // Labels of removed jumps stay where they were
+    std::vector<Statement> out;
+    out.reserve(statements.size());
+    for (size_t i = 0; i < statements.size(); ++i) {
+      if (!removed[i]) {
+        out.push_back(std::move(statements[i]));
+      } else if (!statements[i].getLabel().empty()) {
+        out.emplace_back(statements[i].getLabel());
+      }
+    }
+    statements = std::move(out);
+  }
+
+  return m_stats.jumps() - before;
+}
+
+} // namespace casm
@@ -0,0 +1,257 @@
+#include <casm/assembler.hpp>
+#include <algorithm>
+#include <cctype>
+
+namespace casm {
+
+//
+// Layout engine
+//
+// The first pass records, per section, a stream of layout items: fixed-size
+// data, alignment padding, instructions and label definitions. Instruction
+// sizes are exact, so label offsets are final once the stream is laid out.
+// Branches to labels in the same section start with the shortest
+// displacement form and are grown until every target is in range.
+//
+
+void Assembler::defineLabel(const std::string& label, AssemblyContext& ctx) {
+    // The offset is assigned once the layout has converged
+    Symbol sym;
+    sym.value = 0;
+    sym.section = ctx.getCurrentSectionId();
+    sym.type = coil::SymbolType::NoType;
+    sym.binding = coil::SymbolBinding::Local;
+    sym.defined = true;
+    
+    SymbolId id = ctx.addSymbol(label, sym);
+    ctx.getCurrentSection().layout.push_back({LayoutItem::Kind::Label, id});
+}
+
+void Assembler::layoutInstruction(const Instruction& instruction, AssemblyContext& ctx) {
+    InstructionLayout layout;
+    layout.section = ctx.getCurrentSectionId();
+    
+    if (isRelaxableBranch(instruction)) {
+        // Optimistically start with the shortest displacement
+        layout.form = BranchForm::Rel8;
+        layout.target = static_cast<const LabelOperand*>(instruction.getOperands()[0].get())->getLabel();
+        layout.baseSize = instructionSize(instruction, BranchForm::None, m_options.compactEncoding) - OPERAND_SIZE;
+        layout.size = layout.baseSize + displacementSize(layout.form);
+    } else {
+        layout.size = instructionSize(instruction, BranchForm::None, m_options.compactEncoding);
+        layout.baseSize = layout.size;
+    }
+    
+    size_t index = ctx.addInstructionLayout(layout);
+    ctx.getCurrentSection().layout.push_back({LayoutItem::Kind::Instruction, index});
+}
+
+void Assembler::assignOffsets(AssemblyContext& ctx) {
+    for (Section& section : ctx.getSections()) {
+        size_t offset = 0;
+        size_t dataSize = 0;
+        
+        for (const LayoutItem& item : section.layout) {
+            switch (item.kind) {
+                case LayoutItem::Kind::Fixed:
+                    offset += item.value;
+                    dataSize += item.value;
+                    break;
+                    
+                case LayoutItem::Kind::Zero:
+                    offset += item.value;
+                    break;
+                    
+                case LayoutItem::Kind::Align:
+                    offset += (item.value - (offset % item.value)) % item.value;
+                    break;
+                    
+                case LayoutItem::Kind::Instruction: {
+                    InstructionLayout& layout = ctx.getInstructionLayout(item.value);
+                    layout.offset = offset;
+                    offset += layout.size;
+                    dataSize += layout.size;
+                    break;
+                }
+                
+                case LayoutItem::Kind::Label:
+                    ctx.getSymbol(static_cast<SymbolId>(item.value)).value = offset;
+                    break;
+            }
+        }
+        
+        section.currentOffset = offset;
+        section.dataSize = dataSize;
+    }
+}
+
+void Assembler::relaxBranches(AssemblyContext& ctx) {
+    auto& layouts = ctx.getInstructionLayouts();
+    
+    // Only branches within a section have a displacement known at assembly time
+    for (InstructionLayout& layout : layouts) {
+        if (layout.form == BranchForm::None) {
+            continue;
+        }
+        
+        layout.targetId = ctx.findSymbol(layout.target);
+        const Symbol* target = layout.targetId != NO_SYMBOL ? &ctx.getSymbol(layout.targetId) : nullptr;
+        if (!target || !target->defined || target->section != layout.section) {
+            layout.form = BranchForm::None;
+            layout.size = layout.baseSize + OPERAND_SIZE;
+        }
+    }
+    
+    // Forms only ever grow, so this reaches a fixed point after at most
+    // two growth steps per branch
+    size_t passes = 0;
+    size_t grown = 0;
+    do {
+        assignOffsets(ctx);
+        ++passes;
+        grown = 0;
+        
+        for (InstructionLayout& layout : layouts) {
+            if (layout.form == BranchForm::None) {
+                continue;
+            }
+            
+            const Symbol& target = ctx.getSymbol(layout.targetId);
+            i64 displacement = static_cast<i64>(target.value) - static_cast<i64>(layout.offset + layout.size);
+            
+            BranchForm needed = formForDisplacement(displacement);
+            if (needed > layout.form) {
+                layout.form = needed;
+                layout.size = layout.baseSize + displacementSize(needed);
+                ++grown;
+            }
+        }
+    } while (grown > 0);
+    
+    log("Branch relaxation converged after " + std::to_string(passes) + " pass(es)");
+}
+
+size_t Assembler::instructionSize(const Instruction& instruction, BranchForm form, bool compact) {
+    std::string name = instruction.getName();
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    
+    // Unknown instructions and bad operand counts are reported, not emitted
+    const auto& operands = instruction.getOperands();
+    if (!lookupOpcode(name) || operands.size() > 3) {
+        return 0;
+    }
+    
+    size_t size = INSTRUCTION_HEADER_SIZE;
+    for (size_t i = 0; i < operands.size(); ++i) {
+        if (i == 0 && form != BranchForm::None) {
+            size += displacementSize(form);
+        } else if (compact) {
+            size += compactOperandSize(*operands[i]);
+        } else {
+            size += OPERAND_SIZE;
+        }
+    }
+    
+    return size;
+}
+
+size_t Assembler::compactOperandSize(const Operand& operand) {
+    // Mirrors convertOperand and encodeCompactInstruction
+    switch (operand.getType()) {
+        case Operand::Type::Register: {
+            const auto& reg = static_cast<const RegisterOperand&>(operand);
+            return unsignedWidth(parseRegisterIndex(reg.getName()).value_or(0));
+        }
+        
+        case Operand::Type::Immediate: {
+            const ImmediateValue& value = static_cast<const ImmediateOperand&>(operand).getValue();
+            switch (value.format) {
+                case ImmediateFormat::Integer:
+                    return signedWidth(std::get<i64>(value.value));
+                case ImmediateFormat::Character:
+                    return signedWidth(std::get<char>(value.value));
+                case ImmediateFormat::Float:
+                    return sizeof(f64);
+                case ImmediateFormat::Expression:
+                    // Evaluated after layout, always 32 bits wide
+                    return OPERAND_SIZE;
+                default:
+                    return 1;
+            }
+        }
+        
+        case Operand::Type::Memory: {
+            // Base and offset share one width
+            const MemoryReference& ref = static_cast<const MemoryOperand&>(operand).getReference();
+            if (ref.offsetExpr) {
+                return 2 * OPERAND_SIZE;
+            }
+            size_t width = std::max(unsignedWidth(parseRegisterIndex(ref.reg).value_or(0)),
+                                    signedWidth(ref.offset));
+            return 2 * width;
+        }
+        
+        default:
+            // Label references are relocation fields of fixed size
+            return OPERAND_SIZE;
+    }
+}
+
+bool Assembler::isSymbolicOperand(const Operand& operand) {
+    switch (operand.getType()) {
+        case Operand::Type::Label:
+            return true;
+        case Operand::Type::Immediate:
+            return static_cast<const ImmediateOperand&>(operand).getValue().format == ImmediateFormat::Expression;
+        case Operand::Type::Memory:
+            return static_cast<const MemoryOperand&>(operand).getReference().offsetExpr != nullptr;
+        default:
+            return false;
+    }
+}
+
+size_t Assembler::signedWidth(i64 value) {
+    if (value >= INT8_MIN && value <= INT8_MAX) return 1;
+    if (value >= INT16_MIN && value <= INT16_MAX) return 2;
+    if (value >= INT32_MIN && value <= INT32_MAX) return 4;
+    return 8;
+}
+
+size_t Assembler::unsignedWidth(u64 value) {
+    if (value <= UINT8_MAX) return 1;
+    if (value <= UINT16_MAX) return 2;
+    if (value <= UINT32_MAX) return 4;
+    return 8;
+}
+
+bool Assembler::isRelaxableBranch(const Instruction& instruction) {
+    std::string name = instruction.getName();
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+    if (name != "jmp" && name != "br" && name != "call") {
+        return false;
+    }
+    
+    const auto& operands = instruction.getOperands();
+    return operands.size() == 1 && operands[0]->getType() == Operand::Type::Label;
+}
+
+size_t Assembler::displacementSize(BranchForm form) {
+    switch (form) {
+        case BranchForm::Rel8:  return 1;
+        case BranchForm::Rel16: return 2;
+        case BranchForm::Rel32: return 4;
+        default:                return OPERAND_SIZE;
+    }
+}
+
+Assembler::BranchForm Assembler::formForDisplacement(i64 displacement) {
+    if (displacement >= INT8_MIN && displacement <= INT8_MAX) {
+        return BranchForm::Rel8;
+    }
+    if (displacement >= INT16_MIN && displacement <= INT16_MAX) {
+        return BranchForm::Rel16;
+    }
+    return BranchForm::Rel32;
+}
+
+} // namespace casm
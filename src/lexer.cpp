@@ -15,15 +15,6 @@ static const std::unordered_set<std::string> KNOWN_INSTRUCTIONS = {
   "cmp", "test"
 };
 
-// Known directive names (without the leading '.')
-static const std::unordered_set<std::string> KNOWN_DIRECTIVES = {
-  "section", "global", "local", 
-  "i8", "i16", "i32", "i64", 
-  "u8", "u16", "u32", "u64", 
-  "f32", "f64", 
-  "ascii", "asciiz", "zero"
-};
-
 // Known parameter names (without the leading '^')
 static const std::unordered_set<std::string> KNOWN_PARAMETERS = {
   "eq", "neq", "gt", "gte", "lt", "lte", 
@@ -260,12 +251,13 @@ Token Lexer::scanDirective() {
   }
   
   // Verify that it's a known directive
-  if (KNOWN_DIRECTIVES.find(name) == KNOWN_DIRECTIVES.end()) {
+  DirectiveKind kind = lookupDirective(name);
+  if (kind == DirectiveKind::Unknown) {
     // If it's not a known directive, treat it as a label reference
     return Token::makeLabelRef(std::string(".") + name, location);
   }
   
-  return Token::makeDirective(name, location);
+  return Token::makeDirective(name, kind, location);
 }
 
 Token Lexer::scanInstruction() {
@@ -303,8 +295,8 @@ Token Lexer::scanRegister() {
     return Token::makeError("Empty register name", location);
   }
   
-  // Validate register format (should start with 'r' followed by a number)
-  if (name[0] != 'r' || name.size() == 1 || !std::isdigit(name[1])) {
+  // Validate register format: 'r' (physical) or 'v' (virtual) followed by a number
+  if ((name[0] != 'r' && name[0] != 'v') || name.size() == 1 || !std::isdigit(name[1])) {
     return Token::makeError("Invalid register format: %" + name, location);
   }
   
@@ -372,7 +364,27 @@ Token Lexer::scanImmediate() {
     
     return Token::makeImmediate(value, location);
   }
-  
+
+  // Expression ($(expr)), collected up to the matching parenthesis
+  if (current() == '(') {
+    int parenDepth = 0;
+    do {
+      if (current() == '(') {
+        parenDepth++;
+      } else if (current() == ')') {
+        parenDepth--;
+      }
+      value += current();
+      advance();
+    } while (!isAtEnd() && parenDepth > 0 && current() != '\n');
+
+    if (parenDepth > 0) {
+      return Token::makeError("Unterminated expression", location);
+    }
+
+    return Token::makeImmediate(value, location);
+  }
+
   // Integer/Float format specifier (id, ix, etc.)
   if ((current() == 'i' || current() == 'f') && 
       (peek(1) == 'd' || peek(1) == 'x' || peek(1) == 'b' || peek(1) == 'o')) {
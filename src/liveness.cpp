@@ -0,0 +1,145 @@
+#include <casm/liveness.hpp>
+#include <casm/effects.hpp>
+#include <algorithm>
+#include <cctype>
+
+namespace casm {
+
+//
+// Register liveness
+//
+// Live sets flow backward: a block's live-out set is the union of the
+// live-in sets of its successors, and each instruction, from last to first,
+// removes the registers it writes and adds those it reads. Blocks are swept
+// in reverse until no live-in set changes, then once more to record the set
+// after every instruction. The sets only grow between sweeps, so the loop
+// ends.
+//
+
+namespace {
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// Physical registers named by the instructions of a function, as operands or address bases
+RegisterSet functionRegisters(const std::vector<Statement>& statements, const ControlFlowGraph& graph,
+                              const Function& function) {
+  RegisterSet registers;
+  for (size_t b : function.blocks) {
+    const BasicBlock& block = graph.getBlocks()[b];
+    for (size_t i = block.begin; i < block.end; ++i) {
+      const Instruction* instr = statements[i].getInstruction();
+      if (!instr) {
+        continue;
+      }
+      for (const auto& operand : instr->getOperands()) {
+        std::optional<std::string> reg = registerOf(*operand);
+        if (operand->getType() == Operand::Type::Memory) {
+          reg = lowercase(static_cast<const MemoryOperand&>(*operand).getReference().reg);
+        }
+        if (reg && !isVirtualRegister(*reg)) {
+          registers.insert(*reg);
+        }
+      }
+    }
+  }
+  return registers;
+}
+
+// Turn the registers live after an instruction into those live before it
+void transfer(const Instruction& instr, const RegisterSet& all, RegisterSet& live) {
+  InstructionEffects effects = effectsOf(instr);
+  const auto& operands = instr.getOperands();
+  std::string name = lowercase(instr.getName());
+
+  if (!effects.conditional) {
+    for (size_t index : effects.writes) {
+      live.erase(*registerOf(*operands[index]));
+    }
+    if (effects.setsFlags) {
+      live.erase(Liveness::FLAGS);
+    }
+  }
+
+  // The caller or callee may read any register and the flags
+  if (name == "ret" || effects.clobbers) {
+    live.insert(all.begin(), all.end());
+    live.insert(Liveness::FLAGS);
+  }
+
+  for (size_t index : effects.reads) {
+    live.insert(*registerOf(*operands[index]));
+  }
+  live.insert(effects.addressReads.begin(), effects.addressReads.end());
+  if (effects.conditional) {
+    live.insert(Liveness::FLAGS);
+  }
+}
+
+} // namespace
+
+Liveness Liveness::analyze(const std::vector<Statement>& statements, const ControlFlowGraph& graph) {
+  Liveness liveness;
+  const auto& blocks = graph.getBlocks();
+  liveness.m_after.resize(statements.size());
+  liveness.m_blockIn.resize(blocks.size());
+  liveness.m_blockOut.resize(blocks.size());
+
+  for (const Function& function : graph.getFunctions()) {
+    RegisterSet all = functionRegisters(statements, graph, function);
+
+    // Live-out of a block from its successors and the way it leaves the function
+    auto blockOut = [&](size_t b) {
+      const BasicBlock& block = blocks[b];
+      RegisterSet out;
+      for (size_t successor : block.successors) {
+        const RegisterSet& in = liveness.m_blockIn[successor];
+        out.insert(in.begin(), in.end());
+      }
+      if (!block.exits.empty() || block.indirect || block.fallsOut) {
+        out.insert(all.begin(), all.end());
+        out.insert(FLAGS);
+      }
+      return out;
+    };
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto it = function.blocks.rbegin(); it != function.blocks.rend(); ++it) {
+        RegisterSet live = blockOut(*it);
+        for (size_t i = blocks[*it].end; i-- > blocks[*it].begin;) {
+          if (const Instruction* instr = statements[i].getInstruction()) {
+            transfer(*instr, all, live);
+          }
+        }
+        if (live != liveness.m_blockIn[*it]) {
+          liveness.m_blockIn[*it] = std::move(live);
+          changed = true;
+        }
+      }
+    }
+
+    for (size_t b : function.blocks) {
+      RegisterSet live = blockOut(b);
+      liveness.m_blockOut[b] = live;
+      for (size_t i = blocks[b].end; i-- > blocks[b].begin;) {
+        liveness.m_after[i] = live;
+        if (const Instruction* instr = statements[i].getInstruction()) {
+          transfer(*instr, all, live);
+        }
+      }
+    }
+  }
+
+  return liveness;
+}
+
+const RegisterSet& Liveness::liveAfter(size_t statement) const {
+  static const RegisterSet NONE;
+  return statement < m_after.size() ? m_after[statement] : NONE;
+}
+
+} // namespace casm
@@ -21,10 +21,16 @@ void printHelp(const char* programName) {
   std::cout << "Options:" << std::endl;
   std::cout << "  -h, --help     Show this help message" << std::endl;
   std::cout << "  -v, --verbose  Enable verbose output" << std::endl;
+  std::cout << "  -O, --optimize Enable optimization passes" << std::endl;
+  std::cout << "  --profile FILE Lay out blocks by the counts in FILE (implies -O)" << std::endl;
+  std::cout << "  --order-functions" << std::endl;
+  std::cout << "                 Place functions next to their callers, weighted by --profile" << std::endl;
   std::cout << std::endl;
   std::cout << "Examples:" << std::endl;
   std::cout << "  " << programName << " example.casm example.coil" << std::endl;
   std::cout << "  " << programName << " -v factorial.casm factorial.coil" << std::endl;
+  std::cout << "  " << programName << " --profile factorial.prof factorial.casm factorial.coil" << std::endl;
+  std::cout << "  " << programName << " --order-functions --profile app.prof app.casm app.coil" << std::endl;
 }
 
 // Read the entire file into a string
@@ -51,6 +57,9 @@ int main(int argc, char* argv[]) {
   std::string inputFile;
   std::string outputFile;
   bool verbose = false;
+  bool optimize = false;
+  bool orderFunctions = false;
+  std::string profileFile;
   
   // Process arguments
   for (int i = 1; i < argc; ++i) {
@@ -59,6 +68,17 @@ int main(int argc, char* argv[]) {
       return 0;
     } else if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--verbose") == 0) {
       verbose = true;
+    } else if (strcmp(argv[i], "-O") == 0 || strcmp(argv[i], "--optimize") == 0) {
+      optimize = true;
+    } else if (strcmp(argv[i], "--order-functions") == 0) {
+      orderFunctions = true;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      if (i + 1 >= argc) {
+        std::cerr << "Error: --profile requires a file" << std::endl;
+        return 1;
+      }
+      profileFile = argv[++i];
+      optimize = true;
     } else if (inputFile.empty()) {
       inputFile = argv[i];
     } else if (outputFile.empty()) {
@@ -93,11 +113,17 @@ int main(int argc, char* argv[]) {
     }
     
     // Create assembler
-    casm::Assembler assembler;
-    assembler.setVerbose(verbose);
+    casm::Assembler::Options options;
+    options.verbose = verbose;
+    options.optimize = optimize;
+    options.orderFunctions = orderFunctions;
+    if (!profileFile.empty()) {
+      options.profile = casm::Profile::load(profileFile);
+    }
+    casm::Assembler assembler(options);
     
     // Assemble the source
-    coil::Object obj = assembler.assembleSource(source, inputFile);
+    coil::Object obj = assembler.assembleSource(source, inputFile).object;
     
     if (verbose) {
       std::cout << "Writing output file: " << outputFile << std::endl;
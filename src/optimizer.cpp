@@ -0,0 +1,20 @@
+#include <casm/optimizer.hpp>
+
+namespace casm {
+
+const OptimizationStats& Optimizer::run(std::vector<Statement>& statements) {
+  inlineCalls(statements);
+  eliminateDeadCode(statements);
+  numberValues(statements);
+  eliminateDeadStores(statements);
+  convertTailCalls(statements);
+  if (m_profile) {
+    reorderBlocks(statements, *m_profile);
+  }
+  threadJumps(statements);
+  eliminateDeadCode(statements);
+  peephole(statements);
+  return m_stats;
+}
+
+} // namespace casm
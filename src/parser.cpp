@@ -26,7 +26,7 @@ RegisterOperand::RegisterOperand(std::string name)
 }
 
 std::string RegisterOperand::toString() const {
-  return "%r" + m_name;
+  return "%" + m_name;
 }
 
 // ImmediateOperand implementation
@@ -47,7 +47,7 @@ MemoryOperand::MemoryOperand(MemoryReference memRef)
 
 std::string MemoryOperand::toString() const {
   std::ostringstream ss;
-  ss << "[%r" << m_memRef.reg;
+  ss << "[%" << m_memRef.reg;
   if (m_memRef.offset > 0) {
     ss << "+" << m_memRef.offset;
   } else if (m_memRef.offset < 0) {
@@ -94,12 +94,16 @@ std::string Instruction::toString() const {
 
 // Directive implementation
 Directive::Directive(std::string name, std::vector<std::unique_ptr<Operand>> operands)
-  : m_name(std::move(name)) {
+  : m_name(std::move(name)), m_kind(lookupDirective(m_name)) {
   for (auto& op : operands) {
     m_operands.push_back(std::move(op));
   }
 }
 
+Directive::Directive(std::string name, DirectiveKind kind)
+  : m_name(std::move(name)), m_kind(kind) {
+}
+
 void Directive::addOperand(std::unique_ptr<Operand> operand) {
   m_operands.push_back(std::move(operand));
 }
@@ -307,7 +311,7 @@ std::unique_ptr<Directive> Parser::parseDirective() {
   Token token = consume(TokenType::Directive, "Expected directive");
   
   // Create directive
-  auto directive = std::make_unique<Directive>(token.value);
+  auto directive = std::make_unique<Directive>(token.value, token.directiveKind);
   
   // Parse operands
   while (peek().type != TokenType::EndOfLine && peek().type != TokenType::EndOfFile) {
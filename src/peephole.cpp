@@ -0,0 +1,276 @@
+#include <casm/optimizer.hpp>
+#include <casm/effects.hpp>
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <string>
+
+namespace casm {
+
+//
+// Peephole pass
+//
+// A single forward sweep rewrites instructions in isolation (self moves,
+// arithmetic with zero, multiplication by a power of two, comparison with
+// zero) and folds inc/dec pairs on the same register. Pairs are only folded
+// within a straight run of instructions: a label, a directive or a labelled
+// instruction starts a new run, since control may enter between the two.
+// Removing add/sub of zero, turning mul into shl and folding a pair all
+// change the flags, so they are only done when nothing reads the flags
+// before they are set again.
+//
+
+namespace {
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// Lowercase register name of an operand, if it is a register
+std::optional<std::string> registerName(const Operand& operand) {
+  if (operand.getType() != Operand::Type::Register) {
+    return std::nullopt;
+  }
+  return lowercase(static_cast<const RegisterOperand&>(operand).getName());
+}
+
+// Value of an integer immediate operand
+std::optional<i64> integerValue(const Operand& operand) {
+  if (operand.getType() != Operand::Type::Immediate) {
+    return std::nullopt;
+  }
+  const ImmediateValue& value = static_cast<const ImmediateOperand&>(operand).getValue();
+  if (value.format != ImmediateFormat::Integer) {
+    return std::nullopt;
+  }
+  return std::get<i64>(value.value);
+}
+
+bool isZero(const Operand& operand) {
+  return integerValue(operand) == 0;
+}
+
+std::unique_ptr<Operand> cloneRegister(const Operand& operand) {
+  return Operand::createRegister(static_cast<const RegisterOperand&>(operand).getName());
+}
+
+// Instruction built from a name and register operands copied from another
+std::unique_ptr<Instruction> registerInstruction(const std::string& name,
+                                                 std::initializer_list<const Operand*> operands) {
+  auto instr = std::make_unique<Instruction>(name);
+  for (const Operand* operand : operands) {
+    instr->addOperand(cloneRegister(*operand));
+  }
+  return instr;
+}
+
+enum class Action { Keep, Remove, Replace };
+
+struct Rewrite {
+  Action action = Action::Keep;
+  std::unique_ptr<Instruction> replacement;
+};
+
+Rewrite removal() {
+  return {Action::Remove, nullptr};
+}
+
+Rewrite replacement(std::unique_ptr<Instruction> instr) {
+  return {Action::Replace, std::move(instr)};
+}
+
+// Rewrite of a single instruction, counted in the stats when applied
+Rewrite rewriteInstruction(const Instruction& instr, bool flagsObserved, OptimizationStats& stats) {
+  // Parameters make an instruction conditional; leave those alone
+  if (!instr.getParameters().empty()) {
+    return {};
+  }
+
+  std::string name = lowercase(instr.getName());
+  const auto& operands = instr.getOperands();
+  if (operands.empty()) {
+    return {};
+  }
+
+  auto dest = registerName(*operands[0]);
+  if (!dest) {
+    return {};
+  }
+
+  if (name == "mov" && operands.size() == 2) {
+    // mov %rX, %rX
+    if (dest == registerName(*operands[1])) {
+      ++stats.selfMoves;
+      return removal();
+    }
+  }
+  else if ((name == "add" || name == "sub") && isZero(*operands.back()) && !flagsObserved) {
+    // add %rX, $id0 and add %rX, %rX, $id0 do nothing
+    if (operands.size() == 2) {
+      ++stats.zeroArithmetic;
+      return removal();
+    }
+
+    // add %rX, %rY, $id0 is a move
+    if (operands.size() == 3) {
+      auto src = registerName(*operands[1]);
+      if (src == dest) {
+        ++stats.zeroArithmetic;
+        return removal();
+      }
+      if (src) {
+        ++stats.zeroArithmetic;
+        return replacement(registerInstruction("mov", {operands[0].get(), operands[1].get()}));
+      }
+    }
+  }
+  else if (name == "mul" && (operands.size() == 2 || operands.size() == 3) && !flagsObserved) {
+    // mul by 2^k becomes shl by k
+    auto factor = integerValue(*operands.back());
+    bool registerSources = operands.size() == 2 || registerName(*operands[1]);
+    if (factor && *factor > 1 && (*factor & (*factor - 1)) == 0 && registerSources) {
+      i64 shift = 0;
+      while ((i64{1} << shift) != *factor) {
+        ++shift;
+      }
+
+      auto shl = std::make_unique<Instruction>("shl");
+      for (size_t i = 0; i + 1 < operands.size(); ++i) {
+        shl->addOperand(cloneRegister(*operands[i]));
+      }
+      shl->addOperand(Operand::createImmediate(ImmediateValue::createInteger(shift)));
+
+      ++stats.strengthReductions;
+      return replacement(std::move(shl));
+    }
+  }
+  else if (name == "cmp" && operands.size() == 2 && isZero(*operands[1])) {
+    // cmp %rX, $id0 sets the same flags as test %rX, %rX
+    ++stats.zeroCompares;
+    return replacement(registerInstruction("test", {operands[0].get(), operands[0].get()}));
+  }
+
+  return {};
+}
+
+// Register of an unconditional single-register inc (+1) or dec (-1)
+std::optional<std::pair<std::string, int>> stepOf(const Instruction& instr) {
+  const auto& operands = instr.getOperands();
+  if (!instr.getParameters().empty() || operands.size() != 1) {
+    return std::nullopt;
+  }
+
+  auto reg = registerName(*operands[0]);
+  std::string name = lowercase(instr.getName());
+  if (!reg || (name != "inc" && name != "dec")) {
+    return std::nullopt;
+  }
+  return std::make_pair(*reg, name == "inc" ? 1 : -1);
+}
+
+} // namespace
+
+size_t Optimizer::peephole(std::vector<Statement>& statements) {
+  size_t before = m_stats.peephole();
+
+  std::vector<Statement> out;
+  out.reserve(statements.size());
+
+  // Output indices of the unfolded inc/dec instructions in the current run
+  std::vector<size_t> steps;
+
+  // Label of a removed instruction, waiting for the next statement
+  std::string pendingLabel;
+
+  auto flushLabel = [&out, &pendingLabel]() {
+    if (!pendingLabel.empty()) {
+      out.emplace_back(std::move(pendingLabel));
+      pendingLabel.clear();
+    }
+  };
+
+  auto removeAt = [&out](size_t index) {
+    // A label on a removed instruction stays where the instruction was
+    const std::string& label = out[index].getLabel();
+    out[index] = label.empty() ? Statement() : Statement(label);
+  };
+
+  for (size_t i = 0; i < statements.size(); ++i) {
+    Statement& stmt = statements[i];
+    if (stmt.getType() == Statement::Type::Empty) {
+      continue;
+    }
+
+    Instruction* instr = stmt.getInstruction();
+    if (!instr) {
+      // Labels and directives end the run
+      flushLabel();
+      steps.clear();
+      out.push_back(std::move(stmt));
+      continue;
+    }
+
+    bool observed = flagsObserved(statements, i, statements.size());
+    Rewrite rewrite = rewriteInstruction(*instr, observed, m_stats);
+    if (rewrite.action == Action::Remove) {
+      if (!stmt.getLabel().empty()) {
+        flushLabel();
+        pendingLabel = stmt.getLabel();
+        steps.clear();
+      }
+      continue;
+    }
+
+    // Carry a pending label over to this instruction if it has none
+    std::string label = stmt.getLabel();
+    if (!pendingLabel.empty() && label.empty()) {
+      label = std::move(pendingLabel);
+      pendingLabel.clear();
+    }
+    flushLabel();
+
+    if (!label.empty()) {
+      steps.clear();
+    }
+
+    if (rewrite.action == Action::Replace) {
+      out.emplace_back(std::move(rewrite.replacement), label);
+    } else if (label != stmt.getLabel()) {
+      out.emplace_back(std::make_unique<Instruction>(*instr), label);
+    } else {
+      out.push_back(std::move(stmt));
+    }
+
+    // Fold with the previous step when it moves the same register the other way
+    auto step = stepOf(*out.back().getInstruction());
+    if (step && !steps.empty() && !observed) {
+      auto previous = stepOf(*out[steps.back()].getInstruction());
+      if (previous->first == step->first && previous->second == -step->second) {
+        // The labelled end of the pair cannot be the second one, so only the first keeps a label
+        removeAt(steps.back());
+        steps.pop_back();
+        out.pop_back();
+        ++m_stats.incDecPairs;
+        continue;
+      }
+    }
+
+    if (step) {
+      steps.push_back(out.size() - 1);
+    } else {
+      steps.clear();
+    }
+  }
+  flushLabel();
+
+  // Drop the placeholders left by folded pairs
+  out.erase(std::remove_if(out.begin(), out.end(), [](const Statement& stmt) {
+    return stmt.getType() == Statement::Type::Empty;
+  }), out.end());
+
+  statements = std::move(out);
+  return m_stats.peephole() - before;
+}
+
+} // namespace casm
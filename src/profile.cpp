@@ -0,0 +1,78 @@
+#include <casm/profile.hpp>
+#include <charconv>
+#include <fstream>
+#include <sstream>
+
+namespace casm {
+
+namespace {
+
+// Label without its leading @ or #
+std::string labelName(const std::string& word) {
+  return !word.empty() && (word[0] == '@' || word[0] == '#') ? word.substr(1) : word;
+}
+
+} // namespace
+
+Profile Profile::parse(std::istream& input, const std::string& filename) {
+  Profile profile;
+  std::string line;
+  size_t lineNumber = 0;
+
+  while (std::getline(input, line)) {
+    ++lineNumber;
+    auto error = [&](const std::string& message) {
+      return ProfileException(filename + ":" + std::to_string(lineNumber) + ": " + message);
+    };
+
+    std::istringstream words(line.substr(0, line.find(';')));
+    std::string function;
+    std::string block;
+    std::string count;
+    std::string extra;
+    if (!(words >> function)) {
+      continue;
+    }
+    if (!(words >> block >> count) || (words >> extra)) {
+      throw error("Expected a function label, a block label and a count");
+    }
+
+    function = labelName(function);
+    block = labelName(block);
+    if (function.empty() || block.empty()) {
+      throw error("Empty label");
+    }
+
+    u64 value = 0;
+    auto [end, status] = std::from_chars(count.data(), count.data() + count.size(), value);
+    if (status != std::errc() || end != count.data() + count.size()) {
+      throw error("Invalid count: " + count);
+    }
+    profile.addCount(function, block, value);
+  }
+
+  return profile;
+}
+
+Profile Profile::load(const std::string& path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw ProfileException("Could not open file: " + path);
+  }
+  return parse(file, path);
+}
+
+void Profile::addCount(const std::string& function, const std::string& block, u64 count) {
+  m_counts[function][block] += count;
+}
+
+u64 Profile::count(std::string_view function, std::string_view block) const {
+  auto blocks = m_counts.find(function);
+  if (blocks == m_counts.end()) {
+    return 0;
+  }
+  auto it = blocks->second.find(block);
+  return it != blocks->second.end() ? it->second : 0;
+}
+
+} // namespace casm
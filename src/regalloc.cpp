@@ -0,0 +1,644 @@
+#include <casm/regalloc.hpp>
+#include <casm/cfg.hpp>
+#include <casm/effects.hpp>
+#include <casm/liveness.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <optional>
+#include <set>
+
+namespace casm {
+
+//
+// Linear-scan register allocation
+//
+// Positions number the reads and writes of a function: instruction i reads
+// its operands at 2i and writes its results at 2i + 1, so an interval ending
+// in a read at i can hand its register to one starting in a write at i. A
+// virtual register's interval is the hull of every position where it is
+// read, written or live, taken from Liveness, which also extends it around
+// loops. Allocation repeats with more scratch registers held back until the
+// pool left over is enough for the spill code it causes.
+//
+// Slots live in .bss rather than on the stack, which the instruction set can
+// only reach through push and pop; a call that may come back into the
+// function pushes them instead, so each activation keeps its own values.
+// The call graph says which calls may lead back into the function, and the
+// registers written by every function a call may reach, directly or through
+// tail jumps and fall-through, are those the call may clobber.
+//
+
+namespace {
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+struct Interval {
+  std::string reg;              // Virtual register
+  size_t start = SIZE_MAX;      // First position
+  size_t end = 0;               // Last position
+
+  void cover(size_t position) {
+    start = std::min(start, position);
+    end = std::max(end, position);
+  }
+};
+
+struct Placement {
+  std::map<std::string, std::string> registers;  // Virtual to physical register
+  std::map<std::string, size_t> slots;           // Virtual register to spill slot
+  size_t slotCount = 0;
+};
+
+// Register a register operand names, or the base register of a memory operand
+std::optional<std::string> namedRegister(const Operand& operand) {
+  if (operand.getType() == Operand::Type::Memory) {
+    return lowercase(static_cast<const MemoryOperand&>(operand).getReference().reg);
+  }
+  return registerOf(operand);
+}
+
+// Virtual registers an instruction names, once each, in operand order
+std::vector<std::string> virtualRegisters(const Instruction& instr) {
+  std::vector<std::string> registers;
+  for (const auto& operand : instr.getOperands()) {
+    auto reg = namedRegister(*operand);
+    if (reg && isVirtualRegister(*reg) && std::find(registers.begin(), registers.end(), *reg) == registers.end()) {
+      registers.push_back(*reg);
+    }
+  }
+  return registers;
+}
+
+bool contains(const std::vector<size_t>& indices, size_t index) {
+  return std::find(indices.begin(), indices.end(), index) != indices.end();
+}
+
+// Assign registers from the pool to intervals sorted by start, spilling where none is free
+Placement linearScan(const std::vector<Interval>& intervals, const std::vector<std::string>& pool) {
+  Placement placement;
+  std::map<std::string, size_t> held;                // Pool index of each interval given a register
+  std::vector<const Interval*> active;               // Intervals holding a register now
+  std::vector<std::pair<size_t, size_t>> spilled;    // End and slot of each spilled interval
+  std::set<size_t> freeRegisters;
+  std::set<size_t> freeSlots;
+  for (size_t i = 0; i < pool.size(); ++i) {
+    freeRegisters.insert(i);
+  }
+
+  // A slot freed earlier may only be reused by an interval starting after it was freed
+  auto spill = [&](const Interval& interval, bool started) {
+    size_t slot = placement.slotCount;
+    if (!started && !freeSlots.empty()) {
+      slot = *freeSlots.begin();
+      freeSlots.erase(freeSlots.begin());
+    } else {
+      ++placement.slotCount;
+    }
+    placement.slots[interval.reg] = slot;
+    spilled.emplace_back(interval.end, slot);
+  };
+
+  for (const Interval& interval : intervals) {
+    for (auto it = active.begin(); it != active.end();) {
+      if ((*it)->end < interval.start) {
+        freeRegisters.insert(held[(*it)->reg]);
+        it = active.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    for (auto it = spilled.begin(); it != spilled.end();) {
+      if (it->first < interval.start) {
+        freeSlots.insert(it->second);
+        it = spilled.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    if (!freeRegisters.empty()) {
+      held[interval.reg] = *freeRegisters.begin();
+      freeRegisters.erase(freeRegisters.begin());
+      active.push_back(&interval);
+      continue;
+    }
+
+    // No register is free: spill whichever interval ends last
+    auto last = std::max_element(active.begin(), active.end(),
+                                 [](const Interval* a, const Interval* b) { return a->end < b->end; });
+    if (last != active.end() && (*last)->end > interval.end) {
+      held[interval.reg] = held[(*last)->reg];
+      held.erase((*last)->reg);
+      spill(**last, true);
+      *last = &interval;
+    } else {
+      spill(interval, false);
+    }
+  }
+
+  for (const auto& [reg, index] : held) {
+    placement.registers[reg] = pool[index];
+  }
+  return placement;
+}
+
+// Copy of an operand with its register, or memory base register, renamed
+std::unique_ptr<Operand> renameOperand(const Operand& operand, const std::map<std::string, std::string>& names) {
+  auto rename = [&names](const std::string& reg) {
+    auto it = names.find(lowercase(reg));
+    return it != names.end() ? it->second : reg;
+  };
+
+  switch (operand.getType()) {
+    case Operand::Type::Register:
+      return Operand::createRegister(rename(static_cast<const RegisterOperand&>(operand).getName()));
+    case Operand::Type::Immediate:
+      return Operand::createImmediate(static_cast<const ImmediateOperand&>(operand).getValue());
+    case Operand::Type::Memory: {
+      MemoryReference ref = static_cast<const MemoryOperand&>(operand).getReference();
+      ref.reg = rename(ref.reg);
+      return Operand::createMemory(ref);
+    }
+    case Operand::Type::Label:
+      return Operand::createLabel(static_cast<const LabelOperand&>(operand).getLabel());
+  }
+  return nullptr;
+}
+
+std::unique_ptr<Instruction> spillInstruction(const char* name, const std::string& reg, const std::string& slot) {
+  auto instr = std::make_unique<Instruction>(name);
+  if (std::string(name) == "load") {
+    instr->addOperand(Operand::createRegister(reg));
+    instr->addOperand(Operand::createLabel(slot));
+  } else {
+    instr->addOperand(Operand::createLabel(slot));
+    instr->addOperand(Operand::createRegister(reg));
+  }
+  return instr;
+}
+
+std::unique_ptr<Instruction> stackInstruction(const char* name, const std::string& reg) {
+  auto instr = std::make_unique<Instruction>(name);
+  instr->addOperand(Operand::createRegister(reg));
+  return instr;
+}
+
+// Label named by an instruction's only operand, if it is a label reference
+const std::string* targetLabel(const Instruction& instr) {
+  const auto& operands = instr.getOperands();
+  if (operands.size() != 1 || operands[0]->getType() != Operand::Type::Label) {
+    return nullptr;
+  }
+  return &static_cast<const LabelOperand&>(*operands[0]).getLabel();
+}
+
+// Function holding a label, or NO_FUNCTION for labels outside the program's code
+size_t functionAt(const ControlFlowGraph& graph, const std::string& label) {
+  size_t function = graph.findFunction(label);
+  if (function == ControlFlowGraph::NO_FUNCTION) {
+    size_t block = graph.findBlock(label);
+    if (block != ControlFlowGraph::NO_BLOCK) {
+      function = graph.getBlocks()[block].function;
+    }
+  }
+  return function;
+}
+
+// Function a call or unknown instruction enters, or NO_FUNCTION if it may enter any
+size_t calleeOf(const ControlFlowGraph& graph, const Instruction& instr) {
+  const std::string* label = targetLabel(instr);
+  if (!label || lowercase(instr.getName()) != "call") {
+    return ControlFlowGraph::NO_FUNCTION;
+  }
+  return functionAt(graph, *label);
+}
+
+// Functions each function may transfer control to, itself included, and whether it may reach unknown code
+struct CallGraph {
+  std::vector<std::set<size_t>> reaches;
+  std::vector<bool> unknown;
+};
+
+CallGraph callGraphOf(const std::vector<Statement>& statements, const ControlFlowGraph& graph) {
+  const auto& functions = graph.getFunctions();
+  const auto& blocks = graph.getBlocks();
+  std::vector<std::set<size_t>> edges(functions.size());
+  CallGraph calls{std::vector<std::set<size_t>>(functions.size()), std::vector<bool>(functions.size(), false)};
+
+  for (size_t f = 0; f < functions.size(); ++f) {
+    auto enter = [&](size_t target) {
+      if (target == ControlFlowGraph::NO_FUNCTION) {
+        calls.unknown[f] = true;
+      } else {
+        edges[f].insert(target);
+      }
+    };
+
+    for (size_t b : functions[f].blocks) {
+      const BasicBlock& block = blocks[b];
+      for (size_t i = block.begin; i < block.end; ++i) {
+        const Instruction* instr = statements[i].getInstruction();
+        if (instr && effectsOf(*instr).clobbers) {
+          enter(calleeOf(graph, *instr));
+        }
+      }
+      for (const std::string& exit : block.exits) {
+        enter(functionAt(graph, exit));
+      }
+      if (block.indirect) {
+        calls.unknown[f] = true;
+      }
+      if (block.fallsOut && f + 1 < functions.size() && functions[f + 1].section == functions[f].section) {
+        edges[f].insert(f + 1);
+      }
+    }
+  }
+
+  for (size_t f = 0; f < functions.size(); ++f) {
+    std::vector<size_t> worklist{f};
+    calls.reaches[f].insert(f);
+    while (!worklist.empty()) {
+      size_t current = worklist.back();
+      worklist.pop_back();
+      for (size_t next : edges[current]) {
+        if (calls.reaches[f].insert(next).second) {
+          worklist.push_back(next);
+        }
+      }
+    }
+  }
+  for (size_t f = 0; f < functions.size(); ++f) {
+    for (size_t reached : calls.reaches[f]) {
+      calls.unknown[f] = calls.unknown[f] || calls.unknown[reached];
+    }
+  }
+  return calls;
+}
+
+// Whether control may come back into a function before an instruction completes
+bool reenters(const CallGraph& calls, size_t callee, size_t function) {
+  return callee == ControlFlowGraph::NO_FUNCTION || calls.unknown[callee] || calls.reaches[callee].count(function);
+}
+
+// Labels defined or referenced anywhere in the statements
+std::set<std::string> labelNames(const std::vector<Statement>& statements) {
+  std::set<std::string> names;
+  for (const Statement& stmt : statements) {
+    if (!stmt.getLabel().empty()) {
+      names.insert(stmt.getLabel());
+    }
+    const std::vector<std::unique_ptr<Operand>>* operands = nullptr;
+    if (const Instruction* instr = stmt.getInstruction()) {
+      operands = &instr->getOperands();
+    } else if (const Directive* directive = stmt.getDirective()) {
+      operands = &directive->getOperands();
+    }
+    for (size_t i = 0; operands && i < operands->size(); ++i) {
+      if ((*operands)[i]->getType() == Operand::Type::Label) {
+        names.insert(static_cast<const LabelOperand&>(*(*operands)[i]).getLabel());
+      }
+    }
+  }
+  return names;
+}
+
+} // namespace
+
+bool RegisterAllocator::usesVirtualRegisters(const std::vector<Statement>& statements) {
+  return std::any_of(statements.begin(), statements.end(), [](const Statement& stmt) {
+    return stmt.getInstruction() && !virtualRegisters(*stmt.getInstruction()).empty();
+  });
+}
+
+void RegisterAllocator::allocate(std::vector<Statement>& statements) {
+  m_allocations.clear();
+
+  ControlFlowGraph graph = ControlFlowGraph::build(statements);
+  Liveness liveness = Liveness::analyze(statements, graph);
+  CallGraph calls = callGraphOf(statements, graph);
+  const auto& functions = graph.getFunctions();
+  const auto& blocks = graph.getBlocks();
+
+  // Placement and scratch registers of each function using virtual registers
+  struct Plan {
+    Placement placement;
+    std::vector<std::string> scratch;
+    size_t allocation = 0;
+  };
+  std::vector<Plan> plans(functions.size());
+  std::vector<bool> planned(plans.size(), false);
+
+  // Virtual registers live after an instruction that it does not write itself
+  auto liveAcross = [&liveness](const Instruction& instr, size_t index) {
+    InstructionEffects effects = effectsOf(instr);
+    std::vector<std::string> live;
+    for (const std::string& reg : liveness.liveAfter(index)) {
+      bool written = std::any_of(effects.writes.begin(), effects.writes.end(), [&](size_t operand) {
+        return registerOf(*instr.getOperands()[operand]) == reg;
+      });
+      if (isVirtualRegister(reg) && !written) {
+        live.push_back(reg);
+      }
+    }
+    return live;
+  };
+
+  for (size_t f = 0; f < functions.size(); ++f) {
+    const Function& function = functions[f];
+    std::map<std::string, Interval> intervals;
+    std::set<std::string> named;
+
+    for (size_t b : function.blocks) {
+      for (const std::string& reg : liveness.liveIn(b)) {
+        if (isVirtualRegister(reg)) {
+          intervals[reg].cover(2 * blocks[b].begin);
+        }
+      }
+
+      for (size_t i = blocks[b].begin; i < blocks[b].end; ++i) {
+        const Instruction* instr = statements[i].getInstruction();
+        if (!instr) {
+          continue;
+        }
+
+        InstructionEffects effects = effectsOf(*instr);
+        const auto& operands = instr->getOperands();
+        for (size_t index = 0; index < operands.size(); ++index) {
+          auto reg = namedRegister(*operands[index]);
+          if (!reg) {
+            continue;
+          }
+          if (!isVirtualRegister(*reg)) {
+            named.insert(*reg);
+            continue;
+          }
+          bool written = operands[index]->getType() == Operand::Type::Register && contains(effects.writes, index);
+          intervals[*reg].cover(written ? 2 * i + 1 : 2 * i);
+          if (contains(effects.reads, index)) {
+            intervals[*reg].cover(2 * i);
+          }
+        }
+
+        for (const std::string& reg : liveness.liveAfter(i)) {
+          if (isVirtualRegister(reg)) {
+            intervals[reg].cover(2 * i + 1);
+            intervals[reg].cover(2 * i + 2);
+          }
+        }
+      }
+    }
+
+    if (intervals.empty()) {
+      continue;
+    }
+
+    std::vector<Interval> sorted;
+    for (auto& [reg, interval] : intervals) {
+      interval.reg = reg;
+      sorted.push_back(interval);
+    }
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const Interval& a, const Interval& b) { return a.start < b.start; });
+
+    std::vector<std::string> pool;
+    for (u32 n = 0; n < m_registerCount; ++n) {
+      std::string reg = "r" + std::to_string(n);
+      if (named.count(reg) == 0) {
+        pool.push_back(reg);
+      }
+    }
+
+    // Hold back as many scratch registers as the spilled registers of one instruction,
+    // and one to copy slots to the stack around calls that may come back here
+    Plan& plan = plans[f];
+    size_t scratchCount = 0;
+    while (true) {
+      std::vector<std::string> available(pool.begin(), pool.end() - scratchCount);
+      plan.placement = linearScan(sorted, available);
+      auto spilled = [&plan](const std::string& reg) { return plan.placement.slots.count(reg) != 0; };
+
+      size_t needed = 0;
+      for (size_t b : function.blocks) {
+        for (size_t i = blocks[b].begin; i < blocks[b].end; ++i) {
+          const Instruction* instr = statements[i].getInstruction();
+          if (!instr) {
+            continue;
+          }
+          auto regs = virtualRegisters(*instr);
+          needed = std::max<size_t>(needed, std::count_if(regs.begin(), regs.end(), spilled));
+          if (effectsOf(*instr).clobbers && reenters(calls, calleeOf(graph, *instr), f)) {
+            auto live = liveAcross(*instr, i);
+            if (std::any_of(live.begin(), live.end(), spilled)) {
+              needed = std::max<size_t>(needed, 1);
+            }
+          }
+        }
+      }
+      if (needed <= scratchCount) {
+        break;
+      }
+      scratchCount = needed;
+      if (scratchCount > pool.size()) {
+        throw RegisterAllocationException(
+          "Too few registers to spill the virtual registers of " +
+          (function.name.empty() ? std::string("the code before the first function") : "@" + function.name));
+      }
+    }
+    plan.scratch.assign(pool.end() - scratchCount, pool.end());
+
+    FunctionAllocation allocation;
+    allocation.function = function.name;
+    allocation.registers = plan.placement.registers;
+    allocation.frameSize = plan.placement.slotCount * SLOT_SIZE;
+    plan.allocation = m_allocations.size();
+    m_allocations.push_back(std::move(allocation));
+    planned[f] = true;
+  }
+
+  // Slot labels, clear of every label the program uses
+  std::set<std::string> used = labelNames(statements);
+  std::vector<std::vector<std::string>> slotLabels(functions.size());
+  for (size_t f = 0; f < functions.size(); ++f) {
+    if (!planned[f]) {
+      continue;
+    }
+    const Plan& plan = plans[f];
+    for (size_t k = 0; k < plan.placement.slotCount; ++k) {
+      std::string label = "__spill_" + (functions[f].name.empty() ? "" : functions[f].name + "_") + std::to_string(k);
+      while (used.count(label)) {
+        label = "_" + label;
+      }
+      used.insert(label);
+      slotLabels[f].push_back(label);
+    }
+    FunctionAllocation& allocation = m_allocations[plan.allocation];
+    for (const auto& [reg, slot] : plan.placement.slots) {
+      allocation.spills[reg] = slotLabels[f][slot];
+    }
+  }
+
+  // Physical registers each function writes once allocated
+  std::vector<std::set<std::string>> writes(functions.size());
+  for (size_t f = 0; f < functions.size(); ++f) {
+    const Plan& plan = plans[f];
+    if (plan.placement.slotCount > 0) {
+      writes[f].insert(plan.scratch.begin(), plan.scratch.end());
+    }
+    for (size_t b : functions[f].blocks) {
+      for (size_t i = blocks[b].begin; i < blocks[b].end; ++i) {
+        const Instruction* instr = statements[i].getInstruction();
+        if (!instr) {
+          continue;
+        }
+        for (size_t index : effectsOf(*instr).writes) {
+          std::string reg = *registerOf(*instr->getOperands()[index]);
+          auto assigned = plan.placement.registers.find(reg);
+          if (!isVirtualRegister(reg)) {
+            writes[f].insert(reg);
+          } else if (assigned != plan.placement.registers.end()) {
+            writes[f].insert(assigned->second);
+          }
+        }
+      }
+    }
+  }
+  auto clobbered = [&](size_t callee, const std::string& reg) {
+    if (callee == ControlFlowGraph::NO_FUNCTION || calls.unknown[callee]) {
+      return true;
+    }
+    return std::any_of(calls.reaches[callee].begin(), calls.reaches[callee].end(),
+                       [&](size_t reached) { return writes[reached].count(reg) != 0; });
+  };
+
+  // Rename registers, loading spilled ones into scratch registers before each use and storing them after
+  std::vector<Statement> out;
+  out.reserve(statements.size());
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const Instruction* instr = statements[i].getInstruction();
+    size_t block = graph.blockOf(i);
+    if (!instr || block == ControlFlowGraph::NO_BLOCK || !planned[blocks[block].function]) {
+      out.push_back(std::move(statements[i]));
+      continue;
+    }
+
+    size_t f = blocks[block].function;
+    const Plan& plan = plans[f];
+    FunctionAllocation& allocation = m_allocations[plan.allocation];
+    InstructionEffects effects = effectsOf(*instr);
+    const auto& operands = instr->getOperands();
+    auto slotOf = [&](const std::string& reg) { return slotLabels[f][plan.placement.slots.at(reg)]; };
+
+    std::map<std::string, std::string> names = plan.placement.registers;
+    std::vector<std::string> loads;
+    std::vector<std::string> stores;
+    size_t scratchUsed = 0;
+    for (size_t index = 0; index < operands.size(); ++index) {
+      auto reg = namedRegister(*operands[index]);
+      if (!reg || plan.placement.slots.count(*reg) == 0) {
+        continue;
+      }
+      if (names.count(*reg) == 0) {
+        names[*reg] = plan.scratch[scratchUsed++];
+      }
+
+      // A conditional write may leave the old value, so it must be loaded too
+      bool written = operands[index]->getType() == Operand::Type::Register && contains(effects.writes, index);
+      bool read = !written || contains(effects.reads, index) || effects.conditional;
+      if (read && std::find(loads.begin(), loads.end(), *reg) == loads.end()) {
+        loads.push_back(*reg);
+      }
+      if (written && std::find(stores.begin(), stores.end(), *reg) == stores.end()) {
+        stores.push_back(*reg);
+      }
+    }
+
+    // Values the callee may overwrite are kept on the stack across the call
+    std::vector<std::string> savedRegisters;
+    std::vector<std::string> savedSlots;
+    if (effects.clobbers) {
+      size_t callee = calleeOf(graph, *instr);
+      for (const std::string& reg : liveAcross(*instr, i)) {
+        auto assigned = plan.placement.registers.find(reg);
+        if (assigned != plan.placement.registers.end()) {
+          if (clobbered(callee, assigned->second)) {
+            savedRegisters.push_back(assigned->second);
+          }
+        } else if (reenters(calls, callee, f)) {
+          savedSlots.push_back(slotOf(reg));
+        }
+      }
+    }
+
+    // The statement's label moves to the first instruction emitted for it
+    std::string label = statements[i].getLabel();
+    auto emit = [&out, &label](std::unique_ptr<Instruction> emitted) {
+      out.emplace_back(std::move(emitted), label);
+      label.clear();
+    };
+
+    for (const std::string& reg : savedRegisters) {
+      emit(stackInstruction("push", reg));
+      ++allocation.callSaves;
+    }
+    for (const std::string& slot : savedSlots) {
+      emit(spillInstruction("load", plan.scratch.front(), slot));
+      emit(stackInstruction("push", plan.scratch.front()));
+      ++allocation.callSaves;
+    }
+
+    for (const std::string& reg : loads) {
+      emit(spillInstruction("load", names[reg], slotOf(reg)));
+      ++allocation.spillLoads;
+    }
+
+    auto rewritten = std::make_unique<Instruction>(instr->getName(), instr->getParameters());
+    for (const auto& operand : operands) {
+      rewritten->addOperand(renameOperand(*operand, names));
+    }
+    emit(std::move(rewritten));
+
+    for (const std::string& reg : stores) {
+      emit(spillInstruction("store", names[reg], slotOf(reg)));
+      ++allocation.spillStores;
+    }
+
+    for (auto it = savedSlots.rbegin(); it != savedSlots.rend(); ++it) {
+      emit(stackInstruction("pop", plan.scratch.front()));
+      emit(spillInstruction("store", plan.scratch.front(), *it));
+    }
+    for (auto it = savedRegisters.rbegin(); it != savedRegisters.rend(); ++it) {
+      emit(stackInstruction("pop", *it));
+    }
+  }
+
+  // Reserve the slots, zeroed, in .bss
+  bool anySlots = std::any_of(slotLabels.begin(), slotLabels.end(),
+                              [](const std::vector<std::string>& labels) { return !labels.empty(); });
+  if (anySlots) {
+    auto section = std::make_unique<Directive>("section", DirectiveKind::Section);
+    for (const char* operand : {".bss", "NoBits", "Write", "Alloc"}) {
+      section->addOperand(Operand::createLabel(operand));
+    }
+    out.emplace_back(std::move(section));
+
+    auto align = std::make_unique<Directive>("align", DirectiveKind::Align);
+    align->addOperand(Operand::createImmediate(ImmediateValue::createInteger(SLOT_SIZE)));
+    out.emplace_back(std::move(align));
+
+    for (const std::vector<std::string>& labels : slotLabels) {
+      for (const std::string& label : labels) {
+        auto zero = std::make_unique<Directive>("zero", DirectiveKind::Zero);
+        zero->addOperand(Operand::createImmediate(ImmediateValue::createInteger(SLOT_SIZE)));
+        out.emplace_back(std::move(zero), label);
+      }
+    }
+  }
+
+  statements = std::move(out);
+}
+
+} // namespace casm
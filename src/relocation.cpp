@@ -0,0 +1,65 @@
+#include <casm/assembler.hpp>
+#include <algorithm>
+
+namespace casm {
+
+//
+// Relocation resolution
+//
+// Code generation records every label operand as a compact RelocationEntry
+// and emits a zero placeholder. Once all bytes are emitted the entries are
+// sorted by section and offset, and a single sweep patches those whose value
+// is known at assembly time: PC-relative references to a symbol defined in
+// the same section, whether it precedes or follows the reference. Only
+// references that cross sections or files remain for the object's
+// relocation table.
+//
+
+void Assembler::resolveRelocations(AssemblyContext& ctx) {
+    std::vector<RelocationEntry>& relocations = ctx.getRelocations();
+    
+    // Visit each section's fields in ascending order
+    std::sort(relocations.begin(), relocations.end(),
+        [](const RelocationEntry& a, const RelocationEntry& b) {
+            return a.section != b.section ? a.section < b.section : a.offset < b.offset;
+        });
+    
+    size_t total = relocations.size();
+    size_t kept = 0;
+    Section* section = nullptr;
+    
+    for (const RelocationEntry& reloc : relocations) {
+        const Symbol& target = ctx.getSymbol(reloc.symbol);
+        
+        if (!reloc.isRelative() || !target.defined || target.section != reloc.section) {
+            relocations[kept++] = reloc;
+            continue;
+        }
+        
+        if (!section || section->id != reloc.section) {
+            section = ctx.getSection(reloc.section);
+        }
+        
+        // Relative to the end of the field
+        size_t size = reloc.size();
+        i64 value = static_cast<i64>(target.value) + reloc.addend - static_cast<i64>(reloc.offset + size);
+        
+        i64 limit = size >= 8 ? INT64_MAX : (i64{1} << (size * 8 - 1)) - 1;
+        if (value > limit || value < -limit - 1) {
+            error("Reference to '" + ctx.getSymbolName(reloc.symbol) + "' out of range for a " +
+                  std::to_string(size) + "-byte field");
+            continue;
+        }
+        
+        u8 bytes[8];
+        storeLittleEndian<u64>(bytes, static_cast<u64>(value));
+        section->patch(reloc.offset, bytes, size);
+    }
+    
+    relocations.resize(kept);
+    
+    log("Resolved " + std::to_string(total - kept) + " of " + std::to_string(total) +
+        " reference(s) at assembly time");
+}
+
+} // namespace casm
@@ -0,0 +1,299 @@
+#include <casm/optimizer.hpp>
+#include <casm/cfg.hpp>
+#include <casm/effects.hpp>
+#include <algorithm>
+#include <cctype>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace casm {
+
+//
+// Tail-call conversion
+//
+// A call followed by a ret, directly or through labels only, returns straight
+// to its own caller, so it becomes a jmp and the callee returns there instead.
+// This only holds when the stack is as the function found it: the pushes
+// before the call must all have been popped. Stack depth is tracked forward
+// through the blocks of each function from its entry; a block reached with
+// different depths, a conditional push or pop, or an unknown instruction
+// leaves the depth unknown and the calls after it alone. Blocks whose labels
+// are used other than as jump targets within the function may be entered from
+// anywhere, so their depth is unknown too.
+//
+// A label is only a function entry while something calls it or it is .global,
+// so the last call to a local function from elsewhere is kept as a call. A
+// function's calls to itself do not keep it an entry and are always converted,
+// so recursion in tail position runs in constant stack space. A ret reached
+// only from the converted call is removed with it.
+//
+
+namespace {
+
+constexpr i64 UNKNOWN_DEPTH = -1;
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+// Label named by an instruction's only operand, if it is a label reference
+const std::string* targetLabel(const Instruction& instr) {
+  const auto& operands = instr.getOperands();
+  if (operands.size() != 1 || operands[0]->getType() != Operand::Type::Label) {
+    return nullptr;
+  }
+  return &static_cast<const LabelOperand&>(*operands[0]).getLabel();
+}
+
+bool isUnconditional(const Instruction& instr, const char* name, size_t operands) {
+  return lowercase(instr.getName()) == name && instr.getParameters().empty() &&
+         instr.getOperands().size() == operands;
+}
+
+// Depth after an instruction, given the depth before it
+i64 stackDepthAfter(const Instruction& instr, i64 depth) {
+  if (depth == UNKNOWN_DEPTH) {
+    return UNKNOWN_DEPTH;
+  }
+
+  InstructionEffects effects = effectsOf(instr);
+  if (effects.stack) {
+    if (effects.conditional) {
+      return UNKNOWN_DEPTH;
+    }
+    if (lowercase(instr.getName()) == "push") {
+      return depth + 1;
+    }
+    return depth > 0 ? depth - 1 : UNKNOWN_DEPTH;
+  }
+
+  // A call returns with the stack as it was; an unknown instruction may move it
+  if (effects.clobbers && lowercase(instr.getName()) != "call") {
+    return UNKNOWN_DEPTH;
+  }
+  return depth;
+}
+
+std::unique_ptr<Operand> cloneOperand(const Operand& operand) {
+  switch (operand.getType()) {
+    case Operand::Type::Register:
+      return Operand::createRegister(static_cast<const RegisterOperand&>(operand).getName());
+    case Operand::Type::Immediate:
+      return Operand::createImmediate(static_cast<const ImmediateOperand&>(operand).getValue());
+    case Operand::Type::Memory:
+      return Operand::createMemory(static_cast<const MemoryOperand&>(operand).getReference());
+    case Operand::Type::Label:
+      return Operand::createLabel(static_cast<const LabelOperand&>(operand).getLabel());
+  }
+  return nullptr;
+}
+
+// Stack depth on entry to each block; nullopt for blocks never reached
+std::vector<std::optional<i64>> entryDepths(const std::vector<Statement>& statements,
+                                            const ControlFlowGraph& graph) {
+  const auto& blocks = graph.getBlocks();
+  const auto& functions = graph.getFunctions();
+  std::vector<std::optional<i64>> depths(blocks.size());
+
+  // Labels used other than as jumps within their own function can be entered from anywhere
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const Statement& stmt = statements[i];
+    const std::vector<std::unique_ptr<Operand>>* operands = nullptr;
+    bool localJump = false;
+    if (const Instruction* instr = stmt.getInstruction()) {
+      operands = &instr->getOperands();
+      std::string name = lowercase(instr->getName());
+      localJump = name == "jmp" || name == "br";
+    } else if (const Directive* directive = stmt.getDirective()) {
+      operands = &directive->getOperands();
+    }
+    if (!operands) {
+      continue;
+    }
+
+    for (const auto& operand : *operands) {
+      if (operand->getType() != Operand::Type::Label) {
+        continue;
+      }
+      size_t target = graph.findBlock(static_cast<const LabelOperand&>(*operand).getLabel());
+      if (target == ControlFlowGraph::NO_BLOCK || target == functions[blocks[target].function].blocks.front()) {
+        continue;
+      }
+      size_t from = graph.blockOf(i);
+      if (!localJump || from == ControlFlowGraph::NO_BLOCK || blocks[from].function != blocks[target].function) {
+        depths[target] = UNKNOWN_DEPTH;
+      }
+    }
+  }
+
+  std::vector<size_t> worklist;
+  auto merge = [&depths, &worklist](size_t block, i64 depth) {
+    if (!depths[block]) {
+      depths[block] = depth;
+      worklist.push_back(block);
+    } else if (*depths[block] != depth && *depths[block] != UNKNOWN_DEPTH) {
+      depths[block] = UNKNOWN_DEPTH;
+      worklist.push_back(block);
+    }
+  };
+
+  // Functions are entered with an empty frame, unless the one before falls into them
+  bool fallsIn = false;
+  i64 fallsInDepth = 0;
+  for (size_t f = 0; f < functions.size(); ++f) {
+    const Function& function = functions[f];
+    size_t entry = function.blocks.front();
+    bool fallsThrough = f > 0 && functions[f - 1].section == function.section && fallsIn;
+    merge(entry, 0);
+    if (fallsThrough) {
+      merge(entry, fallsInDepth);
+    }
+    fallsIn = false;
+
+    for (size_t b : function.blocks) {
+      if (depths[b] == UNKNOWN_DEPTH && std::find(worklist.begin(), worklist.end(), b) == worklist.end()) {
+        worklist.push_back(b);
+      }
+    }
+
+    while (!worklist.empty()) {
+      size_t id = worklist.back();
+      worklist.pop_back();
+      const BasicBlock& block = blocks[id];
+
+      i64 depth = *depths[id];
+      for (size_t i = block.begin; i < block.end; ++i) {
+        if (const Instruction* instr = statements[i].getInstruction()) {
+          depth = stackDepthAfter(*instr, depth);
+        }
+      }
+      for (size_t successor : block.successors) {
+        merge(successor, depth);
+      }
+      if (block.fallsOut) {
+        fallsInDepth = fallsIn && fallsInDepth != depth ? UNKNOWN_DEPTH : depth;
+        fallsIn = true;
+      }
+    }
+  }
+
+  return depths;
+}
+
+// Index of the ret control reaches from after the statement through labels only
+std::optional<size_t> returnAfter(const std::vector<Statement>& statements, size_t index) {
+  for (size_t i = index + 1; i < statements.size(); ++i) {
+    Statement::Type type = statements[i].getType();
+    if (type == Statement::Type::Empty || type == Statement::Type::Label) {
+      continue;
+    }
+    const Instruction* instr = statements[i].getInstruction();
+    if (instr && isUnconditional(*instr, "ret", 0)) {
+      return i;
+    }
+    return std::nullopt;
+  }
+  return std::nullopt;
+}
+
+} // namespace
+
+size_t Optimizer::convertTailCalls(std::vector<Statement>& statements) {
+  ControlFlowGraph graph = ControlFlowGraph::build(statements);
+  std::vector<std::optional<i64>> depths = entryDepths(statements, graph);
+
+  // Name of the function holding a statement, empty outside functions
+  auto functionOf = [&graph](size_t statement) -> std::string_view {
+    size_t b = graph.blockOf(statement);
+    return b == ControlFlowGraph::NO_BLOCK ? std::string_view()
+                                           : graph.getFunctions()[graph.getBlocks()[b].function].name;
+  };
+
+  // Calls to each label from other functions, and the labels that stay entries without any
+  std::unordered_map<std::string, size_t> calls;
+  std::unordered_set<std::string> exported;
+  for (size_t i = 0; i < statements.size(); ++i) {
+    const Statement& stmt = statements[i];
+    if (const Instruction* instr = stmt.getInstruction()) {
+      const std::string* label = targetLabel(*instr);
+      if (label && lowercase(instr->getName()) == "call" && functionOf(i) != *label) {
+        ++calls[*label];
+      }
+    } else if (const Directive* directive = stmt.getDirective()) {
+      if (directive->getKind() == DirectiveKind::Global && !directive->getOperands().empty() &&
+          directive->getOperands()[0]->getType() == Operand::Type::Label) {
+        exported.insert(static_cast<const LabelOperand&>(*directive->getOperands()[0]).getLabel());
+      }
+    }
+  }
+
+  std::vector<bool> removed(statements.size(), false);
+  size_t converted = 0;
+  size_t block = ControlFlowGraph::NO_BLOCK;
+  i64 depth = UNKNOWN_DEPTH;
+
+  for (size_t i = 0; i < statements.size(); ++i) {
+    size_t current = graph.blockOf(i);
+    if (current == ControlFlowGraph::NO_BLOCK) {
+      continue;
+    }
+    if (current != block) {
+      block = current;
+      depth = depths[block].value_or(UNKNOWN_DEPTH);
+    }
+
+    const Instruction* instr = statements[i].getInstruction();
+    if (!instr) {
+      continue;
+    }
+    if (!isUnconditional(*instr, "call", 1) || depth != 0) {
+      depth = stackDepthAfter(*instr, depth);
+      continue;
+    }
+
+    auto ret = returnAfter(statements, i);
+    if (!ret) {
+      continue;
+    }
+
+    const std::string* callee = targetLabel(*instr);
+    if (callee && !exported.count(*callee) && functionOf(i) != *callee) {
+      size_t& remaining = calls[*callee];
+      if (remaining <= 1) {
+        continue;
+      }
+      --remaining;
+    }
+
+    auto jmp = std::make_unique<Instruction>("jmp");
+    jmp->addOperand(cloneOperand(*instr->getOperands()[0]));
+    statements[i] = Statement(std::move(jmp), statements[i].getLabel());
+    ++converted;
+
+    // Nothing else can reach a ret with no label in between
+    bool unlabelled = std::all_of(statements.begin() + i + 1, statements.begin() + *ret + 1,
+                                  [](const Statement& stmt) { return stmt.getLabel().empty(); });
+    if (unlabelled) {
+      removed[*ret] = true;
+    }
+  }
+
+  if (std::find(removed.begin(), removed.end(), true) != removed.end()) {
+    std::vector<Statement> out;
+    out.reserve(statements.size());
+    for (size_t i = 0; i < statements.size(); ++i) {
+      if (!removed[i]) {
+        out.push_back(std::move(statements[i]));
+      }
+    }
+    statements = std::move(out);
+  }
+
+  m_stats.tailCalls += converted;
+  return converted;
+}
+
+} // namespace casm
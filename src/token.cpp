@@ -1,7 +1,9 @@
 #include <casm/token.hpp>
+#include <casm/expression.hpp>
 #include <sstream>
 #include <cctype>
 #include <regex>
+#include <unordered_map>
 
 namespace casm {
 
@@ -46,6 +48,14 @@ ImmediateValue ImmediateValue::createString(std::string value) {
   return iv;
 }
 
+ImmediateValue ImmediateValue::createExpression(ExpressionPtr value) {
+  ImmediateValue iv;
+  iv.format = ImmediateFormat::Expression;
+  iv.base = ImmediateBase::Decimal;
+  iv.value = std::move(value);
+  return iv;
+}
+
 std::string ImmediateValue::toString() const {
   std::ostringstream ss;
   
@@ -75,6 +85,10 @@ std::string ImmediateValue::toString() const {
     case ImmediateFormat::String:
       ss << "String(\"" << std::get<std::string>(value) << "\")";
       break;
+
+    case ImmediateFormat::Expression:
+      ss << "Expression(" << std::get<ExpressionPtr>(value)->toString() << ")";
+      break;
   }
   
   return ss.str();
@@ -91,6 +105,22 @@ std::optional<ImmediateValue> parseImmediate(const std::string& str) {
     return std::nullopt;
   }
   
+  // Expression, folded to an integer unless it references symbols
+  if (value[0] == '(') {
+    ExpressionPtr expr = Expression::parse(value);
+    if (!expr) {
+      return std::nullopt;
+    }
+    try {
+      if (std::optional<i64> constant = expr->constantValue()) {
+        return ImmediateValue::createInteger(*constant);
+      }
+    } catch (const ExpressionException& e) {
+      return std::nullopt; // Division by zero or bad shift count
+    }
+    return ImmediateValue::createExpression(std::move(expr));
+  }
+  
   // Character literal
   if (value.size() >= 3 && value[0] == '\'' && value[value.size()-1] == '\'') {
     if (value.size() == 3) {
@@ -202,24 +232,29 @@ std::optional<MemoryReference> parseMemoryRef(const std::string& str) {
   
   std::string regName = content.substr(regStart + 1, regEnd - regStart - 1);
   
-  // Check for offset
-  i64 offset = 0;
-  if (regEnd < content.size()) {
-    char sign = content[regEnd];
-    if (sign == '+' || sign == '-') {
-      std::string offsetStr = content.substr(regEnd + 1);
-      try {
-        offset = std::stoll(offsetStr);
-        if (sign == '-') {
-          offset = -offset;
-        }
-      } catch (const std::exception& e) {
-        return std::nullopt; // Invalid offset
-      }
+  // Check for offset, any expression following a + or -
+  size_t offsetStart = content.find_first_not_of(" \t", regEnd);
+  if (offsetStart == std::string::npos) {
+    return MemoryReference(regName, 0);
+  }
+  if (content[offsetStart] != '+' && content[offsetStart] != '-') {
+    return std::nullopt;
+  }
+  
+  ExpressionPtr offsetExpr = Expression::parse("0" + content.substr(offsetStart));
+  if (!offsetExpr) {
+    return std::nullopt; // Invalid offset
+  }
+  
+  try {
+    if (std::optional<i64> constant = offsetExpr->constantValue()) {
+      return MemoryReference(regName, *constant);
     }
+  } catch (const ExpressionException& e) {
+    return std::nullopt;
   }
   
-  return MemoryReference(regName, offset);
+  return MemoryReference(regName, 0, std::move(offsetExpr));
 }
 
 const char* tokenTypeToString(TokenType type) {
@@ -241,6 +276,27 @@ const char* tokenTypeToString(TokenType type) {
   }
 }
 
+DirectiveKind lookupDirective(const std::string& name) {
+  static const std::unordered_map<std::string, DirectiveKind> DIRECTIVES = {
+    {"section", DirectiveKind::Section}, {"global", DirectiveKind::Global},
+    {"local", DirectiveKind::Local},
+    {"i8", DirectiveKind::I8},   {"i16", DirectiveKind::I16},
+    {"i32", DirectiveKind::I32}, {"i64", DirectiveKind::I64},
+    {"u8", DirectiveKind::U8},   {"u16", DirectiveKind::U16},
+    {"u32", DirectiveKind::U32}, {"u64", DirectiveKind::U64},
+    {"f32", DirectiveKind::F32}, {"f64", DirectiveKind::F64},
+    {"ascii", DirectiveKind::Ascii}, {"asciiz", DirectiveKind::Asciiz},
+    {"zero", DirectiveKind::Zero},   {"align", DirectiveKind::Align},
+    {"equ", DirectiveKind::Equ},     {"set", DirectiveKind::Set}
+  };
+  
+  auto it = DIRECTIVES.find(name);
+  if (it != DIRECTIVES.end()) {
+    return it->second;
+  }
+  return DirectiveKind::Unknown;
+}
+
 std::string Token::toString() const {
   std::ostringstream ss;
   ss << tokenTypeToString(type) << "('" << value << "', at " << location.toString() << ")";
@@ -264,8 +320,10 @@ Token Token::makeInstruction(const std::string& name, const SourceLocation& loca
   return Token(TokenType::Instruction, name, location);
 }
 
-Token Token::makeDirective(const std::string& name, const SourceLocation& location) {
-  return Token(TokenType::Directive, name, location);
+Token Token::makeDirective(const std::string& name, DirectiveKind kind, const SourceLocation& location) {
+  Token token(TokenType::Directive, name, location);
+  token.directiveKind = kind;
+  return token;
 }
 
 Token Token::makeRegister(const std::string& name, const SourceLocation& location) {
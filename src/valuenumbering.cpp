@@ -0,0 +1,363 @@
+#include <casm/optimizer.hpp>
+#include <casm/cfg.hpp>
+#include <casm/effects.hpp>
+#include <casm/expression.hpp>
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace casm {
+
+//
+// Local value numbering
+//
+// Each basic block is swept once, giving every value a number: the incoming
+// value of a register, an immediate of a given type and width, a label
+// address, the result of an operation on numbered values, and the contents
+// of a memory address. A
+// computation or load whose number is already held in a register becomes a
+// mov from that register, or disappears if the destination holds it already.
+// Register reads are redirected to the register a value was first computed
+// into, so the copies in between can later die.
+//
+// Memory is tracked per address: the key is the number of the base register
+// plus the offset, or the label. Any store, push or pop forgets all memory,
+// since addresses may alias, and a call forgets everything. Arithmetic sets
+// the flags, so it is only rewritten when nothing reads them before they are
+// set again.
+//
+
+namespace {
+
+std::string lowercase(std::string text) {
+  std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+  return text;
+}
+
+bool isCommutative(const std::string& name) {
+  return name == "add" || name == "mul" || name == "and" || name == "or" || name == "xor";
+}
+
+std::unique_ptr<Operand> cloneOperand(const Operand& operand) {
+  switch (operand.getType()) {
+    case Operand::Type::Register:
+      return Operand::createRegister(static_cast<const RegisterOperand&>(operand).getName());
+    case Operand::Type::Immediate:
+      return Operand::createImmediate(static_cast<const ImmediateOperand&>(operand).getValue());
+    case Operand::Type::Memory:
+      return Operand::createMemory(static_cast<const MemoryOperand&>(operand).getReference());
+    case Operand::Type::Label:
+      return Operand::createLabel(static_cast<const LabelOperand&>(operand).getLabel());
+  }
+  return nullptr;
+}
+
+std::unique_ptr<Instruction> moveInstruction(const Operand& dest, const std::string& source) {
+  auto mov = std::make_unique<Instruction>("mov");
+  mov->addOperand(cloneOperand(dest));
+  mov->addOperand(Operand::createRegister(source));
+  return mov;
+}
+
+// Key of an immediate: its value and the type it is encoded with, which for
+// integers is 32 bits unless the value needs all 64
+std::string immediateKey(const ImmediateValue& value) {
+  if (value.format != ImmediateFormat::Integer) {
+    return "$" + value.toString();
+  }
+  i64 integer = std::get<i64>(value.value);
+  bool wide = integer < std::numeric_limits<i32>::min() || integer > std::numeric_limits<i32>::max();
+  return (wide ? "$i64 " : "$i32 ") + std::to_string(integer);
+}
+
+// Value numbers of registers, expressions and memory within one block
+class ValueTable {
+public:
+  void clear() {
+    m_registers.clear();
+    m_values.clear();
+    m_memory.clear();
+    m_origins.clear();
+  }
+
+  size_t fresh() { return m_next++; }
+
+  // Number of a register's value, numbering its incoming value on first use
+  size_t registerValue(const std::string& reg) {
+    auto it = m_registers.find(reg);
+    if (it != m_registers.end()) {
+      return it->second;
+    }
+    size_t value = fresh();
+    assign(reg, value);
+    return value;
+  }
+
+  // Number of a source operand; memory operands have none
+  std::optional<size_t> operandValue(const Operand& operand) {
+    switch (operand.getType()) {
+      case Operand::Type::Register:
+        return registerValue(*registerOf(operand));
+      case Operand::Type::Immediate: {
+        return keyedValue(immediateKey(static_cast<const ImmediateOperand&>(operand).getValue())).first;
+      }
+      case Operand::Type::Label:
+        return keyedValue("@" + static_cast<const LabelOperand&>(operand).getLabel()).first;
+      default:
+        return std::nullopt;
+    }
+  }
+
+  // Number for a key, and whether it was numbered before
+  std::pair<size_t, bool> keyedValue(const std::string& key) {
+    auto [it, added] = m_values.try_emplace(key, m_next);
+    if (added) {
+      ++m_next;
+    }
+    return {it->second, !added};
+  }
+
+  // Key of the memory an operand addresses
+  std::optional<std::string> addressKey(const Operand& operand) {
+    if (operand.getType() == Operand::Type::Label) {
+      return "@" + static_cast<const LabelOperand&>(operand).getLabel();
+    }
+    if (operand.getType() != Operand::Type::Memory) {
+      return std::nullopt;
+    }
+
+    const MemoryReference& ref = static_cast<const MemoryOperand&>(operand).getReference();
+    std::string key = "[" + std::to_string(registerValue(lowercase(ref.reg))) + "+";
+    return key + (ref.offsetExpr ? ref.offsetExpr->toString() : std::to_string(ref.offset)) + "]";
+  }
+
+  std::optional<size_t> memoryValue(const std::string& address) const {
+    auto it = m_memory.find(address);
+    return it != m_memory.end() ? std::optional<size_t>(it->second) : std::nullopt;
+  }
+
+  void setMemory(const std::string& address, size_t value) { m_memory[address] = value; }
+  void clearMemory() { m_memory.clear(); }
+
+  void assign(const std::string& reg, size_t value) {
+    m_registers[reg] = value;
+    m_origins.try_emplace(value, reg);
+  }
+
+  // Register the value was first placed in, if it still holds it
+  std::optional<std::string> origin(size_t value) const {
+    auto it = m_origins.find(value);
+    if (it == m_origins.end() || m_registers.at(it->second) != value) {
+      return std::nullopt;
+    }
+    return it->second;
+  }
+
+  // Any register holding the value, preferring its origin
+  std::optional<std::string> holder(size_t value) const {
+    if (auto reg = origin(value)) {
+      return reg;
+    }
+    for (const auto& [reg, held] : m_registers) {
+      if (held == value) {
+        return reg;
+      }
+    }
+    return std::nullopt;
+  }
+
+private:
+  std::map<std::string, size_t> m_registers;             // Ordered, so rewrites are deterministic
+  std::unordered_map<std::string, size_t> m_values;      // Operation, immediate or label key
+  std::unordered_map<std::string, size_t> m_memory;      // Address key
+  std::unordered_map<size_t, std::string> m_origins;     // First register given each value
+  size_t m_next = 0;
+};
+
+} // namespace
+
+size_t Optimizer::numberValues(std::vector<Statement>& statements) {
+  size_t before = m_stats.valueNumbering();
+
+  ControlFlowGraph graph = ControlFlowGraph::build(statements);
+  const auto& blocks = graph.getBlocks();
+  std::vector<FunctionValueCounts> counts(graph.getFunctions().size());
+  for (size_t f = 0; f < counts.size(); ++f) {
+    counts[f].function = graph.getFunctions()[f].name;
+  }
+
+  std::vector<Statement> out;
+  out.reserve(statements.size());
+
+  ValueTable table;
+  size_t currentBlock = ControlFlowGraph::NO_BLOCK;
+
+  for (size_t i = 0; i < statements.size(); ++i) {
+    Statement& stmt = statements[i];
+    size_t block = graph.blockOf(i);
+    if (block != currentBlock) {
+      table.clear();
+      currentBlock = block;
+    }
+
+    Instruction* instr = stmt.getInstruction();
+    if (!instr || block == ControlFlowGraph::NO_BLOCK) {
+      // Data placed between instructions may be anything
+      if (stmt.getDirective()) {
+        table.clear();
+      }
+      out.push_back(std::move(stmt));
+      continue;
+    }
+
+    FunctionValueCounts& count = counts[blocks[block].function];
+    InstructionEffects effects = effectsOf(*instr);
+    const auto& operands = instr->getOperands();
+    std::string name = lowercase(instr->getName());
+
+    if (effects.clobbers) {
+      table.clear();
+      out.push_back(std::move(stmt));
+      continue;
+    }
+
+    // The value written to the destination register, if this pass can number it
+    std::optional<size_t> result;
+    bool reused = false;          // The result is a known value in some register
+    size_t* counter = nullptr;    // Counter for rewriting the instruction into a mov
+
+    auto dest = operands.empty() ? std::nullopt : registerOf(*operands[0]);
+    bool destWritten = std::find(effects.writes.begin(), effects.writes.end(), 0) != effects.writes.end();
+
+    if (!effects.conditional && dest && destWritten) {
+      if (name == "mov" && operands.size() == 2 && operands[1]->getType() != Operand::Type::Memory) {
+        // Self-moves are left to the peephole pass, which counts them
+        result = table.operandValue(*operands[1]);
+        if (result && table.registerValue(*dest) == *result && registerOf(*operands[1]) != dest) {
+          reused = true;
+          counter = &count.copies;
+        }
+      } else if ((name == "load" || name == "mov") && operands.size() == 2) {
+        if (auto address = table.addressKey(*operands[1])) {
+          if (auto known = table.memoryValue(*address)) {
+            result = known;
+            reused = true;
+            counter = &count.loads;
+          } else {
+            result = table.fresh();
+            table.setMemory(*address, *result);
+          }
+        }
+      } else if (effects.setsFlags) {
+        // Arithmetic on registers and immediates: the operation and its source numbers
+        std::vector<size_t> sources;
+        bool numbered = true;
+        for (size_t index = operands.size() == 3 ? 1 : 0; index < operands.size() && numbered; ++index) {
+          auto value = table.operandValue(*operands[index]);
+          numbered = value.has_value();
+          sources.push_back(value.value_or(0));
+        }
+
+        if (numbered) {
+          if (isCommutative(name)) {
+            std::sort(sources.begin(), sources.end());
+          }
+          std::string key = name;
+          for (size_t value : sources) {
+            key += " " + std::to_string(value);
+          }
+          auto [value, known] = table.keyedValue(key);
+          result = value;
+          if (known && !flagsObserved(statements, i, blocks[block].end)) {
+            reused = true;
+            counter = &count.computations;
+          }
+        }
+      }
+    }
+
+    // Where the known value already sits, the instruction becomes a mov or goes away
+    std::optional<std::string> holder;
+    if (reused) {
+      holder = table.registerValue(*dest) == *result ? dest : table.holder(*result);
+    }
+    if (holder) {
+      ++*counter;
+      if (*holder == *dest) {
+        if (!stmt.getLabel().empty()) {
+          out.emplace_back(stmt.getLabel());
+        }
+      } else {
+        out.emplace_back(moveInstruction(*operands[0], *holder), stmt.getLabel());
+        table.assign(*dest, *result);
+      }
+      continue;
+    }
+
+    // Redirect reads of copies to the register the value was first placed in
+    std::vector<std::optional<std::string>> redirected(operands.size());
+    bool redirects = false;
+    if (!effects.conditional) {
+      for (size_t index : effects.reads) {
+        if (std::find(effects.writes.begin(), effects.writes.end(), index) != effects.writes.end()) {
+          continue;
+        }
+        std::string reg = *registerOf(*operands[index]);
+        auto original = table.origin(table.registerValue(reg));
+        if (original && *original != reg) {
+          redirected[index] = original;
+          redirects = true;
+          ++count.copies;
+        }
+      }
+    }
+
+    // Apply the writes
+    if (name == "store" && !effects.conditional && operands.size() == 2) {
+      // The stored address now holds the stored value; every other address may alias it
+      auto address = table.addressKey(*operands[0]);
+      auto value = table.operandValue(*operands[1]);
+      table.clearMemory();
+      if (address && value) {
+        table.setMemory(*address, *value);
+      }
+    } else if (effects.stores || name == "pop") {
+      table.clearMemory();
+    }
+
+    for (size_t index : effects.writes) {
+      std::string reg = *registerOf(*operands[index]);
+      table.assign(reg, index == 0 && result ? *result : table.fresh());
+    }
+
+    if (redirects) {
+      auto rewritten = std::make_unique<Instruction>(instr->getName(), instr->getParameters());
+      for (size_t index = 0; index < operands.size(); ++index) {
+        rewritten->addOperand(redirected[index] ? Operand::createRegister(*redirected[index])
+                                                : cloneOperand(*operands[index]));
+      }
+      out.emplace_back(std::move(rewritten), stmt.getLabel());
+    } else {
+      out.push_back(std::move(stmt));
+    }
+  }
+
+  for (FunctionValueCounts& function : counts) {
+    if (function.computations + function.loads + function.copies == 0) {
+      continue;
+    }
+    m_stats.redundantComputations += function.computations;
+    m_stats.redundantLoads += function.loads;
+    m_stats.propagatedCopies += function.copies;
+    m_stats.functionValues.push_back(std::move(function));
+  }
+
+  statements = std::move(out);
+  return m_stats.valueNumbering() - before;
+}
+
+} // namespace casm
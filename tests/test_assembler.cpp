@@ -173,6 +173,121 @@ TEST_CASE_METHOD(CoilTestFixture, "Sections and directives", "[assembler]") {
         CHECK(section->getData().size() >= 49);
     }
     
+    SECTION("Data directive encoding") {
+        // Build a large .i32 table to exercise bulk emission
+        std::string table = "            .i32 ";
+        for (int i = 0; i < 1000; ++i) {
+            table += (i ? ", $id" : "$id") + std::to_string(i * 3);
+        }
+        
+        std::string source = R"(
+            .section .data
+            .i16 $id513, $id2
+            .f32 $fd1.5
+            .ascii $"Hi"
+)" + table + "\n";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        auto* section = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".data")));
+        REQUIRE(section != nullptr);
+        
+        const auto& data = section->getData();
+        REQUIRE(data.size() == 4 + 4 + 2 + 4000);
+        
+        // Little-endian 16-bit values
+        CHECK(data[0] == 0x01);
+        CHECK(data[1] == 0x02);
+        CHECK(data[2] == 0x02);
+        CHECK(data[3] == 0x00);
+        
+        // 1.5f == 0x3FC00000
+        CHECK(data[4] == 0x00);
+        CHECK(data[5] == 0x00);
+        CHECK(data[6] == 0xC0);
+        CHECK(data[7] == 0x3F);
+        
+        CHECK(data[8] == 'H');
+        CHECK(data[9] == 'i');
+        
+        // Every table entry is stored in order
+        bool tableMatches = true;
+        for (size_t i = 0; i < 1000; ++i) {
+            const coil::u8* entry = data.data() + 10 + i * 4;
+            coil::u32 value = entry[0] | (entry[1] << 8) | (entry[2] << 16) | (static_cast<coil::u32>(entry[3]) << 24);
+            tableMatches = tableMatches && value == i * 3;
+        }
+        CHECK(tableMatches);
+    }
+    
+    SECTION("Align directive") {
+        std::string source = R"(
+            .section .data
+            .i8 $id1
+            .align $id4
+            #word
+            .i32 $id7
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        // Word should start on the next 4-byte boundary
+        const coil::Symbol* word = obj.getSymbol(obj.getSymbolIndex("word"));
+        REQUIRE(word != nullptr);
+        CHECK(word->value == 4);
+        
+        auto* section = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".data")));
+        REQUIRE(section != nullptr);
+        
+        const auto& data = section->getData();
+        REQUIRE(data.size() == 8);
+        CHECK(data[0] == 1);
+        CHECK(data[1] == 0);
+        CHECK(data[4] == 7);
+    }
+    
+    SECTION("Zero fill") {
+        std::string source = R"(
+            .section .data
+            .i8 $id1
+            .zero $id3
+            .i8 $id2
+            
+            .section .bss
+            .zero $id1073741824
+            #after_gap
+            .zero $id16
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        // Zero runs are expanded in ProgBits sections
+        auto* data = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".data")));
+        REQUIRE(data != nullptr);
+        CHECK(data->getData() == std::vector<coil::u8>{1, 0, 0, 0, 2});
+        
+        // Sections are emitted in creation order
+        CHECK(obj.getSectionIndex(".data") < obj.getSectionIndex(".bss"));
+        
+        // NoBits sections only track their size
+        auto* bss = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".bss")));
+        REQUIRE(bss != nullptr);
+        CHECK(bss->getData().empty());
+        
+        const coil::Symbol* afterGap = obj.getSymbol(obj.getSymbolIndex("after_gap"));
+        REQUIRE(afterGap != nullptr);
+        CHECK(afterGap->value == 1073741824);
+    }
+    
     SECTION("Section with custom flags") {
         std::string source = R"(
             .section .custom ^Write ^Alloc
@@ -233,6 +348,61 @@ TEST_CASE_METHOD(CoilTestFixture, "Symbols and labels", "[assembler]") {
         CHECK(main->binding == static_cast<coil::u8>(coil::SymbolBinding::Global));
     }
     
+    SECTION("Symbol order") {
+        std::string source = R"(
+            .section .text
+            #zeta
+              nop
+            #alpha
+              nop
+            #mid
+              ret
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        // Symbols are emitted in definition order
+        coil::u16 zeta = obj.getSymbolIndex("zeta");
+        coil::u16 alpha = obj.getSymbolIndex("alpha");
+        coil::u16 mid = obj.getSymbolIndex("mid");
+        REQUIRE(zeta > 0);
+        CHECK(zeta < alpha);
+        CHECK(alpha < mid);
+    }
+    
+    SECTION("Function symbols") {
+        std::string source = R"(
+            .section .text
+            .global @main
+            #main
+              call @helper
+              ret
+            #helper
+              br ^eq @done
+              nop
+            #done ret
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        // Exported and called labels are functions, branch targets are not
+        const coil::Symbol* main = obj.getSymbol(obj.getSymbolIndex("main"));
+        const coil::Symbol* helper = obj.getSymbol(obj.getSymbolIndex("helper"));
+        const coil::Symbol* done = obj.getSymbol(obj.getSymbolIndex("done"));
+        REQUIRE(main != nullptr);
+        REQUIRE(helper != nullptr);
+        REQUIRE(done != nullptr);
+        CHECK(main->type == static_cast<coil::u8>(coil::SymbolType::Func));
+        CHECK(helper->type == static_cast<coil::u8>(coil::SymbolType::Func));
+        CHECK(done->type == static_cast<coil::u8>(coil::SymbolType::NoType));
+    }
+    
     SECTION("Multiple labels") {
         std::string source = R"(
             .section .text
@@ -333,11 +503,87 @@ TEST_CASE_METHOD(CoilTestFixture, "Instructions", "[assembler]") {
         CHECK(data[0] == static_cast<coil::u8>(coil::Opcode::Nop));
         
         // Check for MOV opcode in the second instruction
-        // Assuming 8-byte instructions based on the encoding in assembler.cpp
-        CHECK(data[8] == static_cast<coil::u8>(coil::Opcode::Mov));
+        // nop is 4 bytes, each mov is a 4-byte header plus two 4-byte operands
+        CHECK(data[4] == static_cast<coil::u8>(coil::Opcode::Mov));
         
         // Check for ADD opcode in the fourth instruction
-        CHECK(data[24] == static_cast<coil::u8>(coil::Opcode::Add));
+        CHECK(data[28] == static_cast<coil::u8>(coil::Opcode::Add));
+    }
+    
+    SECTION("Operand encoding") {
+        std::string source = R"(
+            .section .text
+            mov %r3, $ix1234
+            load %r1, [%r2+8]
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        auto* section = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(section != nullptr);
+        
+        const auto& data = section->getData();
+        REQUIRE(data.size() == 24);
+        
+        // Register and immediate occupy little-endian 4-byte slots
+        CHECK(data[4] == 3);
+        CHECK(data[5] == 0);
+        CHECK(data[8] == 0x34);
+        CHECK(data[9] == 0x12);
+        CHECK(data[10] == 0);
+        
+        // Memory operand is a 16-bit base register and a 16-bit offset
+        CHECK(data[20] == 2);
+        CHECK(data[22] == 8);
+        CHECK(data[23] == 0);
+    }
+    
+    SECTION("Operand shapes") {
+        std::string source = R"(
+            .section .text
+            add %r1, %r2, %r3
+            sub %r4, %r5, $id-2
+            store [%r6-4], %r7
+            mov %r1, $fd1.5
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        auto* section = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(section != nullptr);
+        
+        const auto& data = section->getData();
+        REQUIRE(data.size() == 16 + 16 + 12 + 12);
+        
+        // Three register slots
+        CHECK(data[0] == static_cast<coil::u8>(coil::Opcode::Add));
+        CHECK(data[4] == 1);
+        CHECK(data[8] == 2);
+        CHECK(data[12] == 3);
+        
+        // Negative immediate fills its 32-bit slot
+        CHECK(data[16] == static_cast<coil::u8>(coil::Opcode::Sub));
+        CHECK(data[28] == 0xFE);
+        CHECK(data[31] == 0xFF);
+        
+        // Memory destination then register source
+        CHECK(data[32] == static_cast<coil::u8>(coil::Opcode::Store));
+        CHECK(data[36] == 6);
+        CHECK(data[38] == 0xFC);
+        CHECK(data[39] == 0xFF);
+        CHECK(data[40] == 7);
+        
+        // 64-bit float immediates keep their low 32 bits
+        CHECK(data[44] == static_cast<coil::u8>(coil::Opcode::Mov));
+        CHECK(data[48] == 1);
+        CHECK(data[52] == 0);
+        CHECK(data[55] == 0);
     }
     
     SECTION("Memory operations") {
@@ -370,8 +616,8 @@ TEST_CASE_METHOD(CoilTestFixture, "Instructions", "[assembler]") {
         CHECK(data[0] == static_cast<coil::u8>(coil::Opcode::Load));
         
         // Check for STORE opcode in the third instruction
-        // Assuming 8-byte instructions based on the encoding in assembler.cpp
-        CHECK(data[16] == static_cast<coil::u8>(coil::Opcode::Store));
+        // Each load is a 4-byte header plus two 4-byte operands
+        CHECK(data[24] == static_cast<coil::u8>(coil::Opcode::Store));
     }
     
     SECTION("Branch instructions with parameters") {
@@ -402,11 +648,774 @@ TEST_CASE_METHOD(CoilTestFixture, "Instructions", "[assembler]") {
         CHECK(!data.empty());
         
         // Find the BR instruction (third instruction)
-        // Assuming 8-byte instructions based on the encoding in assembler.cpp
-        CHECK(data[16] == static_cast<coil::u8>(coil::Opcode::Br));
+        // inc is 8 bytes and cmp is 12 bytes
+        CHECK(data[20] == static_cast<coil::u8>(coil::Opcode::Br));
         
         // Check flag byte (LT parameter)
-        CHECK(data[17] == static_cast<coil::u8>(coil::InstrFlag0::LT));
+        CHECK(data[21] == static_cast<coil::u8>(coil::InstrFlag0::LT));
+        
+        // Short backward branch is relaxed to an 8-bit displacement
+        CHECK(data[23] == 1);
+        CHECK(data.size() == 29);
+        CHECK(static_cast<coil::i8>(data[24]) == -25);
+    }
+}
+
+TEST_CASE_METHOD(CoilTestFixture, "Branch relaxation", "[assembler]") {
+    SECTION("Label offsets are exact") {
+        std::string source = R"(
+            .section .text
+            
+            #start
+              jmp @end
+              mov %r1, $id1
+            #end
+              ret
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        // jmp with an 8-bit displacement is 5 bytes, mov is 12 bytes
+        const coil::Symbol* end = obj.getSymbol(obj.getSymbolIndex("end"));
+        REQUIRE(end != nullptr);
+        CHECK(end->value == 17);
+        
+        auto* section = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(section != nullptr);
+        
+        const auto& data = section->getData();
+        REQUIRE(data.size() == 21);
+        CHECK(data[0] == static_cast<coil::u8>(coil::Opcode::Jump));
+        CHECK(data[3] == 1);
+        CHECK(data[4] == 12);
+    }
+    
+    SECTION("Mnemonics are relaxed in any case") {
+        // The lexer only accepts lower case, but statements built in code may not be
+        std::vector<Statement> statements;
+        statements.emplace_back(std::make_unique<Directive>("section", std::vector<std::unique_ptr<Operand>>{}));
+        statements.back().getDirective()->addOperand(Operand::createLabel(".text"));
+        auto jmp = std::make_unique<Instruction>("JMP");
+        jmp->addOperand(Operand::createLabel("end"));
+        statements.emplace_back(std::move(jmp), "start");
+        auto mov = std::make_unique<Instruction>("mov");
+        mov->addOperand(Operand::createRegister("r1"));
+        mov->addOperand(Operand::createImmediate(ImmediateValue::createInteger(1)));
+        statements.emplace_back(std::move(mov));
+        statements.emplace_back(std::make_unique<Instruction>("ret"), "end");
+        
+        Assembler assembler;
+        coil::Object obj = assembler.assemble(statements).object;
+        REQUIRE(assembler.getErrors().empty());
+        
+        // Laid out at the 8-bit size the encoder emits
+        const coil::Symbol* end = obj.getSymbol(obj.getSymbolIndex("end"));
+        REQUIRE(end != nullptr);
+        CHECK(end->value == 17);
+        
+        auto* section = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(section != nullptr);
+        REQUIRE(section->getData().size() == 21);
+        CHECK(section->getData()[3] == 1);
+    }
+    
+    SECTION("Far branches grow to wider displacements") {
+        std::string source = ".section .text\n#top\njmp @bottom\n";
+        for (int i = 0; i < 40; ++i) {
+            source += "nop\n";
+        }
+        source += "#bottom\njmp @top\n";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        auto* section = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(section != nullptr);
+        
+        // 160 bytes of nops do not fit in 8 bits, so both jumps use 16-bit displacements
+        const auto& data = section->getData();
+        REQUIRE(data.size() == 6 + 160 + 6);
+        CHECK(data[3] == 2);
+        CHECK((data[4] | (data[5] << 8)) == 160);
+        
+        const coil::Symbol* bottom = obj.getSymbol(obj.getSymbolIndex("bottom"));
+        REQUIRE(bottom != nullptr);
+        CHECK(bottom->value == 166);
+        CHECK(data[166 + 3] == 2);
+        CHECK(static_cast<coil::i16>(data[170] | (data[171] << 8)) == -172);
+    }
+    
+    SECTION("Cross-section targets are not relaxed") {
+        std::string source = R"(
+            .section .text
+            jmp @elsewhere
+            
+            .section .other
+            #elsewhere
+              ret
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        auto* section = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(section != nullptr);
+        CHECK(section->getData().size() == 8);
+        CHECK(section->getData()[3] == 0);
+    }
+}
+
+TEST_CASE_METHOD(CoilTestFixture, "Relocations", "[assembler]") {
+    SECTION("Cross-section references are relocated") {
+        std::string source = R"(
+            .section .data
+            .zero $id8
+            #value
+              .i32 $id7
+            
+            .section .text
+            #main
+              mov %r1, @value
+              ret
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        // One absolute relocation for the source operand of mov
+        REQUIRE(obj.getRelocationCount() == 1);
+        const coil::Relocation* reloc = obj.getRelocation(1);
+        REQUIRE(reloc != nullptr);
+        CHECK(reloc->offset == 8);
+        CHECK(reloc->size == 4);
+        CHECK(reloc->symbol_index == obj.getSymbolIndex("value"));
+        CHECK(reloc->section_index == obj.getSectionIndex(".text"));
+        CHECK(reloc->type == static_cast<coil::u8>(Assembler::RelocationType::Absolute));
+        
+        // The field itself is left as a zero placeholder
+        auto* text = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        CHECK(text->getData()[8] == 0);
+    }
+    
+    SECTION("Same-section references are resolved") {
+        std::string source = R"(
+            .section .text
+            #start
+              mov %r1, @later
+              nop
+            #later
+              mov %r2, @start
+              ret
+        )";
+        
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        
+        CHECK(errors.empty());
+        
+        // Forward and backward references within .text need no relocation
+        CHECK(obj.getRelocationCount() == 0);
+        
+        auto* text = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        const auto& data = text->getData();
+        REQUIRE(data.size() == 32);
+        
+        // Displacements are measured from the end of the referencing instruction
+        auto field = [&data](size_t offset) {
+            return static_cast<coil::i32>(data[offset] | (data[offset + 1] << 8) |
+                                          (data[offset + 2] << 16) | (static_cast<coil::u32>(data[offset + 3]) << 24));
+        };
+        CHECK(field(8) == 16 - 12);
+        CHECK(field(24) == 0 - 28);
+    }
+    
+    SECTION("External symbols") {
+        Assembler assembler;
+        Assembler::Options options;
+        options.allowUnresolvedSymbols = true;
+        assembler.setOptions(options);
+        
+        auto result = assembler.assembleSource(".section .text\ncall @external\nret\n", "test.casm");
+        CHECK(assembler.getErrors().empty());
+        
+        // The undefined symbol is emitted for the linker and referenced by the relocation
+        coil::u16 external = result.object.getSymbolIndex("external");
+        REQUIRE(external > 0);
+        CHECK(result.object.getSymbol(external)->section_index == 0);
+        
+        REQUIRE(result.object.getRelocationCount() == 1);
+        CHECK(result.object.getRelocation(1)->symbol_index == external);
+        CHECK(result.object.getRelocation(1)->offset == 4);
+    }
+}
+
+TEST_CASE_METHOD(CoilTestFixture, "Compact encoding", "[assembler]") {
+    Assembler assembler;
+    Assembler::Options options;
+    options.compactEncoding = true;
+    assembler.setOptions(options);
+    
+    std::string source = R"(
+        .section .text
+        #start
+          mov %r1, $id5
+          mov %r2, $id5000000000
+          load %r3, [%r1+1000]
+          jmp @start
+        #end
+          mov %r4, @start
+    )";
+    
+    auto result = assembler.assembleSource(source, "test.casm");
+    CHECK(assembler.getErrors().empty());
+    
+    auto* text = dynamic_cast<const coil::DataSection*>(result.object.getSection(result.object.getSectionIndex(".text")));
+    REQUIRE(text != nullptr);
+    const auto& data = text->getData();
+    
+    SECTION("Operands use the smallest width") {
+        // mov %r1, $id5: header, 1-byte register, 1-byte immediate
+        CHECK(data[3] == 0x00);
+        CHECK(data[4] == 1);
+        CHECK(data[5] == 5);
+        
+        // mov %r2, $id5000000000: the immediate keeps all 64 bits
+        CHECK(data[9] == 0x30);
+        coil::u64 wide = 0;
+        for (int i = 7; i >= 0; --i) {
+            wide = (wide << 8) | data[11 + i];
+        }
+        CHECK(wide == 5000000000ULL);
+        
+        // load %r3, [%r1+1000]: base and offset share a 2-byte width
+        CHECK(data[22] == 0x10);
+        CHECK(data[23] == 3);
+        CHECK((data[24] | (data[25] << 8)) == 1);
+        CHECK((data[26] | (data[27] << 8)) == 1000);
+    }
+    
+    SECTION("Labels and branches follow the compact layout") {
+        // jmp @start still relaxes to an 8-bit displacement
+        CHECK(data[31] == static_cast<coil::u8>(1));
+        CHECK(static_cast<coil::i8>(data[32]) == -33);
+        
+        const coil::Symbol* end = result.object.getSymbol(result.object.getSymbolIndex("end"));
+        REQUIRE(end != nullptr);
+        CHECK(end->value == 33);
+        
+        // Label operands stay 4-byte fields: 33 + header + register + field
+        REQUIRE(data.size() == 33 + 4 + 1 + 4);
+        coil::i32 displacement = static_cast<coil::i32>(data[38] | (data[39] << 8) | (data[40] << 16) |
+                                                        (static_cast<coil::u32>(data[41]) << 24));
+        CHECK(displacement == -42);
+    }
+}
+
+TEST_CASE_METHOD(CoilTestFixture, "Memory offsets keep their full width", "[assembler]") {
+    std::string source = R"(
+        .section .text
+          load %r1, [%r2+4294967300]
+    )";
+    
+    SECTION("Compact offsets take 8 bytes") {
+        Assembler assembler;
+        Assembler::Options options;
+        options.compactEncoding = true;
+        assembler.setOptions(options);
+        
+        auto result = assembler.assembleSource(source, "test.casm");
+        CHECK(assembler.getErrors().empty());
+        
+        auto* text = dynamic_cast<const coil::DataSection*>(result.object.getSection(result.object.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        const auto& data = text->getData();
+        REQUIRE(data.size() == 4 + 1 + 16);
+        
+        // src1 width code 3: 8-byte base and offset
+        CHECK((data[3] >> 4 & 3) == 3);
+        coil::u64 offset = 0;
+        for (int i = 7; i >= 0; --i) {
+            offset = (offset << 8) | data[13 + i];
+        }
+        CHECK(offset == 4294967300ULL);
+    }
+    
+    SECTION("Offsets computed from symbols must fit their 32-bit field") {
+        Assembler assembler;
+        Assembler::Options options;
+        options.compactEncoding = true;
+        assembler.setOptions(options);
+        
+        assembler.assembleSource(R"(
+            .equ @BIG, $id5000000000
+            .section .text
+              load %r1, [%r2 + @BIG]
+        )", "test.casm");
+        const auto& errors = assembler.getErrors();
+        REQUIRE(errors.size() == 1);
+        CHECK(errors[0].find("32-bit") != std::string::npos);
+    }
+    
+    SECTION("The fixed encoding rejects offsets over 16 bits") {
+        std::vector<std::string> errors;
+        assembleString(source, &errors);
+        REQUIRE(errors.size() == 1);
+        CHECK(errors[0].find("16-bit") != std::string::npos);
+    }
+}
+
+TEST_CASE_METHOD(CoilTestFixture, "Expressions", "[assembler]") {
+    std::string source = R"(
+        .section .text
+        #start
+          mov %r1, $(@end - @start)
+          load %r2, [%r1 + @end - @start]
+          mov %r3, $((1 << 4) | 2)
+        #end
+          nop
+        .section .data
+        #table
+          .i32 $(@end - @start), $(2 * 8)
+    )";
+
+    auto readU32 = [](const std::vector<coil::u8>& data, size_t offset) {
+        return static_cast<coil::u32>(data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) |
+                                      (static_cast<coil::u32>(data[offset + 3]) << 24));
+    };
+
+    SECTION("Label differences are evaluated after layout") {
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        CHECK(errors.empty());
+
+        auto* text = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        const auto& code = text->getData();
+        REQUIRE(code.size() == 40);
+
+        // Three 12-byte instructions before #end
+        CHECK(readU32(code, 8) == 36);
+        CHECK((code[20] | (code[21] << 8)) == 1);
+        CHECK((code[22] | (code[23] << 8)) == 36);
+        CHECK(readU32(code, 32) == 18);
+
+        auto* data = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".data")));
+        REQUIRE(data != nullptr);
+        REQUIRE(data->getData().size() == 8);
+        CHECK(readU32(data->getData(), 0) == 36);
+        CHECK(readU32(data->getData(), 4) == 16);
+    }
+
+    SECTION("Symbol-dependent operands keep full width in the compact encoding") {
+        Assembler assembler;
+        Assembler::Options options;
+        options.compactEncoding = true;
+        assembler.setOptions(options);
+
+        auto result = assembler.assembleSource(source, "test.casm");
+        CHECK(assembler.getErrors().empty());
+
+        auto* text = dynamic_cast<const coil::DataSection*>(result.object.getSection(result.object.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        const auto& code = text->getData();
+
+        // mov: 1-byte register and 4-byte value; load: 4-byte base and offset
+        CHECK(code[3] == 0x20);
+        CHECK(readU32(code, 5) == 28);
+        CHECK(code[12] == 0x20);
+        CHECK(readU32(code, 14) == 1);
+        CHECK(readU32(code, 18) == 28);
+
+        // The folded constant still uses the smallest width
+        CHECK(code[27] == 18);
+    }
+
+    SECTION("Expressions must not depend on a label") {
+        std::vector<std::string> errors;
+        assembleString(R"(
+            .section .text
+            #start
+              mov %r1, $(@start + 4)
+        )", &errors);
+        REQUIRE_FALSE(errors.empty());
+        CHECK(errors[0].find("Labels in an expression") != std::string::npos);
+
+        errors.clear();
+        assembleString(R"(
+            .section .text
+            #start
+              mov %r1, $(@table - @start)
+            .section .data
+            #table
+              .i8 $id0
+        )", &errors);
+        CHECK_FALSE(errors.empty());
+
+        errors.clear();
+        assembleString(R"(
+            .section .text
+              mov %r1, $(@missing * 2)
+        )", &errors);
+        REQUIRE_FALSE(errors.empty());
+        CHECK(errors[0].find("Undefined symbol in expression: @missing") != std::string::npos);
+    }
+}
+
+TEST_CASE_METHOD(CoilTestFixture, "Constants", "[assembler]") {
+    auto readU32 = [](const std::vector<coil::u8>& data, size_t offset) {
+        return static_cast<coil::u32>(data[offset] | (data[offset + 1] << 8) | (data[offset + 2] << 16) |
+                                      (static_cast<coil::u32>(data[offset + 3]) << 24));
+    };
+
+    SECTION("Constants are substituted as immediates") {
+        std::string source = R"(
+            .section .text
+            .global @MASK
+            .equ @SIZE, $id64
+            .equ @MASK, $(@SIZE - 1)
+            .set @COUNT, $id1
+            #start
+              mov %r1, @SIZE
+              and %r2, %r2, @MASK
+              mov %r3, @COUNT
+            .set @COUNT, $(@COUNT + 1)
+              mov %r3, @COUNT
+              mov %r4, $(@LEN * 2)
+            #end nop
+            .equ @LEN, $(@end - @start)
+            .section .data
+              .i32 @SIZE, @LEN
+        )";
+
+        std::vector<std::string> errors;
+        coil::Object obj = assembleString(source, &errors);
+        CHECK(errors.empty());
+
+        auto* text = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        const auto& code = text->getData();
+        REQUIRE(code.size() == 68);
+
+        CHECK(code[0] == static_cast<coil::u8>(coil::Opcode::Mov));
+        CHECK(readU32(code, 8) == 64);
+        CHECK(readU32(code, 24) == 63);
+
+        // Each use sees the .set in effect at that point
+        CHECK(readU32(code, 36) == 1);
+        CHECK(readU32(code, 48) == 2);
+
+        // Constants may depend on labels and be used before their definition
+        CHECK(readU32(code, 60) == 128);
+
+        auto* data = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".data")));
+        REQUIRE(data != nullptr);
+        REQUIRE(data->getData().size() == 8);
+        CHECK(readU32(data->getData(), 0) == 64);
+        CHECK(readU32(data->getData(), 4) == 64);
+
+        // Only the exported constant becomes a symbol, and no relocations are needed
+        CHECK(obj.getSymbolIndex("SIZE") == 0);
+        CHECK(obj.getSymbolIndex("COUNT") == 0);
+        const coil::Symbol* mask = obj.getSymbol(obj.getSymbolIndex("MASK"));
+        REQUIRE(mask != nullptr);
+        CHECK(mask->value == 63);
+        CHECK(mask->section_index == Assembler::ABSOLUTE_SECTION_INDEX);
+        CHECK(obj.getSymbolIndex("start") != 0);
+    }
+
+    SECTION("Constants keep full width in the compact encoding") {
+        Assembler assembler;
+        Assembler::Options options;
+        options.compactEncoding = true;
+        assembler.setOptions(options);
+
+        auto result = assembler.assembleSource(R"(
+            .section .text
+            .equ @ONE, $id1
+              mov %r1, @ONE
+              mov %r1, $id1
+        )", "test.casm");
+        CHECK(assembler.getErrors().empty());
+
+        auto* text = dynamic_cast<const coil::DataSection*>(result.object.getSection(result.object.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        const auto& code = text->getData();
+        REQUIRE(code.size() == 9 + 6);
+        CHECK(readU32(code, 5) == 1);
+        CHECK(code[14] == 1);
+    }
+
+    SECTION("Invalid definitions") {
+        std::vector<std::string> errors;
+        assembleString(R"(
+            .equ @A, $id1
+            .equ @A, $id2
+        )", &errors);
+        REQUIRE_FALSE(errors.empty());
+        CHECK(errors[0].find("Symbol already defined: A") != std::string::npos);
+
+        errors.clear();
+        assembleString(R"(
+            .equ @A, $id1
+            .set @A, $id2
+        )", &errors);
+        CHECK_FALSE(errors.empty());
+
+        errors.clear();
+        assembleString(R"(
+            .section .text
+            #A nop
+            .equ @A, $id1
+        )", &errors);
+        CHECK_FALSE(errors.empty());
+
+        errors.clear();
+        assembleString(R"(
+            .equ @A, $fd1.5
+        )", &errors);
+        REQUIRE_FALSE(errors.empty());
+        CHECK(errors[0].find("Constant value must be an integer expression") != std::string::npos);
+
+        errors.clear();
+        assembleString(R"(
+            .equ @A, @B
+            .equ @B, @A
+            .section .text
+              mov %r1, @A
+        )", &errors);
+        REQUIRE_FALSE(errors.empty());
+        CHECK(errors[0].find("Circular constant definition") != std::string::npos);
+    }
+}
+
+TEST_CASE_METHOD(CoilTestFixture, "Optimization", "[assembler]") {
+    std::string source = R"(
+        .section .text
+        #start mov %r1, %r1
+        mul %r2, %r2, $id4
+        inc %r3
+        dec %r3
+        add %r4, %r4, $id0
+        cmp %r2, $id0
+        br ^eq @done
+        mov %r5, %r6
+        #done ret
+    )";
+    
+    SECTION("Rewrites are counted and shrink the code") {
+        Assembler plain;
+        coil::Object plainObj = plain.assembleSource(source, "test.casm").object;
+        REQUIRE(plain.getErrors().empty());
+        CHECK(plain.getOptimizationStats().total() == 0);
+        
+        Assembler::Options options;
+        options.optimize = true;
+        Assembler optimizing(options);
+        coil::Object obj = optimizing.assembleSource(source, "test.casm").object;
+        REQUIRE(optimizing.getErrors().empty());
+        
+        const OptimizationStats& stats = optimizing.getOptimizationStats();
+        CHECK(stats.selfMoves == 1);
+        CHECK(stats.strengthReductions == 1);
+        CHECK(stats.zeroCompares == 1);
+        CHECK(stats.incDecPairs == 1);
+        CHECK(stats.zeroArithmetic == 1);
+        
+        auto* plainText = dynamic_cast<const coil::DataSection*>(plainObj.getSection(plainObj.getSectionIndex(".text")));
+        auto* text = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(plainText != nullptr);
+        REQUIRE(text != nullptr);
+        
+        // shl, test, br, mov, ret remain
+        const auto& data = text->getData();
+        CHECK(plainText->getData().size() == 12 + 16 + 8 + 8 + 16 + 12 + 5 + 12 + 4);
+        REQUIRE(data.size() == 16 + 12 + 5 + 12 + 4);
+        CHECK(data[0] == static_cast<coil::u8>(coil::Opcode::Shl));
+        CHECK(data[16] == static_cast<coil::u8>(coil::Opcode::Test));
+        
+        // Labels follow the optimized layout: start moved to shl, the branch lands on ret
+        const coil::Symbol* start = obj.getSymbol(obj.getSymbolIndex("start"));
+        const coil::Symbol* done = obj.getSymbol(obj.getSymbolIndex("done"));
+        REQUIRE(start != nullptr);
+        REQUIRE(done != nullptr);
+        CHECK(start->value == 0);
+        CHECK(done->value == 45);
+        CHECK(static_cast<coil::i8>(data[32]) == 12);
+    }
+    
+    SECTION("Dead code is removed and symbols are compacted") {
+        std::string deadSource = R"(
+            .section .text
+            .global @main
+            #main
+              call @live
+              ret
+              nop
+            #dead_helper
+              push %r1
+              pop %r1
+              ret
+            #live
+              ret
+        )";
+        
+        // Keep the call to live rather than inlining it
+        Assembler::Options options;
+        options.optimize = true;
+        options.inlineLimit = 0;
+        Assembler optimizing(options);
+        coil::Object obj = optimizing.assembleSource(deadSource, "test.casm").object;
+        REQUIRE(optimizing.getErrors().empty());
+        
+        CHECK(optimizing.getOptimizationStats().deadInstructions == 4);
+        
+        auto* text = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        CHECK(text->getData().size() == 5 + 4 + 4);
+        
+        // live follows main directly, and the call reaches it
+        const coil::Symbol* live = obj.getSymbol(obj.getSymbolIndex("live"));
+        REQUIRE(live != nullptr);
+        CHECK(live->value == 9);
+        CHECK(static_cast<coil::i8>(text->getData()[4]) == 4);
+        CHECK(obj.getSymbolIndex("dead_helper") == 0);
+    }
+    
+    SECTION("Repeated loads are replaced by moves") {
+        std::string loadSource = R"(
+            .section .text
+            .global @main
+            #main
+              load %r1, [%r4+8]
+              load %r2, [%r4+8]
+              add %r3, %r1, %r2
+              ret
+        )";
+        
+        Assembler::Options options;
+        options.optimize = true;
+        Assembler optimizing(options);
+        coil::Object obj = optimizing.assembleSource(loadSource, "test.casm").object;
+        REQUIRE(optimizing.getErrors().empty());
+        
+        const OptimizationStats& stats = optimizing.getOptimizationStats();
+        CHECK(stats.redundantLoads == 1);
+        CHECK(stats.propagatedCopies == 1);
+        REQUIRE(stats.functionValues.size() == 1);
+        CHECK(stats.functionValues[0].function == "main");
+        
+        auto* text = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        CHECK(text->getData()[12] == static_cast<coil::u8>(coil::Opcode::Mov));
+    }
+}
+
+TEST_CASE_METHOD(CoilTestFixture, "Virtual registers", "[assembler]") {
+    SECTION("Virtual registers assemble like the registers assigned") {
+        std::string source = R"(
+            .section .text
+            .global @sum
+            #sum
+              mov %v1, %r1
+              mov %v2, $id0
+            #loop
+              add %v2, %v2, %v1
+              dec %v1
+              br ^neq @loop
+              mov %r1, %v2
+              ret
+        )";
+        std::string physical = R"(
+            .section .text
+            .global @sum
+            #sum
+              mov %r0, %r1
+              mov %r2, $id0
+            #loop
+              add %r2, %r2, %r0
+              dec %r0
+              br ^neq @loop
+              mov %r1, %r2
+              ret
+        )";
+        
+        Assembler assembler;
+        coil::Object obj = assembler.assembleSource(source, "test.casm").object;
+        REQUIRE(assembler.getErrors().empty());
+        
+        const auto& allocations = assembler.getRegisterAllocations();
+        REQUIRE(allocations.size() == 1);
+        CHECK(allocations[0].function == "sum");
+        CHECK(allocations[0].registers.at("v1") == "r0");
+        CHECK(allocations[0].registers.at("v2") == "r2");
+        CHECK(allocations[0].frameSize == 0);
+        
+        std::vector<std::string> errors;
+        coil::Object expected = assembleString(physical, &errors);
+        REQUIRE(errors.empty());
+        
+        auto* text = dynamic_cast<const coil::DataSection*>(obj.getSection(obj.getSectionIndex(".text")));
+        auto* expectedText = dynamic_cast<const coil::DataSection*>(expected.getSection(expected.getSectionIndex(".text")));
+        REQUIRE(text != nullptr);
+        REQUIRE(expectedText != nullptr);
+        CHECK(text->getData() == expectedText->getData());
+    }
+    
+    SECTION("Spill slots are reserved in .bss") {
+        std::string source = R"(
+            .section .text
+            .global @g
+            #g
+              mov %v1, $id1
+              mov %v2, $id2
+              mov %v3, $id3
+              add %v1, %v1, %v2
+              add %v1, %v1, %v3
+              push %v1
+              ret
+        )";
+        
+        Assembler::Options options;
+        options.registerCount = 2;
+        Assembler assembler(options);
+        coil::Object obj = assembler.assembleSource(source, "test.casm").object;
+        REQUIRE(assembler.getErrors().empty());
+        
+        const auto& allocations = assembler.getRegisterAllocations();
+        REQUIRE(allocations.size() == 1);
+        CHECK(allocations[0].frameSize > 0);
+        
+        auto* bss = obj.getSection(obj.getSectionIndex(".bss"));
+        REQUIRE(bss != nullptr);
+        CHECK(bss->getSectionType() == static_cast<coil::u8>(coil::SectionType::NoBits));
+        CHECK((bss->getHeader().flags & static_cast<uint16_t>(coil::SectionFlag::Write)) != 0);
+    }
+    
+    SECTION("The register file size is configurable") {
+        std::string source = R"(
+            .section .text
+            #f
+              mov %v1, $id1
+              ret
+        )";
+        
+        Assembler::Options options;
+        options.registerCount = 0;
+        Assembler assembler(options);
+        assembler.assembleSource(source, "test.casm");
+        REQUIRE(assembler.getErrors().size() == 1);
+        CHECK(assembler.getErrors()[0].find("Too few registers") != std::string::npos);
     }
 }
 
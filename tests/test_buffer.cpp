@@ -0,0 +1,91 @@
+#include <catch2/catch_all.hpp>
+#include "casm/buffer.hpp"
+#include <vector>
+
+using namespace Catch;
+
+TEST_CASE("Section buffer spans multiple pages", "[buffer]") {
+  casm::SectionBuffer buffer;
+  
+  // Append enough bytes to need several pages
+  std::vector<casm::u8> expected;
+  for (size_t i = 0; i < 3 * casm::SectionBuffer::MAX_PAGE_SIZE; ++i) {
+    expected.push_back(static_cast<casm::u8>(i * 7));
+  }
+  
+  for (size_t i = 0; i < expected.size(); i += 1000) {
+    size_t count = std::min<size_t>(1000, expected.size() - i);
+    buffer.append(expected.data() + i, count);
+  }
+  
+  REQUIRE(buffer.size() == expected.size());
+  CHECK(buffer.toVector() == expected);
+  
+  // Spans cover the buffer in order
+  size_t total = 0;
+  size_t spans = 0;
+  buffer.forEachSpan([&](const casm::u8*, size_t count) {
+    total += count;
+    ++spans;
+  });
+  CHECK(total == expected.size());
+  CHECK(spans > 1);
+}
+
+TEST_CASE("Section buffer keeps page addresses stable", "[buffer]") {
+  casm::SectionBuffer buffer;
+  buffer.push_back(42);
+  
+  const casm::u8* first = nullptr;
+  buffer.forEachSpan([&](const casm::u8* bytes, size_t) {
+    if (!first) {
+      first = bytes;
+    }
+  });
+  
+  std::vector<casm::u8> chunk(casm::SectionBuffer::MAX_PAGE_SIZE, 1);
+  buffer.append(chunk.data(), chunk.size());
+  buffer.append(chunk.data(), chunk.size());
+  
+  const casm::u8* after = nullptr;
+  buffer.forEachSpan([&](const casm::u8* bytes, size_t) {
+    if (!after) {
+      after = bytes;
+    }
+  });
+  
+  CHECK(first == after);
+  CHECK(buffer[0] == 42);
+}
+
+TEST_CASE("Section buffer patches across page boundaries", "[buffer]") {
+  casm::SectionBuffer buffer;
+  buffer.reserve(8);
+  
+  std::vector<casm::u8> zeros(casm::SectionBuffer::MIN_PAGE_SIZE, 0);
+  buffer.append(zeros.data(), zeros.size());
+  buffer.append(zeros.data(), zeros.size());
+  
+  // Patch four bytes straddling the first page boundary
+  const casm::u8 value[4] = {0x11, 0x22, 0x33, 0x44};
+  size_t boundary = 0;
+  buffer.forEachSpan([&](const casm::u8*, size_t count) {
+    if (boundary == 0) {
+      boundary = count;
+    }
+  });
+  REQUIRE(boundary < buffer.size());
+  buffer.patch(boundary - 2, value, 4);
+  
+  casm::u8 readBack[4] = {};
+  buffer.read(boundary - 2, readBack, 4);
+  CHECK(readBack[0] == 0x11);
+  CHECK(readBack[1] == 0x22);
+  CHECK(readBack[2] == 0x33);
+  CHECK(readBack[3] == 0x44);
+  CHECK(buffer[boundary - 3] == 0);
+  CHECK(buffer[boundary + 2] == 0);
+  
+  // Patching past the end is rejected
+  CHECK_THROWS_AS(buffer.patch(buffer.size() - 2, value, 4), std::out_of_range);
+}
@@ -0,0 +1,147 @@
+#include <catch2/catch_all.hpp>
+#include "casm/lexer.hpp"
+#include "casm/parser.hpp"
+#include "casm/cfg.hpp"
+#include <string>
+#include <vector>
+
+using namespace Catch;
+
+namespace {
+
+std::vector<casm::Statement> parseSource(const std::string& source) {
+  casm::Lexer lexer("test", source);
+  casm::Parser parser(lexer);
+  std::vector<casm::Statement> statements = parser.parse();
+  REQUIRE(parser.getErrors().empty());
+  return statements;
+}
+
+const std::string FACTORIAL = R"(
+.section .text
+.global @main
+
+#main
+  mov %r1, $id5
+  call @factorial
+  ret
+
+#factorial
+  cmp %r1, $id0
+  br ^eq @base_case
+  push %r1
+  dec %r1
+  call @factorial
+  pop %r1
+  ret
+
+#base_case
+  mov %r1, $id1
+  ret
+
+.section .data
+#result
+  .i32 $id0
+)";
+
+} // namespace
+
+TEST_CASE("Functions start at exported and called labels", "[cfg]") {
+  auto statements = parseSource(FACTORIAL);
+
+  auto entries = casm::ControlFlowGraph::functionEntries(statements);
+  CHECK(entries.size() == 2);
+  CHECK(entries.count("main") == 1);
+  CHECK(entries.count("factorial") == 1);
+
+  auto graph = casm::ControlFlowGraph::build(statements);
+  const auto& functions = graph.getFunctions();
+  REQUIRE(functions.size() == 2);
+
+  size_t main = graph.findFunction("main");
+  REQUIRE(main != casm::ControlFlowGraph::NO_FUNCTION);
+  CHECK(functions[main].section == ".text");
+  CHECK(functions[main].blocks.size() == 1);
+  REQUIRE(functions[main].callees.size() == 1);
+  CHECK(functions[main].callees[0] == "factorial");
+
+  // Data labels are not part of the graph
+  CHECK(graph.findFunction("base_case") == casm::ControlFlowGraph::NO_FUNCTION);
+  CHECK(graph.findBlock("result") == casm::ControlFlowGraph::NO_BLOCK);
+}
+
+TEST_CASE("Blocks split at labels and control transfers", "[cfg]") {
+  auto statements = parseSource(FACTORIAL);
+  auto graph = casm::ControlFlowGraph::build(statements);
+  const auto& blocks = graph.getBlocks();
+
+  const casm::Function& factorial = graph.getFunctions()[graph.findFunction("factorial")];
+  REQUIRE(factorial.blocks.size() == 3);
+
+  // cmp/br, then the recursive case, then the base case
+  const casm::BasicBlock& entry = blocks[factorial.blocks[0]];
+  const casm::BasicBlock& recurse = blocks[factorial.blocks[1]];
+  const casm::BasicBlock& base = blocks[factorial.blocks[2]];
+
+  REQUIRE(entry.labels.size() == 1);
+  CHECK(entry.labels[0] == "factorial");
+  CHECK(entry.successors.size() == 2);
+  CHECK(entry.predecessors.empty());
+
+  CHECK(recurse.labels.empty());
+  CHECK(recurse.successors.empty());
+  CHECK(recurse.returns);
+  REQUIRE(recurse.predecessors.size() == 1);
+  CHECK(recurse.predecessors[0] == factorial.blocks[0]);
+
+  CHECK(graph.findBlock("base_case") == factorial.blocks[2]);
+  CHECK(base.predecessors.size() == 1);
+  CHECK(base.returns);
+
+  // Every statement in a block maps back to it
+  for (size_t id : factorial.blocks) {
+    for (size_t i = blocks[id].begin; i < blocks[id].end; ++i) {
+      if (statements[i].getType() != casm::Statement::Type::Empty) {
+        CHECK(graph.blockOf(i) == id);
+      }
+    }
+  }
+}
+
+TEST_CASE("Edges leaving a function are recorded as exits", "[cfg]") {
+  auto statements = parseSource(R"(
+    .global @helper
+    nop
+  #loop
+    dec %r1
+    br ^neq @loop
+    jmp @helper
+  #helper
+    jmp %r2
+  )");
+
+  auto graph = casm::ControlFlowGraph::build(statements);
+  const auto& functions = graph.getFunctions();
+  const auto& blocks = graph.getBlocks();
+  REQUIRE(functions.size() == 2);
+
+  // Code before the first entry label forms an unnamed function
+  const casm::Function& prologue = functions[0];
+  CHECK(prologue.name.empty());
+  REQUIRE(prologue.blocks.size() == 3);
+
+  const casm::BasicBlock& loop = blocks[prologue.blocks[1]];
+  CHECK(loop.successors.size() == 2);
+  CHECK(loop.predecessors.size() == 2);
+
+  // The tail jump leaves the function
+  const casm::BasicBlock& tail = blocks[prologue.blocks[2]];
+  CHECK(tail.successors.empty());
+  REQUIRE(tail.exits.size() == 1);
+  CHECK(tail.exits[0] == "helper");
+
+  const casm::BasicBlock& helper = blocks[functions[graph.findFunction("helper")].blocks[0]];
+  CHECK(helper.indirect);
+  CHECK(helper.successors.empty());
+  CHECK_FALSE(helper.fallsOut);
+}
@@ -0,0 +1,157 @@
+#include <catch2/catch_all.hpp>
+#include "casm/expression.hpp"
+#include "casm/token.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace Catch;
+
+namespace {
+
+casm::i64 evaluate(const std::string& text, const std::map<std::string, casm::SymbolValue>& symbols = {}) {
+  casm::ExpressionPtr expr = casm::Expression::parse(text);
+  REQUIRE(expr);
+  return expr->evaluate([&symbols](const std::string& name) -> std::optional<casm::SymbolValue> {
+    auto it = symbols.find(name);
+    if (it == symbols.end()) {
+      return std::nullopt;
+    }
+    return it->second;
+  });
+}
+
+} // namespace
+
+TEST_CASE("Expression parsing", "[expression]") {
+  SECTION("Precedence and associativity") {
+    CHECK(evaluate("1 + 2 * 3") == 7);
+    CHECK(evaluate("(1 + 2) * 3") == 9);
+    CHECK(evaluate("10 - 4 - 3") == 3);
+    CHECK(evaluate("100 / 10 / 5") == 2);
+    CHECK(evaluate("1 << 4 + 1") == 32);
+    CHECK(evaluate("0xF0 | 0x0F & 0x3C") == 0xFC);
+    CHECK(evaluate("6 ^ 3 & 1") == 7);
+  }
+
+  SECTION("Literals") {
+    CHECK(evaluate("0x10") == 16);
+    CHECK(evaluate("0b101") == 5);
+    CHECK(evaluate("0o17") == 15);
+    CHECK(evaluate("ix2A") == 42);
+    CHECK(evaluate("id12") == 12);
+    CHECK(evaluate("ib11") == 3);
+  }
+
+  SECTION("Unary operators") {
+    CHECK(evaluate("-5 + 2") == -3);
+    CHECK(evaluate("~0") == -1);
+    CHECK(evaluate("-(2 * 3)") == -6);
+    CHECK(evaluate("+4") == 4);
+    CHECK(evaluate("-16 >> 2") == -4);
+  }
+
+  SECTION("Invalid expressions") {
+    CHECK_FALSE(casm::Expression::parse(""));
+    CHECK_FALSE(casm::Expression::parse("1 +"));
+    CHECK_FALSE(casm::Expression::parse("(1 + 2"));
+    CHECK_FALSE(casm::Expression::parse("1 2"));
+    CHECK_FALSE(casm::Expression::parse("@"));
+    CHECK_FALSE(casm::Expression::parse("0xZZ"));
+  }
+
+  SECTION("Formatting") {
+    casm::ExpressionPtr expr = casm::Expression::parse("@end - @start + 4 * -2");
+    REQUIRE(expr);
+    CHECK(expr->toString() == "((@end - @start) + (4 * -2))");
+  }
+}
+
+TEST_CASE("Expression evaluation", "[expression]") {
+  const std::map<std::string, casm::SymbolValue> symbols = {
+    {"start", {0x10, 0}},
+    {"end", {0x38, 0}},
+    {"data", {0x8, 1}},
+    {"SIZE", {64, casm::SymbolValue::ABSOLUTE}},
+  };
+
+  SECTION("Label differences within a section") {
+    CHECK(evaluate("@end - @start", symbols) == 0x28);
+    CHECK(evaluate("(@end - @start) / 4", symbols) == 10);
+    CHECK(evaluate("@end + 8 - @start", symbols) == 0x30);
+    CHECK(evaluate("@SIZE * 2", symbols) == 128);
+  }
+
+  SECTION("Results must not depend on a label") {
+    CHECK_THROWS_AS(evaluate("@start", symbols), casm::ExpressionException);
+    CHECK_THROWS_AS(evaluate("@start + 4", symbols), casm::ExpressionException);
+    CHECK_THROWS_AS(evaluate("@data - @start", symbols), casm::ExpressionException);
+    CHECK_THROWS_AS(evaluate("@start * 2 - @end", symbols), casm::ExpressionException);
+    CHECK_THROWS_AS(evaluate("@start + @end", symbols), casm::ExpressionException);
+  }
+
+  SECTION("Errors") {
+    CHECK_THROWS_AS(evaluate("@missing + 1", symbols), casm::ExpressionException);
+    CHECK_THROWS_AS(evaluate("1 / 0"), casm::ExpressionException);
+    CHECK_THROWS_AS(evaluate("1 % (2 - 2)"), casm::ExpressionException);
+    CHECK_THROWS_AS(evaluate("1 << 64"), casm::ExpressionException);
+    CHECK_THROWS_AS(evaluate("1 >> -1"), casm::ExpressionException);
+  }
+
+  SECTION("Wrapping arithmetic") {
+    CHECK(evaluate("0x7FFFFFFFFFFFFFFF + 1") == INT64_MIN);
+    CHECK(evaluate("-0x8000000000000000 / -1") == INT64_MIN);
+  }
+
+  SECTION("Symbols and constants") {
+    casm::ExpressionPtr expr = casm::Expression::parse("(@a - @b) * @a");
+    REQUIRE(expr);
+    std::vector<std::string> names;
+    expr->forEachSymbol([&names](const std::string& name) { names.push_back(name); });
+    CHECK(names == std::vector<std::string>{"a", "b", "a"});
+    CHECK_FALSE(expr->constantValue());
+    CHECK(casm::Expression::parse("3 * 7")->constantValue() == 21);
+  }
+}
+
+TEST_CASE("Expression operands", "[expression]") {
+  SECTION("Constant immediates fold to integers") {
+    auto value = casm::parseImmediate("$(4 * 8 + 1)");
+    REQUIRE(value);
+    CHECK(value->format == casm::ImmediateFormat::Integer);
+    CHECK(std::get<casm::i64>(value->value) == 33);
+  }
+
+  SECTION("Symbolic immediates keep the expression") {
+    auto value = casm::parseImmediate("$(@end - @start)");
+    REQUIRE(value);
+    CHECK(value->format == casm::ImmediateFormat::Expression);
+    CHECK(value->toString() == "Expression((@end - @start))");
+  }
+
+  SECTION("Invalid immediates") {
+    CHECK_FALSE(casm::parseImmediate("$(1 +)"));
+    CHECK_FALSE(casm::parseImmediate("$(1 / 0)"));
+  }
+
+  SECTION("Memory offsets") {
+    auto folded = casm::parseMemoryRef("[%r1 + 4 * 8]");
+    REQUIRE(folded);
+    CHECK(folded->reg == "r1");
+    CHECK(folded->offset == 32);
+    CHECK_FALSE(folded->offsetExpr);
+
+    auto negative = casm::parseMemoryRef("[%r2-8]");
+    REQUIRE(negative);
+    CHECK(negative->offset == -8);
+
+    auto symbolic = casm::parseMemoryRef("[%r3 + @field - @base]");
+    REQUIRE(symbolic);
+    CHECK(symbolic->reg == "r3");
+    REQUIRE(symbolic->offsetExpr);
+    CHECK(symbolic->offsetExpr->toString() == "((0 + @field) - @base)");
+
+    CHECK_FALSE(casm::parseMemoryRef("[%r1 8]"));
+    CHECK_FALSE(casm::parseMemoryRef("[%r1 + ]"));
+  }
+}
@@ -61,6 +61,28 @@ TEST_CASE("Lexer tokenizes basic instructions", "[lexer]") {
   CHECK(filtered[15].value == "$id42");
 }
 
+TEST_CASE("Lexer tokenizes virtual registers", "[lexer]") {
+  casm::Lexer lexer("test", "add %v12, %v3, %r1\nmov %x1, %v\n");
+  std::vector<casm::Token> tokens = lexer.tokenize();
+  
+  REQUIRE(tokens.size() >= 6);
+  CHECK(tokens[1].type == casm::TokenType::Register);
+  CHECK(tokens[1].value == "v12");
+  CHECK(tokens[3].type == casm::TokenType::Register);
+  CHECK(tokens[3].value == "v3");
+  CHECK(tokens[5].type == casm::TokenType::Register);
+  CHECK(tokens[5].value == "r1");
+  
+  // Other prefixes, and a prefix without a number, are rejected
+  size_t errors = 0;
+  for (const auto& token : tokens) {
+    if (token.type == casm::TokenType::Error) {
+      ++errors;
+    }
+  }
+  CHECK(errors == 2);
+}
+
 TEST_CASE("Lexer tokenizes labels and directives", "[lexer]") {
   std::string source = R"(
     .section .text     ; Start text section
@@ -273,6 +295,13 @@ TEST_CASE("Lexer tokenizes data directives", "[lexer]") {
   CHECK(directives[3].value == "ascii");
   CHECK(directives[4].value == "asciiz");
   
+  // Directive kinds are resolved by the lexer
+  CHECK(directives[0].directiveKind == casm::DirectiveKind::Section);
+  CHECK(directives[1].directiveKind == casm::DirectiveKind::I32);
+  CHECK(directives[2].directiveKind == casm::DirectiveKind::F64);
+  CHECK(directives[3].directiveKind == casm::DirectiveKind::Ascii);
+  CHECK(directives[4].directiveKind == casm::DirectiveKind::Asciiz);
+  
   // Find string literals
   std::vector<casm::Token> strings;
   for (const auto& token : tokens) {
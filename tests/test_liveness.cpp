@@ -0,0 +1,89 @@
+#include <catch2/catch_all.hpp>
+#include "casm/lexer.hpp"
+#include "casm/parser.hpp"
+#include "casm/cfg.hpp"
+#include "casm/liveness.hpp"
+#include <string>
+#include <vector>
+
+using namespace Catch;
+
+namespace {
+
+std::vector<casm::Statement> parseSource(const std::string& source) {
+  casm::Lexer lexer("test", source);
+  casm::Parser parser(lexer);
+  std::vector<casm::Statement> statements = parser.parse();
+  REQUIRE(parser.getErrors().empty());
+  return statements;
+}
+
+// Index of the n-th instruction
+size_t instructionIndex(const std::vector<casm::Statement>& statements, size_t n) {
+  for (size_t i = 0; i < statements.size(); ++i) {
+    if (statements[i].getInstruction() && n-- == 0) {
+      return i;
+    }
+  }
+  FAIL("No such instruction");
+  return 0;
+}
+
+} // namespace
+
+TEST_CASE("Liveness within a block", "[liveness]") {
+  auto statements = parseSource(R"(
+    .global @f
+    #f
+      mov %r1, $id1
+      mov %r2, $id2
+      add %r3, %r1, %r1
+      mov %r2, %r3
+      cmp %r2, $id0
+      ret
+  )");
+
+  auto graph = casm::ControlFlowGraph::build(statements);
+  auto liveness = casm::Liveness::analyze(statements, graph);
+
+  // The first value of r2 is overwritten before it is read
+  CHECK(liveness.isLiveAfter(instructionIndex(statements, 0), "r1"));
+  CHECK_FALSE(liveness.isLiveAfter(instructionIndex(statements, 1), "r2"));
+  CHECK(liveness.isLiveAfter(instructionIndex(statements, 3), "r2"));
+
+  // Every register and the flags are live at the ret, since the caller may read them
+  const casm::RegisterSet& last = liveness.liveAfter(instructionIndex(statements, 4));
+  CHECK(last == casm::RegisterSet{"r1", "r2", "r3", casm::Liveness::FLAGS});
+}
+
+TEST_CASE("Liveness across blocks", "[liveness]") {
+  auto statements = parseSource(R"(
+    .global @loop
+    #loop
+      mov %r1, $id10
+      mov %r2, $id0
+    #top
+      add %r2, %r2, %r1
+      dec %r1
+      br ^neq @top
+      mov %r1, %r2
+      mov %r2, %r1
+      call @loop
+      ret
+  )");
+
+  auto graph = casm::ControlFlowGraph::build(statements);
+  auto liveness = casm::Liveness::analyze(statements, graph);
+
+  // The loop carries r1 and r2 around the back edge, and the branch reads the flags
+  size_t top = graph.findBlock("top");
+  REQUIRE(top != casm::ControlFlowGraph::NO_BLOCK);
+  CHECK(liveness.liveIn(top) == casm::RegisterSet{"r1", "r2"});
+  CHECK(liveness.liveOut(top).count("r2") == 1);
+  CHECK(liveness.isLiveAfter(instructionIndex(statements, 3), casm::Liveness::FLAGS));
+
+  // A call may read any register
+  CHECK(liveness.isLiveAfter(instructionIndex(statements, 5), "r1"));
+  CHECK(liveness.isLiveAfter(instructionIndex(statements, 6), "r1"));
+  CHECK(liveness.isLiveAfter(instructionIndex(statements, 6), "r2"));
+}
@@ -0,0 +1,861 @@
+#include <catch2/catch_all.hpp>
+#include "casm/lexer.hpp"
+#include "casm/parser.hpp"
+#include "casm/optimizer.hpp"
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Catch;
+
+namespace {
+
+std::vector<casm::Statement> parseSource(const std::string& source) {
+  casm::Lexer lexer("test", source);
+  casm::Parser parser(lexer);
+  std::vector<casm::Statement> statements = parser.parse();
+  REQUIRE(parser.getErrors().empty());
+  return statements;
+}
+
+// Operand in source syntax, with immediates printed in decimal
+std::string operandText(const casm::Operand& operand) {
+  if (operand.getType() == casm::Operand::Type::Register) {
+    return "%" + static_cast<const casm::RegisterOperand&>(operand).getName();
+  }
+  if (operand.getType() == casm::Operand::Type::Immediate) {
+    const casm::ImmediateValue& value = static_cast<const casm::ImmediateOperand&>(operand).getValue();
+    if (value.format == casm::ImmediateFormat::Integer) {
+      return "$id" + std::to_string(std::get<casm::i64>(value.value));
+    }
+  }
+  return operand.toString();
+}
+
+// One line per non-empty statement: "label:", "name op, op" or "label: name op, op"
+std::vector<std::string> listing(const std::vector<casm::Statement>& statements) {
+  std::vector<std::string> lines;
+  for (const auto& stmt : statements) {
+    if (stmt.getType() == casm::Statement::Type::Empty) {
+      continue;
+    }
+
+    std::string line = stmt.getLabel().empty() ? "" : stmt.getLabel() + ":";
+    if (const casm::Instruction* instr = stmt.getInstruction()) {
+      line += (line.empty() ? "" : " ") + instr->getName();
+      const auto& operands = instr->getOperands();
+      for (size_t i = 0; i < operands.size(); ++i) {
+        line += (i == 0 ? " " : ", ") + operandText(*operands[i]);
+      }
+    } else if (const casm::Directive* directive = stmt.getDirective()) {
+      line += (line.empty() ? "." : " .") + directive->getName();
+    }
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+} // namespace
+
+TEST_CASE("Peephole removes instructions without effect", "[optimizer]") {
+  auto statements = parseSource(R"(
+    mov %r1, %r1
+    add %r2, $id0
+    sub %r3, %r3, $id0
+    add %r4, %r5, $id0
+    mov %r1, %r2
+    cmp %r1, $id1
+  )");
+
+  casm::Optimizer optimizer;
+  CHECK(optimizer.peephole(statements) == 4);
+  CHECK(optimizer.getStats().selfMoves == 1);
+  CHECK(optimizer.getStats().zeroArithmetic == 3);
+
+  auto lines = listing(statements);
+  REQUIRE(lines.size() == 3);
+  CHECK(lines[0] == "mov %r4, %r5");
+  CHECK(lines[1] == "mov %r1, %r2");
+  CHECK(lines[2] == "cmp %r1, $id1");
+}
+
+TEST_CASE("Peephole strength-reduces multiplication and comparison", "[optimizer]") {
+  auto statements = parseSource(R"(
+    mul %r1, %r2, $id8
+    mul %r3, $id2
+    mul %r4, %r4, $id6
+    cmp %r5, $id0
+    cmp %r5, $id1
+  )");
+
+  casm::Optimizer optimizer;
+  CHECK(optimizer.peephole(statements) == 3);
+  CHECK(optimizer.getStats().strengthReductions == 2);
+  CHECK(optimizer.getStats().zeroCompares == 1);
+
+  auto lines = listing(statements);
+  REQUIRE(lines.size() == 5);
+  CHECK(lines[0] == "shl %r1, %r2, $id3");
+  CHECK(lines[1] == "shl %r3, $id1");
+  CHECK(lines[2] == "mul %r4, %r4, $id6");
+  CHECK(lines[3] == "test %r5, %r5");
+  CHECK(lines[4] == "cmp %r5, $id1");
+}
+
+TEST_CASE("Peephole folds inc/dec pairs within a run", "[optimizer]") {
+  auto statements = parseSource(R"(
+    inc %r1
+    inc %r1
+    mov %r2, %r2
+    dec %r1
+    dec %r1
+    inc %r2
+    dec %r3
+    inc %r4
+    #next dec %r4
+  )");
+
+  casm::Optimizer optimizer;
+  optimizer.peephole(statements);
+  CHECK(optimizer.getStats().incDecPairs == 2);
+
+  // A labelled instruction can be entered from elsewhere, so it is not folded
+  auto lines = listing(statements);
+  REQUIRE(lines.size() == 4);
+  CHECK(lines[0] == "inc %r2");
+  CHECK(lines[1] == "dec %r3");
+  CHECK(lines[2] == "inc %r4");
+  CHECK(lines[3] == "next: dec %r4");
+}
+
+TEST_CASE("Peephole keeps labels of removed instructions", "[optimizer]") {
+  auto statements = parseSource(R"(
+    #start mov %r1, %r1
+    nop
+    #loop inc %r2
+    dec %r2
+    cmp %r2, $id1
+    .section .data
+  )");
+
+  casm::Optimizer optimizer;
+  CHECK(optimizer.run(statements).total() == 2);
+
+  // The first label moves to the next instruction, the second stays in place
+  auto lines = listing(statements);
+  REQUIRE(lines.size() == 4);
+  CHECK(lines[0] == "start: nop");
+  CHECK(lines[1] == "loop:");
+  CHECK(lines[2] == "cmp %r2, $id1");
+  CHECK(lines[3] == ".section");
+}
+
+TEST_CASE("Peephole keeps rewrites whose flags are read", "[optimizer]") {
+  const std::string source = R"(
+    add %r1, $id0
+    br ^eq @z
+    mul %r2, $id4
+    br ^lt @z
+    inc %r3
+    dec %r3
+    br ^neq @z
+  #z
+    nop
+  )";
+  auto statements = parseSource(source);
+
+  casm::Optimizer optimizer;
+  CHECK(optimizer.peephole(statements) == 0);
+  CHECK(listing(statements) == listing(parseSource(source)));
+}
+
+TEST_CASE("Dead code after unconditional transfers is removed", "[optimizer]") {
+  auto statements = parseSource(R"(
+    .global @main
+  #main
+    br ^eq @skip
+    jmp @done
+    inc %r1
+  #orphan
+    dec %r1
+  #skip
+    nop
+  #done
+    ret
+    mov %r2, %r3
+  )");
+
+  casm::Optimizer optimizer;
+  CHECK(optimizer.eliminateDeadCode(statements) == 4);
+  CHECK(optimizer.getStats().unreachableBlocks == 3);
+  CHECK(optimizer.getStats().deadInstructions == 3);
+  CHECK(optimizer.getStats().deadFunctions == 0);
+
+  auto lines = listing(statements);
+  REQUIRE(lines.size() == 8);
+  CHECK(lines[0] == ".global");
+  CHECK(lines[1] == "main:");
+  CHECK(lines[2] == "br @skip");
+  CHECK(lines[3] == "jmp @done");
+  CHECK(lines[4] == "skip:");
+  CHECK(lines[5] == "nop");
+  CHECK(lines[6] == "done:");
+  CHECK(lines[7] == "ret");
+}
+
+TEST_CASE("Unreferenced local functions are removed", "[optimizer]") {
+  auto statements = parseSource(R"(
+    .global @main
+  #main
+    call @used
+    ret
+  #used
+    ret
+  #unused
+    call @helper
+    call @stub
+    ret
+  #helper
+    ret
+    .align $id8
+  #stub
+    ret
+    .section .data
+    .i32 @stub
+  )");
+
+  // unused is never called, helper only from unused; stub is referenced from data
+  casm::Optimizer optimizer;
+  CHECK(optimizer.eliminateDeadCode(statements) == 6);
+  CHECK(optimizer.getStats().deadFunctions == 1);
+  CHECK(optimizer.getStats().unreachableBlocks == 2);
+
+  // The alignment still applies to the code after it
+  auto lines = listing(statements);
+  REQUIRE(lines.size() == 11);
+  CHECK(lines[4] == "used:");
+  CHECK(lines[5] == "ret");
+  CHECK(lines[6] == ".align");
+  CHECK(lines[7] == "stub:");
+  CHECK(lines[8] == "ret");
+}
+
+TEST_CASE("Falling out of a function keeps the next one", "[optimizer]") {
+  auto statements = parseSource(R"(
+    .global @main
+  #main
+    call @first
+    ret
+  #first
+    inc %r1
+    .section .data
+    .i32 $id0
+    .section .text
+  #second
+    dec %r1
+    ret
+  #unused
+    call @second
+    ret
+  )");
+
+  // second is only entered by falling out of first, in the same section
+  casm::Optimizer optimizer;
+  CHECK(optimizer.eliminateDeadCode(statements) == 3);
+  CHECK(optimizer.getStats().unreachableBlocks == 1);
+  CHECK(optimizer.getStats().deadFunctions == 0);
+
+  auto lines = listing(statements);
+  REQUIRE(lines.size() == 12);
+  CHECK(lines[9] == "second:");
+  CHECK(lines.back() == "ret");
+}
+
+TEST_CASE("Constants keep the labels they measure", "[optimizer]") {
+  const std::string source = R"(
+    .global @main
+  #main
+    ret
+  #dead
+    nop
+  #dead_end .equ @SIZE, $((@dead_end - @dead))
+    ret
+  )";
+  auto statements = parseSource(source);
+
+  // The .equ is kept, so the unreachable blocks whose labels it uses stay too
+  casm::Optimizer optimizer;
+  CHECK(optimizer.eliminateDeadCode(statements) == 0);
+  CHECK(listing(statements) == listing(parseSource(source)));
+}
+
+TEST_CASE("Value numbering removes recomputed values", "[optimizer]") {
+  SECTION("Arithmetic on the same values") {
+    auto statements = parseSource(R"(
+      .global @f
+      #f
+        add %r3, %r1, %r2
+        add %r4, %r2, %r1
+        mul %r5, %r3, %r4
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.numberValues(statements) == 2);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "f:", "add %r3, %r1, %r2", "mov %r4, %r3", "mul %r5, %r3, %r3", "ret"});
+
+    const auto& stats = optimizer.getStats();
+    CHECK(stats.redundantComputations == 1);
+    CHECK(stats.propagatedCopies == 1);
+    REQUIRE(stats.functionValues.size() == 1);
+    CHECK(stats.functionValues[0].function == "f");
+    CHECK(stats.functionValues[0].computations == 1);
+    CHECK(stats.functionValues[0].copies == 1);
+  }
+
+  SECTION("Loads with no store in between") {
+    auto statements = parseSource(R"(
+      .global @main
+      #main
+        load %r1, @input
+        load %r2, @input
+        load %r3, [%r4+8]
+        add %r1, %r1, %r3
+        load %r5, [%r4+8]
+        store [%r6], %r5
+        load %r7, [%r4+8]
+        load %r8, [%r6]
+        load %r9, @input
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    optimizer.numberValues(statements);
+    auto lines = listing(statements);
+    REQUIRE(lines.size() == 12);
+    CHECK(lines[3] == "mov %r2, %r1");
+    CHECK(lines[6] == "mov %r5, %r3");
+    CHECK(lines[7].rfind("store", 0) == 0);
+    CHECK(lines[7].find(", %r3") != std::string::npos);
+    CHECK(lines[8].rfind("load %r7", 0) == 0);
+    CHECK(lines[9] == "mov %r8, %r3");
+    CHECK(lines[10] == "load %r9, @input");
+
+    const auto& stats = optimizer.getStats();
+    CHECK(stats.redundantLoads == 3);
+    CHECK(stats.propagatedCopies == 1);
+    CHECK(stats.redundantComputations == 0);
+  }
+
+  SECTION("Flags, calls and block boundaries") {
+    auto statements = parseSource(R"(
+      .global @g
+      #g
+        sub %r3, %r1, %r2
+        sub %r4, %r1, %r2
+        br ^eq @done
+        mov %r5, %r1
+        mov %r5, %r1
+        call @g
+        mov %r5, %r1
+      #done
+        mov %r5, %r1
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.numberValues(statements) == 1);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "g:", "sub %r3, %r1, %r2", "sub %r4, %r1, %r2", "br @done", "mov %r5, %r1",
+      "call @g", "mov %r5, %r1", "done:", "mov %r5, %r1", "ret"});
+    CHECK(optimizer.getStats().propagatedCopies == 1);
+  }
+  SECTION("Immediates are numbered with their type") {
+    auto statements = parseSource(R"(
+      .global @h
+      #h
+        mov %r1, $id65
+        mov %r1, $ix41
+        mov %r1, $'A'
+        mov %r1, $fd65.0
+        mov %r2, $id4294967361
+        mov %r2, $id65
+        ret
+    )");
+
+    // Only an integer of the same value and width is the value r1 already holds
+    casm::Optimizer optimizer;
+    CHECK(optimizer.numberValues(statements) == 1);
+    auto lines = listing(statements);
+    REQUIRE(lines.size() == 8);
+    CHECK(lines[2] == "mov %r1, $id65");
+    CHECK(lines[3].rfind("mov %r1, $Char", 0) == 0);
+    CHECK(lines[4].rfind("mov %r1, $Float", 0) == 0);
+    CHECK(lines[5] == "mov %r2, $id4294967361");
+    CHECK(lines[6] == "mov %r2, $id65");
+  }
+}
+
+TEST_CASE("Dead stores are removed", "[optimizer]") {
+  SECTION("Writes that are never read") {
+    auto statements = parseSource(R"(
+      .global @f
+      #f
+        mov %r1, $id1
+        mov %r2, $id2
+        add %r3, %r1, %r1
+        mov %r2, %r3
+        cmp %r2, $id0
+        mov %r4, $id1
+        add %r5, %r4, $id2
+        mov %r5, $id0
+        mov %r4, $id0
+        sub %r6, %r6, $id1
+        mov %r6, $id0
+        br ^eq @f
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.eliminateDeadStores(statements) == 4);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "f:", "mov %r1, $id1", "add %r3, %r1, %r1", "mov %r2, %r3", "mov %r5, $id0",
+      "mov %r4, $id0", "sub %r6, %r6, $id1", "mov %r6, $id0", "br @f", "ret"});
+    CHECK(optimizer.getStats().deadStores == 4);
+  }
+
+  SECTION("Flags reaching a ret or call are kept") {
+    const std::string source = R"(
+      .global @f
+      #f
+        load %r1, @x
+        cmp %r1, $id5
+        ret
+      .global @g
+      #g
+        cmp %r1, $id0
+        call @f
+        ret
+    )";
+    auto statements = parseSource(source);
+
+    // The caller of f and the callee of g may branch on the flags
+    casm::Optimizer optimizer;
+    CHECK(optimizer.eliminateDeadStores(statements) == 0);
+    CHECK(listing(statements) == listing(parseSource(source)));
+  }
+
+  SECTION("Saves of registers dead after the restore") {
+    auto statements = parseSource(R"(
+      .global @g
+      #g
+        push %r1
+        push %r2
+        call @h
+        pop %r2
+        pop %r1
+        mov %r2, $id0
+        push %r3
+        load %r4, [%r5]
+        pop %r3
+        mov %r3, $id0
+        ret
+      #h
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.eliminateDeadStores(statements) == 1);
+
+    // r1 is live at the ret; the load may read the stack, so r3 stays saved
+    auto lines = listing(statements);
+    REQUIRE(lines.size() == 13);
+    CHECK(std::vector<std::string>(lines.begin() + 2, lines.begin() + 7) == std::vector<std::string>{
+      "push %r1", "call @h", "pop %r1", "mov %r2, $id0", "push %r3"});
+    CHECK(lines[7].rfind("load %r4", 0) == 0);
+    CHECK(lines[8] == "pop %r3");
+    CHECK(optimizer.getStats().redundantSaves == 1);
+  }
+
+  SECTION("Saves around a recursive call are kept") {
+    auto statements = parseSource(R"(
+      .global @factorial
+      #factorial
+        cmp %r1, $id0
+        br ^eq @base_case
+        push %r1
+        dec %r1
+        call @factorial
+        mov %r2, %r1
+        pop %r1
+        mul %r1, %r1, %r2
+        ret
+      #base_case
+        mov %r1, $id1
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.eliminateDeadStores(statements) == 0);
+  }
+}
+
+TEST_CASE("Calls followed by ret become jumps", "[optimizer]") {
+  SECTION("Directly and through a label") {
+    auto statements = parseSource(R"(
+      .global @f
+      .global @g
+      #f
+        cmp %r1, $id0
+        br ^eq @done
+        dec %r1
+        call @f
+      #done
+        ret
+      #g
+        call @f
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.convertTailCalls(statements) == 2);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", ".global", "f:", "cmp %r1, $id0", "br @done", "dec %r1", "jmp @f", "done:", "ret",
+      "g:", "jmp @f"});
+    CHECK(optimizer.getStats().tailCalls == 2);
+  }
+
+  SECTION("Calls with values pushed are kept") {
+    auto statements = parseSource(R"(
+      .global @f
+      .global @g
+      #f
+        push %r1
+        call @g
+        pop %r1
+        call @g
+        ret
+      #g
+        push %r2
+        cmp %r1, $id0
+        br ^eq @skip
+        pop %r2
+      #skip
+        call @f
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.convertTailCalls(statements) == 1);
+
+    // @skip is reached with and without r2 pushed, so its depth is unknown
+    auto lines = listing(statements);
+    CHECK(std::vector<std::string>(lines.begin() + 2, lines.begin() + 8) == std::vector<std::string>{
+      "f:", "push %r1", "call @g", "pop %r1", "jmp @g", "g:"});
+    CHECK(lines[lines.size() - 2] == "call @f");
+    CHECK(lines.back() == "ret");
+  }
+
+  SECTION("The last call to a local function is kept") {
+    auto statements = parseSource(R"(
+      .global @main
+      #main
+        call @helper
+        ret
+      #helper
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.convertTailCalls(statements) == 0);
+  }
+
+  SECTION("A local function's calls to itself are converted") {
+    auto statements = parseSource(R"(
+      .global @main
+      #main
+        mov %r1, $id10
+        call @count
+        ret
+      #count
+        cmp %r1, $id0
+        br ^eq @done
+        dec %r1
+        call @count
+        ret
+      #done
+        ret
+    )");
+
+    // The call from main keeps @count an entry
+    casm::Optimizer optimizer;
+    CHECK(optimizer.convertTailCalls(statements) == 1);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "main:", "mov %r1, $id10", "call @count", "ret",
+      "count:", "cmp %r1, $id0", "br @done", "dec %r1", "jmp @count", "done:", "ret"});
+  }
+}
+
+TEST_CASE("Small leaf functions are inlined", "[optimizer]") {
+  SECTION("Calls are replaced by the body and the function is dropped") {
+    auto statements = parseSource(R"(
+      .global @main
+      #main
+        mov %v1, $id1
+        call @twice
+      #again
+        call @twice
+        call @print
+        ret
+      #twice
+        mov %v1, %r1
+        add %r1, %r1, %v1
+        ret
+      #print
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.inlineCalls(statements) == 3);
+    optimizer.eliminateDeadCode(statements);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "main:", "mov %v1, $id1", "mov %v2, %r1", "add %r1, %r1, %v2",
+      "again:", "mov %v3, %r1", "add %r1, %r1, %v3", "ret"});
+    CHECK(optimizer.getStats().unreachableBlocks == 2);
+  }
+
+  SECTION("Exported, large and non-leaf functions are called") {
+    auto statements = parseSource(R"(
+      .global @main
+      .global @exported
+      #main
+        call @exported
+        call @large
+        call @caller
+        call @unbalanced
+        ret
+      #exported
+        ret
+      #large
+        inc %r1
+        inc %r2
+        inc %r3
+        inc %r4
+        inc %r5
+        ret
+      #caller
+        call @exported
+        ret
+      #unbalanced
+        push %r1
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.inlineCalls(statements) == 0);
+
+    casm::Optimizer larger(5);
+    CHECK(larger.inlineCalls(statements) == 1);
+    CHECK(larger.getStats().inlinedCalls == 1);
+  }
+}
+
+TEST_CASE("Jumps are threaded and folded", "[optimizer]") {
+  SECTION("Chains, inverted branches and jumps to the next block") {
+    auto statements = parseSource(R"(
+      .global @f
+      #f
+        cmp %r1, $id0
+        br ^lt @negative
+        jmp @positive
+      #negative
+        jmp @hop
+      #hop
+        jmp @done
+      #positive
+        inc %r1
+        jmp @next
+      #next
+        dec %r2
+      #done
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.threadJumps(statements) == 3);
+    CHECK(optimizer.getStats().threadedJumps == 1);
+    CHECK(optimizer.getStats().invertedBranches == 1);
+    CHECK(optimizer.getStats().fallThroughJumps == 1);
+
+    // br ^lt over jmp @positive becomes br ^gte @positive; negative is left for dead-code elimination
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "f:", "cmp %r1, $id0", "br @positive", "negative:", "jmp @done", "hop:", "jmp @done",
+      "positive:", "inc %r1", "next:", "dec %r2", "done:", "ret"});
+    CHECK(statements[3].getInstruction()->getParameters() == std::vector<std::string>{"gte"});
+  }
+
+  SECTION("Loops and labelled jumps are kept") {
+    auto statements = parseSource(R"(
+      .global @f
+      #f
+        br ^eq @loop
+      #skip
+        jmp @f
+      #loop
+        jmp @spin
+      #other
+        ret
+      #spin
+        jmp @loop
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.threadJumps(statements) == 0);
+  }
+}
+
+TEST_CASE("Blocks are laid out by profile", "[optimizer]") {
+  const std::string source = R"(
+    .global @f
+    #f
+      cmp %r1, $id0
+      br ^eq @rare
+    #hot
+      dec %r1
+      br ^neq @hot
+      ret
+    #rare
+      mov %r1, $id1
+    #cold
+      inc %r2
+      ret
+  )";
+
+  SECTION("Hot paths fall through and cold blocks move to the end") {
+    auto statements = parseSource(source);
+    std::istringstream input("@f @f 10\n@f @rare 9\n@f @hot 1\n@f @cold 9\n");
+    casm::Profile profile = casm::Profile::parse(input);
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.reorderBlocks(statements, profile) == 1);
+    CHECK(optimizer.getStats().reorderedFunctions == 1);
+
+    // rare now follows the branch to it, which is inverted to reach hot instead
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "f:", "cmp %r1, $id0", "br @hot", "rare:", "mov %r1, $id1", "cold:", "inc %r2", "ret",
+      "hot:", "dec %r1", "br @hot", "ret"});
+    CHECK(statements[3].getInstruction()->getParameters() == std::vector<std::string>{"neq"});
+
+    // The same profile gives the same layout
+    auto again = parseSource(source);
+    casm::Optimizer other;
+    other.reorderBlocks(again, profile);
+    CHECK(listing(again) == listing(statements));
+  }
+
+  SECTION("Lost fall-throughs become jumps") {
+    auto statements = parseSource(source);
+    std::istringstream input("@f @f 10\n@f @rare 9\n@f @hot 1\n");
+    casm::Profile profile = casm::Profile::parse(input);
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.reorderBlocks(statements, profile) == 1);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "f:", "cmp %r1, $id0", "br @hot", "rare:", "mov %r1, $id1", "jmp @cold",
+      "hot:", "dec %r1", "br @hot", "ret", "cold:", "inc %r2", "ret"});
+  }
+
+  SECTION("Functions without counts keep their layout") {
+    auto statements = parseSource(source);
+    std::istringstream input("@g @g 10\n");
+    casm::Profile profile = casm::Profile::parse(input);
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.reorderBlocks(statements, profile) == 0);
+  }
+}
+
+TEST_CASE("Functions are ordered by call graph", "[optimizer]") {
+  SECTION("Callees follow their callers along the heaviest calls") {
+    auto statements = parseSource(R"(
+      .global @main
+      #main
+        call @leaf
+        ret
+      #a
+        mov %r1, $id1
+        ret
+      #b
+        call @a
+        call @a
+        ret
+      #leaf
+        call @b
+        ret
+    )");
+
+    // b-a is merged first; leaf joins main, then b comes next to leaf
+    casm::Optimizer optimizer;
+    CHECK(optimizer.orderFunctions(statements, casm::Profile()) == 2);
+    CHECK(optimizer.getStats().orderedFunctions == 2);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "main:", "call @leaf", "ret", "leaf:", "call @b", "ret",
+      "b:", "call @a", "call @a", "ret", "a:", "mov %r1, $id1", "ret"});
+  }
+
+  SECTION("A profile weights calls by how often they ran") {
+    const std::string source = R"(
+      .global @main
+      #main
+        call @a
+        cmp %r1, $id0
+        br ^eq @done
+      #loop
+        call @b
+        dec %r1
+        br ^neq @loop
+      #done
+        ret
+      #a
+        ret
+      #b
+        ret
+    )";
+
+    auto statements = parseSource(source);
+    casm::Optimizer optimizer;
+    CHECK(optimizer.orderFunctions(statements, casm::Profile()) == 0);
+
+    std::istringstream input("@main @main 1\n@main @loop 1000\n");
+    casm::Profile profile = casm::Profile::parse(input);
+    CHECK(optimizer.orderFunctions(statements, profile) == 2);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", "main:", "call @a", "cmp %r1, $id0", "br @done", "loop:", "call @b", "dec %r1", "br @loop",
+      "done:", "ret", "b:", "ret", "a:", "ret"});
+  }
+
+  SECTION("Fall-throughs stay together and alignment moves with its function") {
+    auto statements = parseSource(R"(
+      .global @main
+      .global @near
+      #main
+        call @c
+        ret
+      #near
+        inc %r1
+      #far
+        ret
+        .align $id8
+      #c
+        call @far
+        ret
+    )");
+
+    casm::Optimizer optimizer;
+    CHECK(optimizer.orderFunctions(statements, casm::Profile()) == 3);
+    CHECK(listing(statements) == std::vector<std::string>{
+      ".global", ".global", "main:", "call @c", "ret", ".align", "c:", "call @far", "ret",
+      "near:", "inc %r1", "far:", "ret"});
+  }
+}
@@ -0,0 +1,45 @@
+#include <catch2/catch_all.hpp>
+#include "casm/profile.hpp"
+#include <sstream>
+#include <string>
+
+using namespace Catch;
+
+TEST_CASE("Profiles are parsed by function and block", "[profile]") {
+  std::istringstream input(R"(
+    ; function  block   count
+    @fact       @fact   1000
+    fact        #loop   250000   ; labels may be written bare or with # or @
+    @fact       @loop   5
+    @main       @main   1
+  )");
+
+  casm::Profile profile = casm::Profile::parse(input);
+  CHECK_FALSE(profile.empty());
+  CHECK(profile.hasFunction("fact"));
+  CHECK(profile.hasFunction("main"));
+  CHECK_FALSE(profile.hasFunction("loop"));
+  CHECK(profile.count("fact", "fact") == 1000);
+  CHECK(profile.count("fact", "loop") == 250005);
+  CHECK(profile.count("fact", "error") == 0);
+  CHECK(profile.count("other", "other") == 0);
+}
+
+TEST_CASE("Malformed profiles are rejected with their line", "[profile]") {
+  auto parse = [](const std::string& text) {
+    std::istringstream input(text);
+    return casm::Profile::parse(input, "test.prof");
+  };
+
+  CHECK_THROWS_AS(parse("@f @f\n"), casm::ProfileException);
+  CHECK_THROWS_AS(parse("@f @f 1 2\n"), casm::ProfileException);
+  CHECK_THROWS_AS(parse("@f @f -1\n"), casm::ProfileException);
+  CHECK_THROWS_AS(parse("@ @f 1\n"), casm::ProfileException);
+
+  try {
+    parse("; header\n@f @f 12x\n");
+    FAIL("Expected a ProfileException");
+  } catch (const casm::ProfileException& e) {
+    CHECK(std::string(e.what()).find("test.prof:2: Invalid count: 12x") != std::string::npos);
+  }
+}
@@ -0,0 +1,278 @@
+#include <catch2/catch_all.hpp>
+#include "casm/lexer.hpp"
+#include "casm/parser.hpp"
+#include "casm/regalloc.hpp"
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace Catch;
+
+namespace {
+
+std::vector<casm::Statement> parseSource(const std::string& source) {
+  casm::Lexer lexer("test", source);
+  casm::Parser parser(lexer);
+  std::vector<casm::Statement> statements = parser.parse();
+  REQUIRE(parser.getErrors().empty());
+  return statements;
+}
+
+// Operand in source syntax, with immediates printed in decimal
+std::string operandText(const casm::Operand& operand) {
+  if (operand.getType() == casm::Operand::Type::Immediate) {
+    const casm::ImmediateValue& value = static_cast<const casm::ImmediateOperand&>(operand).getValue();
+    if (value.format == casm::ImmediateFormat::Integer) {
+      return "$id" + std::to_string(std::get<casm::i64>(value.value));
+    }
+  }
+  return operand.toString();
+}
+
+// Instructions in source syntax, one per line, with their labels
+std::vector<std::string> listing(const std::vector<casm::Statement>& statements) {
+  std::vector<std::string> lines;
+  for (const auto& stmt : statements) {
+    if (const casm::Instruction* instr = stmt.getInstruction()) {
+      std::string line = stmt.getLabel().empty() ? "" : stmt.getLabel() + ": ";
+      line += instr->getName();
+      const auto& operands = instr->getOperands();
+      for (size_t i = 0; i < operands.size(); ++i) {
+        line += (i == 0 ? " " : ", ") + operandText(*operands[i]);
+      }
+      lines.push_back(line);
+    }
+  }
+  return lines;
+}
+
+} // namespace
+
+TEST_CASE("Virtual registers share physical registers", "[regalloc]") {
+  auto statements = parseSource(R"(
+    .global @f
+    #f
+      mov %v1, %r1
+      add %v2, %v1, $id1
+      mul %v3, %v2, %v1
+      mov %r1, %v3
+      ret
+  )");
+  REQUIRE(casm::RegisterAllocator::usesVirtualRegisters(statements));
+
+  casm::RegisterAllocator allocator(16);
+  allocator.allocate(statements);
+  CHECK_FALSE(casm::RegisterAllocator::usesVirtualRegisters(statements));
+
+  // r1 is named by the function, so it is never assigned; v3 reuses the register of v1
+  auto lines = listing(statements);
+  REQUIRE(lines.size() == 5);
+  CHECK(lines[0] == "mov %r0, %r1");
+  CHECK(lines[1] == "add %r2, %r0, $id1");
+  CHECK(lines[2] == "mul %r0, %r2, %r0");
+  CHECK(lines[3] == "mov %r1, %r0");
+
+  const auto& allocations = allocator.getAllocations();
+  REQUIRE(allocations.size() == 1);
+  CHECK(allocations[0].function == "f");
+  CHECK(allocations[0].registers.size() == 3);
+  CHECK(allocations[0].spills.empty());
+  CHECK(allocations[0].frameSize == 0);
+}
+
+TEST_CASE("Virtual registers are spilled when registers run out", "[regalloc]") {
+  SECTION("More values live than registers") {
+    auto statements = parseSource(R"(
+      .global @g
+      #g
+        mov %v1, $id1
+        mov %v2, $id2
+        mov %v3, $id3
+        mov %v4, $id4
+        add %v5, %v1, %v2
+        add %v5, %v5, %v3
+        add %v5, %v5, %v4
+        push %v5
+        ret
+    )");
+
+    // One of r0 to r2 is held back for reloads, so the two values ending last are spilled
+    casm::RegisterAllocator allocator(3);
+    allocator.allocate(statements);
+    CHECK(listing(statements) == std::vector<std::string>{
+      "mov %r0, $id1", "mov %r1, $id2",
+      "mov %r2, $id3", "store @__spill_g_0, %r2",
+      "mov %r2, $id4", "store @__spill_g_1, %r2",
+      "add %r0, %r0, %r1",
+      "load %r2, @__spill_g_0", "add %r0, %r0, %r2",
+      "load %r2, @__spill_g_1", "add %r0, %r0, %r2",
+      "push %r0", "ret"});
+
+    const auto& allocation = allocator.getAllocations().at(0);
+    CHECK(allocation.spills == std::map<std::string, std::string>{{"v3", "__spill_g_0"}, {"v4", "__spill_g_1"}});
+    CHECK(allocation.frameSize == 16);
+    CHECK(allocation.registers.size() == 3);
+
+    // The slots are reserved after the code
+    REQUIRE(statements.size() >= 4);
+    const casm::Directive* section = statements[statements.size() - 4].getDirective();
+    REQUIRE(section != nullptr);
+    CHECK(section->getKind() == casm::DirectiveKind::Section);
+    CHECK(statements[statements.size() - 2].getLabel() == "__spill_g_0");
+    CHECK(statements.back().getLabel() == "__spill_g_1");
+    REQUIRE(statements.back().getDirective() != nullptr);
+    CHECK(statements.back().getDirective()->getKind() == casm::DirectiveKind::Zero);
+  }
+
+  SECTION("Slot labels avoid the program's own") {
+    auto statements = parseSource(R"(
+      .global @g
+      #g
+        mov %v1, $id1
+        mov %v2, $id2
+        mov %v3, $id3
+        mov %v4, $id4
+        add %v5, %v1, %v2
+      #again add %v5, %v5, %v3
+        add %v5, %v5, %v4
+        store @__spill_g_0, %v5
+        ret
+    )");
+
+    // The label moves to the reload in front of its instruction
+    casm::RegisterAllocator allocator(3);
+    allocator.allocate(statements);
+    auto lines = listing(statements);
+    REQUIRE(lines.size() == 13);
+    CHECK(lines[7] == "again: load %r2, @___spill_g_0");
+    CHECK(lines[8] == "add %r0, %r0, %r2");
+    CHECK(lines[11] == "store @__spill_g_0, %r0");
+    CHECK(allocator.getAllocations().at(0).spills ==
+          std::map<std::string, std::string>{{"v3", "___spill_g_0"}, {"v4", "__spill_g_1"}});
+  }
+
+  SECTION("Too few registers") {
+    auto statements = parseSource(R"(
+      .global @f
+      #f
+        mov %v1, $id1
+        ret
+    )");
+
+    casm::RegisterAllocator allocator(0);
+    CHECK_THROWS_AS(allocator.allocate(statements), casm::RegisterAllocationException);
+  }
+}
+
+TEST_CASE("Values live across calls are saved only where the callee may change them", "[regalloc]") {
+  SECTION("A callee that leaves the register alone") {
+    auto statements = parseSource(R"(
+      .global @main
+      #main
+        load %v0, @x
+        call @g
+        store @y, %v0
+        ret
+      #g
+        mov %r2, $id5
+        ret
+    )");
+
+    casm::RegisterAllocator allocator(16);
+    allocator.allocate(statements);
+    CHECK(listing(statements) == std::vector<std::string>{
+      "load %r0, @x", "call @g", "store @y, %r0", "ret", "mov %r2, $id5", "ret"});
+
+    const auto& allocation = allocator.getAllocations().at(0);
+    CHECK(allocation.registers.at("v0") == "r0");
+    CHECK(allocation.spills.empty());
+    CHECK(allocation.callSaves == 0);
+  }
+
+  SECTION("A recursive call pushes the registers it writes") {
+    auto statements = parseSource(R"(
+      .global @h
+      #h
+        mov %v1, %r1
+        call @h
+        add %r1, %r1, %v1
+        ret
+    )");
+
+    casm::RegisterAllocator allocator(16);
+    allocator.allocate(statements);
+    CHECK(listing(statements) == std::vector<std::string>{
+      "mov %r0, %r1", "push %r0", "call @h", "pop %r0", "add %r1, %r1, %r0", "ret"});
+    CHECK(allocator.getAllocations().at(0).callSaves == 1);
+  }
+
+  SECTION("Nested functions spilling across calls keep their own slots") {
+    auto statements = parseSource(R"(
+      .global @main
+      #main
+        mov %v1, $id1
+        mov %v2, $id2
+        mov %v3, $id3
+        call @g
+        add %v1, %v1, %v2
+        add %v1, %v1, %v3
+        store @x, %v1
+        ret
+      #g
+        mov %v1, $id4
+        mov %v2, $id5
+        mov %v3, $id6
+        call @h
+        add %v1, %v1, %v2
+        add %v1, %v1, %v3
+        store @y, %v1
+        ret
+      #h
+        ret
+    )");
+
+    // Neither call can lead back into its caller, so the slots stay where they are
+    casm::RegisterAllocator allocator(2);
+    allocator.allocate(statements);
+    auto lines = listing(statements);
+    CHECK(std::count(lines.begin(), lines.end(), "store @__spill_main_0, %r0") > 0);
+    CHECK(std::count(lines.begin(), lines.end(), "store @__spill_g_0, %r0") > 0);
+    CHECK(std::none_of(lines.begin(), lines.end(), [](const std::string& line) { return line.rfind("push", 0) == 0; }));
+
+    const auto& allocations = allocator.getAllocations();
+    REQUIRE(allocations.size() == 2);
+    CHECK(allocations[0].frameSize == 24);
+    CHECK(allocations[1].frameSize == 24);
+    CHECK(allocations[0].callSaves == 0);
+    CHECK(allocations[1].callSaves == 0);
+  }
+
+  SECTION("Slots are pushed around calls that may come back") {
+    auto statements = parseSource(R"(
+      .global @f
+      #f
+        load %v1, @a
+        load %v2, @b
+        load %v3, @c
+        call @f
+        add %v2, %v2, %v3
+        add %v1, %v1, %v2
+        store @a, %v1
+        ret
+    )");
+
+    // Every value is spilled; the recursive call would overwrite the slots
+    casm::RegisterAllocator allocator(2);
+    allocator.allocate(statements);
+    auto lines = listing(statements);
+    auto call = std::find(lines.begin(), lines.end(), "call @f");
+    REQUIRE(call - lines.begin() >= 6);
+    REQUIRE(lines.end() - call >= 7);
+    CHECK(std::vector<std::string>(call - 6, call + 7) == std::vector<std::string>{
+      "load %r0, @__spill_f_0", "push %r0", "load %r0, @__spill_f_1", "push %r0",
+      "load %r0, @__spill_f_2", "push %r0", "call @f",
+      "pop %r0", "store @__spill_f_2, %r0", "pop %r0", "store @__spill_f_1, %r0",
+      "pop %r0", "store @__spill_f_0, %r0"});
+    CHECK(allocator.getAllocations().at(0).callSaves == 3);
+  }
+}
@@ -0,0 +1,48 @@
+#include <catch2/catch_all.hpp>
+#include "casm/symbols.hpp"
+#include <string>
+
+using namespace Catch;
+
+TEST_CASE("Symbol table interns names to dense IDs", "[symbols]") {
+  casm::SymbolTable<int> table;
+  
+  casm::SymbolId main = table.intern("main");
+  casm::SymbolId loop = table.intern("loop");
+  
+  CHECK(main == 0);
+  CHECK(loop == 1);
+  CHECK(table.intern("main") == main);
+  CHECK(table.size() == 2);
+  
+  CHECK(table.find("loop") == loop);
+  CHECK(table.find("missing") == casm::NO_SYMBOL);
+  CHECK(table.get("missing") == nullptr);
+  
+  table[loop] = 42;
+  REQUIRE(table.get("loop") != nullptr);
+  CHECK(*table.get("loop") == 42);
+  CHECK(table.name(main) == "main");
+}
+
+TEST_CASE("Symbol table keeps insertion order while growing", "[symbols]") {
+  casm::SymbolTable<size_t> table;
+  
+  for (size_t i = 0; i < 5000; ++i) {
+    casm::SymbolId id = table.intern("sym" + std::to_string(i));
+    table[id] = i;
+  }
+  
+  REQUIRE(table.size() == 5000);
+  
+  bool ordered = true;
+  for (casm::SymbolId id = 0; id < table.size(); ++id) {
+    ordered = ordered && table.name(id) == "sym" + std::to_string(id) && table[id] == id;
+    ordered = ordered && table.find(table.name(id)) == id;
+  }
+  CHECK(ordered);
+  
+  table.clear();
+  CHECK(table.empty());
+  CHECK(table.find("sym1") == casm::NO_SYMBOL);
+}